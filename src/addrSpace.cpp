@@ -17,50 +17,184 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "addrSpace.h"
+#include "debugstream.h"
+#include "optionsList.h"
 #include "utils.h"
+#include <algorithm>
 #include <climits>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
+
+/// Reads the whole of \p File, which may be a /proc file with no size.
+static std::string readProcFile(const std::string &File) {
+  int Fd = openSafe(File.c_str(), O_RDONLY);
+  std::string Contents;
+  char Buf[16384];
+  ssize_t Bytes;
+  while ((Bytes = read(Fd, Buf, sizeof(Buf))) > 0)
+    Contents.append(Buf, Bytes);
+  closeSafe(Fd);
+  return Contents;
+}
+
+std::string AddressSpace::Region::getModuleName() const {
+  size_t Slash = Path.rfind('/');
+  return Slash == std::string::npos ? Path : Path.substr(Slash + 1);
+}
+
+void AddressSpace::Region::dump() const {
+  static const char *KindStr[] = {"exe", "lib", "vdso", "stack", "anon"};
+  fprintf(stderr, "0x%lx-0x%lx %-5s %s\n", From, To,
+          KindStr[static_cast<int>(Kind)], Path.c_str());
+}
+
+unsigned long AddressSpace::readVmSize() const {
+  // The first field of statm is the total program size in pages. It changes
+  // with every mmap(), munmap() and brk() that is not a pure remapping.
+  std::string Statm = readProcFile("/proc/" + std::to_string(Pid) + "/statm");
+  return strtoul(Statm.c_str(), nullptr, 10);
+}
 
 void AddressSpace::parse() {
-  // Parse /proc/<Pid>/maps to extract the address range and file path.
-  std::string ProcFile("/proc/" + std::to_string(Pid) + "/maps");
-  std::fstream FS(ProcFile, std::fstream::in);
-  if (FS.fail())
-    die(__FUNCTION__, "(): Failed to open ", ProcFile);
-
-  std::string Line;
-  while (std::getline(FS, Line) && !FS.eof()) {
-    unsigned long From, To;
-    char Permissions[5];
-    unsigned long Num;
-    char Dev[6];
-    unsigned long Inode;
-    char Path[PATH_MAX];
-    sscanf(Line.c_str(), "%lx-%lx %4s %lx %5s %ld %s", &From, &To, Permissions,
-           &Num, Dev, &Inode, Path);
-    MappingsSet.insert(Mapping(From, To, Path));
+  std::string ProcDir = "/proc/" + std::to_string(Pid);
+  char ExePath[PATH_MAX];
+  ssize_t ExeLen = readlink((ProcDir + "/exe").c_str(), ExePath,
+                            sizeof(ExePath) - 1);
+  ExePath[ExeLen > 0 ? ExeLen : 0] = '\0';
+  // Read the size first, so that a change while we parse is seen next time.
+  ParsedVmSize = readVmSize();
+  std::string Maps = readProcFile(ProcDir + "/maps");
+
+  // Each line is: from-to perms offset dev inode [path]
+  Regions.clear();
+  const char *Ptr = Maps.c_str();
+  const char *End = Ptr + Maps.size();
+  while (Ptr < End) {
+    const char *EOL = static_cast<const char *>(memchr(Ptr, '\n', End - Ptr));
+    if (EOL == nullptr)
+      EOL = End;
+    Region R;
+    char *Next;
+    R.From = strtoul(Ptr, &Next, 16);
+    R.To = strtoul(Next + 1, &Next, 16);
+    // Skip the permissions.
+    Next = const_cast<char *>(
+        static_cast<const char *>(memchr(Next + 1, ' ', EOL - Next - 1)));
+    R.Offset = strtoul(Next + 1, &Next, 16);
+    // Skip the device and the inode.
+    for (int Field = 0; Field != 2 && Next < EOL; ++Field) {
+      while (Next < EOL && *Next == ' ')
+        ++Next;
+      while (Next < EOL && *Next != ' ')
+        ++Next;
+    }
+    while (Next < EOL && *Next == ' ')
+      ++Next;
+    R.Path.assign(static_cast<const char *>(Next), EOL);
+    const std::string Deleted = " (deleted)";
+    if (R.Path.size() > Deleted.size() &&
+        R.Path.compare(R.Path.size() - Deleted.size(), Deleted.size(),
+                       Deleted) == 0)
+      R.Path.resize(R.Path.size() - Deleted.size());
+
+    if (R.Path.empty())
+      R.Kind = RegionKind::Anonymous;
+    else if (R.Path == ExePath)
+      R.Kind = RegionKind::MainExe;
+    else if (R.Path[0] == '/')
+      R.Kind = RegionKind::Library;
+    else if (R.Path == "[stack]")
+      R.Kind = RegionKind::Stack;
+    else if (R.Path == "[vdso]" || R.Path == "[vvar]" ||
+             R.Path == "[vsyscall]")
+      R.Kind = RegionKind::Vdso;
+    else
+      R.Kind = RegionKind::Anonymous;
+    Regions.push_back(std::move(R));
+    Ptr = EOL + 1;
   }
-  FS.close();
+  // The kernel lists them sorted, but don't rely on it for the lookups.
+  std::sort(Regions.begin(), Regions.end(),
+            [](const Region &R1, const Region &R2) { return R1.From < R2.From; });
+  dbg(3) << "Parsed " << Regions.size() << " mappings of " << Pid << "\n";
 }
 
-AddressSpace::AddressSpace(pid_t Pid) : Pid(Pid) { parse(); }
+const AddressSpace::Region *AddressSpace::lookup(unsigned long Addr) const {
+  auto It = std::upper_bound(
+      Regions.begin(), Regions.end(), Addr,
+      [](unsigned long Addr, const Region &R) { return Addr < R.From; });
+  if (It == Regions.begin())
+    return nullptr;
+  --It;
+  return Addr < It->To ? &*It : nullptr;
+}
 
-bool AddressSpace::isInLibrary(unsigned long Addr) const {
-  Mapping AddrMapping(Addr);
-  auto It = MappingsSet.find(AddrMapping);
-  if (It == MappingsSet.end()) {
+void AddressSpace::refresh() {
+  if (ParsedVmSize == 0 || readVmSize() != ParsedVmSize)
+    parse();
+}
+
+const AddressSpace::Region *AddressSpace::findRegion(unsigned long Addr) {
+  if (ParsedVmSize == 0)
+    parse();
+  if (const Region *R = lookup(Addr))
+    return R;
+  // The mapping may be newer than our copy, e.g., a remapping of the same size.
+  parse();
+  return lookup(Addr);
+}
+
+bool AddressSpace::isInLibrary(unsigned long Addr) {
+  const Region *R = findRegion(Addr);
+  if (R == nullptr) {
     dump();
     die("Could not find addr ", Addr, " in address space");
   }
-  const Mapping &FoundMapping = *It;
-  const std::string &Path = FoundMapping.Path;
-  // Return true if the paths ends in .so
-  std::string So = ".so";
-  bool Found = Path.rfind(So) == Path.size() - So.size();
-  return Found;
+  return R->Kind == RegionKind::Library || R->Kind == RegionKind::Vdso;
+}
+
+bool AddressSpace::isInjectable(unsigned long Addr) {
+  if (DontInjectToLibs && isInLibrary(Addr))
+    return false;
+  static const std::vector<std::string> Allowed =
+      splitList(InjectToModules.getValue());
+  static const std::vector<std::string> Denied =
+      splitList(DontInjectToModules.getValue());
+  if (Allowed.empty() && Denied.empty())
+    return true;
+  const Region *R = findRegion(Addr);
+  if (R == nullptr)
+    return false;
+  std::string Name = R->getModuleName();
+  if (!Allowed.empty() && !matchesAny(Allowed, Name))
+    return false;
+  return !matchesAny(Denied, Name);
+}
+
+bool AddressSpace::getFileOffset(unsigned long Addr, std::string &Path,
+                                 unsigned long &Offset) {
+  const Region *R = findRegion(Addr);
+  if (R == nullptr || R->Path.empty() || R->Path[0] != '/')
+    return false;
+  Path = R->Path;
+  Offset = Addr - R->From + R->Offset;
+  return true;
+}
+
+bool AddressSpace::getAddress(const std::string &Path, unsigned long Offset,
+                              unsigned long &Addr) {
+  if (ParsedVmSize == 0)
+    parse();
+  for (const Region &R : Regions)
+    if (R.Path == Path && Offset >= R.Offset &&
+        Offset - R.Offset < R.To - R.From) {
+      Addr = R.From + Offset - R.Offset;
+      return true;
+    }
+  return false;
 }
 
 void AddressSpace::dump() const {
-  for (const auto &Entry : MappingsSet)
-    Entry.dump();
+  for (const Region &R : Regions)
+    R.dump();
 }
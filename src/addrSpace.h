@@ -20,54 +20,105 @@
 #ifndef __ADDRSPACE_H__
 #define __ADDRSPACE_H__
 
-#include <cassert>
-#include <set>
 #include <string>
+#include <sys/types.h>
+#include <vector>
 
-/// Holds the information about the address space of a process.
+/// Holds the information about the address space of a process. The mappings
+/// are parsed from /proc/<pid>/maps only when they are first needed, and again
+/// only after they change.
 class AddressSpace {
-  /// Holds an address mapping entry.
-  struct Mapping {
+public:
+  /// The kind of a mapping.
+  enum class RegionKind {
+    /// The executable of the process.
+    MainExe,
+    /// Any other file, usually a shared library.
+    Library,
+    /// The vdso, vvar and vsyscall pages of the kernel.
+    Vdso,
+    /// The stack of the main thread.
+    Stack,
+    /// Anonymous memory, like the heap, thread stacks or JIT code.
+    Anonymous,
+  };
+
+  /// An address mapping entry.
+  struct Region {
     /// Address space start.
     unsigned long From = 0;
-    /// Address space end.
+    /// Address space end, exclusive.
     unsigned long To = 0;
-    /// The path mapped to this address space.
+    /// The offset in the file of the start of the mapping.
+    unsigned long Offset = 0;
+    /// The path mapped to this address space, or the pseudo-path like [heap].
     std::string Path;
-    /// Normal entry constructor.
-    Mapping(unsigned long From, unsigned long To, const char *Path)
-        : From(From), To(To), Path(Path) {
-      assert(From <= To && "Expected range.");
-    }
-    /// Query constructor for checking if \p Addr is in the address space.
-    Mapping(unsigned long Addr) : Mapping(Addr, Addr, "Query") {}
-    /// Methods to support std::set.
-    bool operator<(const Mapping &M2) const {
-      // Equivalence is checked by comparing reflexively, so query mappings
-      // should return false in A<B && !B<A.
-      return From < M2.From && To < M2.To;
-    }
+    RegionKind Kind = RegionKind::Anonymous;
+    /// \Returns the name of the module, which is the file name of the path.
+    std::string getModuleName() const;
     /// Debug print.
-    void dump() const {
-      fprintf(stderr, "0x%lx-0x%lx %s\n", From, To, Path.c_str());
-    }
+    void dump() const;
   };
 
+private:
   /// The process id.
   pid_t Pid = 0;
 
-  /// Map start address to end address and path.
-  std::set<Mapping> MappingsSet;
+  /// The mappings, sorted by address. They don't overlap.
+  std::vector<Region> Regions;
+
+  /// The size of the address space when we parsed it, or 0 if not parsed.
+  unsigned long ParsedVmSize = 0;
+
+  /// \Returns the current size of the address space of the process.
+  unsigned long readVmSize() const;
 
   /// Parse /proc/<Pid>/maps to extract the complete address mapping.
   void parse();
 
+  /// \Returns the region of \p Addr, or nullptr if it is not mapped.
+  const Region *lookup(unsigned long Addr) const;
+
 public:
-  /// Initialize the address space for process \p Pid.
-  AddressSpace(pid_t Pid);
+  /// Initialize the address space for process \p Pid. This does not parse it.
+  explicit AddressSpace(pid_t Pid) : Pid(Pid) {}
+
+  /// Initialize the address space for process \p Pid as a copy of \p AS,
+  /// which belongs to a process that \p Pid is a fork of.
+  AddressSpace(const AddressSpace &AS, pid_t Pid) : AddressSpace(AS) {
+    this->Pid = Pid;
+  }
+
+  /// \Returns the process id.
+  pid_t getPid() const { return Pid; }
+
+  /// Parse the mappings again if the size of the address space has changed
+  /// since they were parsed. Call this every time the process has run.
+  void refresh();
+
+  /// Forget the mappings, e.g., after an execve().
+  void invalidate() { ParsedVmSize = 0; }
+
+  /// \Returns the region of \p Addr, or nullptr if it is not mapped. If it is
+  /// not in the mappings we know of, they are parsed again.
+  const Region *findRegion(unsigned long Addr);
 
   /// \Returns true if \p Addr is in the address space mapped to a library.
-  bool isInLibrary(unsigned long Addr) const;
+  bool isInLibrary(unsigned long Addr);
+
+  /// \Returns true if the filters of the command line allow injecting faults
+  /// to the instruction at \p Addr.
+  bool isInjectable(unsigned long Addr);
+
+  /// Set \p Path to the file mapped at \p Addr and \p Offset to the offset of
+  /// \p Addr in it. \Returns false if \p Addr is not in a file mapping.
+  bool getFileOffset(unsigned long Addr, std::string &Path,
+                     unsigned long &Offset);
+
+  /// Set \p Addr to the address where offset \p Offset of file \p Path is
+  /// mapped. \Returns false if it is not mapped.
+  bool getAddress(const std::string &Path, unsigned long Offset,
+                  unsigned long &Addr);
 
   /// Debug print.
   void dump() const;
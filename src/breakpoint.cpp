@@ -0,0 +1,58 @@
+// Software breakpoints in the code of a traced process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "breakpoint.h"
+#include "childMemory.h"
+#include "debugstream.h"
+#include "utils.h"
+#include <cassert>
+
+/// The x86 int3 opcode.
+static constexpr const unsigned long Int3 = 0xcc;
+
+Breakpoint::~Breakpoint() {
+  // The process may be gone by now, in which case there is nothing to restore.
+  if (Enabled)
+    ptrace(PTRACE_POKETEXT, Pid, (void *)Addr, (void *)SavedWord);
+}
+
+void Breakpoint::enable() {
+  assert(!Enabled && "Already enabled");
+  if (ChildMemory(Pid).read(Addr, &SavedWord, sizeof(SavedWord)) !=
+      sizeof(SavedWord))
+    die("Cannot read breakpoint address ", (void *)Addr);
+  unsigned long Patched = (SavedWord & ~0xfful) | Int3;
+  ptraceSafe(PTRACE_POKETEXT, Pid, (void *)Addr, (void *)Patched);
+  Enabled = true;
+  dbg(2) << "Breakpoint at " << (void *)Addr << " enabled\n";
+}
+
+void Breakpoint::disable() {
+  assert(Enabled && "Not enabled");
+  ptraceSafe(PTRACE_POKETEXT, Pid, (void *)Addr, (void *)SavedWord);
+  Enabled = false;
+  dbg(2) << "Breakpoint at " << (void *)Addr << " disabled\n";
+}
+
+void Breakpoint::rewind(pid_t Tid) const {
+  user_regs_struct Regs;
+  ptraceSafe(PTRACE_GETREGS, Tid, nullptr, &Regs);
+  assert(isHit(Regs) && "Thread did not hit this breakpoint");
+  Regs.rip = Addr;
+  ptraceSafe(PTRACE_SETREGS, Tid, nullptr, &Regs);
+}
@@ -0,0 +1,72 @@
+//-*- C++ -*-
+// Software breakpoints in the code of a traced process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __BREAKPOINT_H__
+#define __BREAKPOINT_H__
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+/// An int3 breakpoint in the code of a traced process. The original code is
+/// restored when the breakpoint is disabled or destroyed.
+class Breakpoint {
+  /// The traced process.
+  pid_t Pid = 0;
+
+  /// The address of the breakpoint.
+  unsigned long Addr = 0;
+
+  /// The original code word at Addr.
+  unsigned long SavedWord = 0;
+
+  /// True while the int3 is in the code.
+  bool Enabled = false;
+
+public:
+  /// Create a breakpoint at \p Addr of process \p Pid. This does not enable it.
+  Breakpoint(pid_t Pid, unsigned long Addr) : Pid(Pid), Addr(Addr) {}
+  Breakpoint(const Breakpoint &) = delete;
+  ~Breakpoint();
+
+  /// Write the int3 into the code.
+  void enable();
+
+  /// Restore the original code.
+  void disable();
+
+  /// \Returns true if registers \p Regs belong to a thread that has just
+  /// trapped on this breakpoint.
+  bool isHit(const user_regs_struct &Regs) const {
+    return Regs.rip == Addr + 1;
+  }
+
+  /// Move the IP of thread \p Tid back to the breakpoint address, so that it
+  /// executes the original instruction once the breakpoint is disabled.
+  void rewind(pid_t Tid) const;
+
+  /// Access the code through thread \p Tid from now on, e.g., because the
+  /// thread that we created the breakpoint with is running. \p Tid must be a
+  /// stopped thread of the same process.
+  void setTid(pid_t Tid) { Pid = Tid; }
+
+  /// \Returns the breakpoint address.
+  unsigned long getAddr() const { return Addr; }
+};
+
+#endif //__BREAKPOINT_H__
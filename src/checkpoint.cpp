@@ -0,0 +1,124 @@
+// Snapshots of the golden run that test runs are cloned from.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "checkpoint.h"
+#include "debugstream.h"
+#include "optionsList.h"
+#include "remoteSyscall.h"
+#include "utils.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <sched.h>
+#include <sys/stat.h>
+
+CheckpointRunner::CheckpointRunner(
+    ForkServer *Server, unsigned NumCheckpoints,
+    std::vector<std::unique_ptr<Checkpoint>> &Checkpoints)
+    : RunnerBase(-2, !NoCleanup.getValue(), Server), Checkpoints(Checkpoints),
+      NumCheckpoints(NumCheckpoints) {}
+
+void CheckpointRunner::takeCheckpoint(double Time) {
+  RemoteSyscall RS(ChildPID);
+  pid_t CkptPID = RS.fork(CLONE_PARENT | SIGCHLD);
+  if (CkptPID == 0)
+    die("Failed to take a checkpoint at ", Time, "s");
+  auto Ckpt = std::make_unique<Checkpoint>();
+  Ckpt->Time = Time;
+  Ckpt->Golden = &ExState;
+  struct stat StatData;
+  fstat(ExState.getStdoutFd(), &StatData);
+  Ckpt->StdoutSize = StatData.st_size;
+  fstat(ExState.getStderrFd(), &StatData);
+  Ckpt->StderrSize = StatData.st_size;
+  Ckpt->Server.own(CkptPID);
+  dbg(2) << "Checkpoint " << CkptPID << " at " << Time << "s, stdout "
+         << Ckpt->StdoutSize << " bytes, stderr " << Ckpt->StderrSize
+         << " bytes\n";
+  // The previous checkpoint's window ends here.
+  if (!Checkpoints.empty())
+    Checkpoints.back()->EndTime = Time;
+  Checkpoints.push_back(std::move(Ckpt));
+}
+
+void CheckpointRunner::runAndWait() {
+  ChildPID = Server->clone();
+  if (ChildPID == 0)
+    userDie("Error: Failed to clone the fork server for the golden run.");
+  setupClone(false /* TimeoutAlarm */);
+  // The clone is already seized, so it can be stopped with PTRACE_INTERRUPT.
+  Seized = UseSeize.getValue();
+  // We take checkpoints by forking the golden process.
+  ptraceSafe(PTRACE_SETOPTIONS, ChildPID, 0,
+             (void *)(getCloneTraceOptions() | PTRACE_O_TRACEFORK));
+  takeCheckpoint(0.0);
+
+  double Interval = BinExecTime.getValue() / NumCheckpoints;
+  int Status = 0;
+  bool Exited = false;
+  for (unsigned Cnt = 1; Cnt < NumCheckpoints; ++Cnt) {
+    ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+    WaitPidData Data;
+    if (waitpidSkipThreadStateUntil(addSecs(getMonoTime(), Interval), Data)) {
+      // This can only fail once the golden run has been reaped.
+      if (!stopChildThread(ChildPID))
+        die("Failed to stop the golden run ", ChildPID);
+      Data = waitpidSkipThreadState();
+    }
+    Status = Data.Status;
+    if (!WIFSTOPPED(Status)) {
+      Exited = true;
+      break;
+    }
+    // clone() only copies the calling thread.
+    if (!ChildThreads.empty()) {
+      warning("Warning: The workload is multi-threaded, so there are no "
+              "checkpoints after ",
+              Checkpoints.back()->Time, "s.");
+      break;
+    }
+    takeCheckpoint(Cnt * Interval);
+  }
+  // Let the golden run finish.
+  if (!Exited) {
+    ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+    Status = waitpidSkipThreadState().Status;
+  }
+  ExState.setExitState(getWaitPidExitState(Status));
+  Checkpoints.back()->EndTime =
+      BinExecTime.getValue() * BinExecTimeOvershoot.getValue();
+}
+
+void CheckpointSet::create(ForkServer *Server, unsigned Num) {
+  assert(Server != nullptr && Server->isRunning() && "Need a fork server");
+  GoldenRunner = std::make_unique<CheckpointRunner>(Server, Num, Checkpoints);
+  GoldenRunner->runAndWait();
+  Dbg(1) << "Checkpoints: " << Checkpoints.size() << "\n";
+}
+
+unsigned CheckpointSet::pickRandom() {
+  assert(!empty() && "No checkpoints");
+  double Time = UserInjectionTime.isSet() ? UserInjectionTime.getValue()
+                                          : Runner::getRandomInjectionTime();
+  // Find the latest checkpoint taken before the injection time.
+  auto It = std::upper_bound(
+      Checkpoints.begin(), Checkpoints.end(), Time,
+      [](double T, const std::unique_ptr<Checkpoint> &C) { return T < C->Time; });
+  assert(It != Checkpoints.begin() && "The first checkpoint is at time 0");
+  return std::prev(It) - Checkpoints.begin();
+}
@@ -0,0 +1,96 @@
+//-*- C++ -*-
+// Snapshots of the golden run that test runs are cloned from.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "exitState.h"
+#include "forkServer.h"
+#include "runner.h"
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+/// A stopped copy of the golden run, taken at Time seconds into its execution.
+/// Test runs cloned from it only execute the suffix of the golden run.
+struct Checkpoint {
+  /// The time into the golden run when the checkpoint was taken.
+  double Time = 0.0;
+
+  /// The end of the injection window covered by this checkpoint, which is the
+  /// time of the next checkpoint.
+  double EndTime = 0.0;
+
+  /// The golden stdout and stderr files.
+  const ExecutionExitState *Golden = nullptr;
+
+  /// The size of the golden stdout and stderr when the checkpoint was taken.
+  /// This prefix is copied into the output files of the runs.
+  off_t StdoutSize = 0;
+  off_t StderrSize = 0;
+
+  /// The stopped copy of the golden process.
+  ForkServer Server;
+};
+
+/// Runs the golden process once and takes checkpoints along the way.
+class CheckpointRunner : public RunnerBase {
+  /// The checkpoints taken so far.
+  std::vector<std::unique_ptr<Checkpoint>> &Checkpoints;
+
+  /// The number of checkpoints to take.
+  unsigned NumCheckpoints = 0;
+
+  /// Clone the stopped golden process and record a new checkpoint at \p Time.
+  void takeCheckpoint(double Time);
+
+public:
+  CheckpointRunner(ForkServer *Server, unsigned NumCheckpoints,
+                   std::vector<std::unique_ptr<Checkpoint>> &Checkpoints);
+  /// Run the golden process to completion, stopping it at evenly spaced time
+  /// points to take checkpoints.
+  void runAndWait() override;
+  /// \Returns the golden stdout and stderr.
+  const ExecutionExitState &getGolden() const { return ExState; }
+};
+
+/// The checkpoints of the golden run, sorted by time.
+class CheckpointSet {
+  std::vector<std::unique_ptr<Checkpoint>> Checkpoints;
+
+  /// The run that produced the checkpoints. It owns the golden output files.
+  std::unique_ptr<CheckpointRunner> GoldenRunner;
+
+public:
+  /// Run the workload cloned from \p Server and take \p Num checkpoints at
+  /// evenly spaced time points.
+  void create(ForkServer *Server, unsigned Num);
+
+  /// \Returns true if there are no checkpoints.
+  bool empty() const { return Checkpoints.empty(); }
+
+  /// Pick an injection time and \returns the index of the latest checkpoint
+  /// before it. Runs are cloned from it.
+  unsigned pickRandom();
+
+  /// \Returns checkpoint \p Idx.
+  Checkpoint &get(unsigned Idx) { return *Checkpoints[Idx]; }
+};
+
+#endif //__CHECKPOINT_H__
@@ -0,0 +1,97 @@
+// Reads the memory of a traced process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "childMemory.h"
+#include "debugstream.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/uio.h>
+
+/// Cleared once process_vm_readv() fails because of the kernel, for example
+/// if it is built without CONFIG_CROSS_MEMORY_ATTACH or a seccomp filter
+/// forbids it. From then on we only use PTRACE_PEEKDATA.
+static bool UseVmReadv = true;
+
+/// The page size, which is the granularity of the remote iovecs.
+static const unsigned long PageSize = sysconf(_SC_PAGESIZE);
+
+/// The maximum number of remote iovecs of a single process_vm_readv().
+static constexpr const size_t MaxIovecs = 64;
+
+size_t ChildMemory::peekRead(unsigned long Addr, void *Buf, size_t Size) const {
+  uint8_t *Bytes = static_cast<uint8_t *>(Buf);
+  const size_t WordSz = sizeof(unsigned long);
+  size_t Off = 0;
+  while (Off < Size) {
+    errno = 0;
+    long Word = ptrace(PTRACE_PEEKDATA, Pid, Addr + Off, 0);
+    if (Word == -1 && errno != 0)
+      break;
+    size_t Copy = std::min(Size - Off, WordSz);
+    memcpy(Bytes + Off, &Word, Copy);
+    Off += Copy;
+  }
+  return Off;
+}
+
+size_t ChildMemory::read(unsigned long Addr, void *Buf, size_t Size) const {
+  if (!UseVmReadv)
+    return peekRead(Addr, Buf, Size);
+  // A partial transfer stops at the first remote iovec that cannot be read as
+  // a whole, so we split the range at page boundaries. This way a range that
+  // runs into an unmapped page still returns all the bytes before it.
+  uint8_t *Bytes = static_cast<uint8_t *>(Buf);
+  size_t Done = 0;
+  while (Done < Size) {
+    struct iovec Local = {Bytes + Done, 0};
+    struct iovec Remote[MaxIovecs];
+    size_t NumIovecs = 0;
+    unsigned long Next = Addr + Done;
+    while (NumIovecs != MaxIovecs && Local.iov_len < Size - Done) {
+      unsigned long PageEnd = (Next & ~(PageSize - 1)) + PageSize;
+      size_t Len = std::min(PageEnd - Next, Size - Done - Local.iov_len);
+      Remote[NumIovecs++] = {(void *)Next, Len};
+      Local.iov_len += Len;
+      Next += Len;
+    }
+    ssize_t Read = process_vm_readv(Pid, &Local, 1, Remote, NumIovecs, 0);
+    if (Read < 0) {
+      if (errno == EFAULT || errno == ESRCH)
+        break;
+      dbg(1) << "process_vm_readv() failed: " << strerror(errno)
+             << ", falling back to PTRACE_PEEKDATA\n";
+      UseVmReadv = false;
+      return Done + peekRead(Addr + Done, Bytes + Done, Size - Done);
+    }
+    Done += Read;
+    if ((size_t)Read != Local.iov_len)
+      break;
+  }
+  if (Done != Size)
+    dbg(2) << "Read " << Done << " of " << Size << " bytes at " << (void *)Addr
+           << "\n";
+  return Done;
+}
+
+void ChildMemory::readSafe(unsigned long Addr, void *Buf, size_t Size) const {
+  size_t Read = read(Addr, Buf, Size);
+  if (Read != Size)
+    die("Failed to read ", Size, " bytes of tracee ", Pid, " memory at ",
+        (void *)Addr, ", only got ", Read);
+}
@@ -0,0 +1,55 @@
+//-*- C++ -*-
+// Reads the memory of a traced process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __CHILDMEMORY_H__
+#define __CHILDMEMORY_H__
+
+#include <cstddef>
+#include <sys/types.h>
+
+/// Reads the memory of a stopped tracee. It uses process_vm_readv(), which
+/// copies a whole range with a single system call, and falls back to one
+/// PTRACE_PEEKDATA per word if the kernel does not allow it.
+class ChildMemory {
+  /// The tracee.
+  pid_t Pid = 0;
+
+  /// The PTRACE_PEEKDATA version of read().
+  size_t peekRead(unsigned long Addr, void *Buf, size_t Size) const;
+
+public:
+  explicit ChildMemory(pid_t Pid) : Pid(Pid) {}
+
+  /// Copy \p Size bytes at \p Addr of the tracee into \p Buf. \Returns the
+  /// number of bytes copied, which is less than \p Size if the range runs into
+  /// memory that cannot be read.
+  size_t read(unsigned long Addr, void *Buf, size_t Size) const;
+
+  /// Like read() but dies if not all \p Size bytes can be read.
+  void readSafe(unsigned long Addr, void *Buf, size_t Size) const;
+
+  /// \Returns the word at \p Addr, or dies if it cannot be read.
+  unsigned long readWordSafe(unsigned long Addr) const {
+    unsigned long Word;
+    readSafe(Addr, &Word, sizeof(Word));
+    return Word;
+  }
+};
+
+#endif // __CHILDMEMORY_H__
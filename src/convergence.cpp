@@ -0,0 +1,192 @@
+// Detect test runs that have converged back to the golden run.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "convergence.h"
+#include "childMemory.h"
+#include "debugstream.h"
+#include "optionsList.h"
+#include "regManip.h"
+#include "remoteSyscall.h"
+#include "utils.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <vector>
+
+/// The size of the x86_64 red zone below the stack pointer.
+static constexpr const unsigned long RedZoneBytes = 128;
+
+/// \Returns the size of the file of \p Fd.
+static off_t getFileSize(int Fd) {
+  struct stat StatData;
+  if (fstat(Fd, &StatData) != 0)
+    die("fstat() failed");
+  return StatData.st_size;
+}
+
+/// \Returns a cheap hash that identifies the execution point of a process
+/// with registers \p Regs and output \p Out.
+static uint64_t getKey(const user_regs_struct &Regs,
+                       const ExecutionExitState &Out) {
+  uint64_t Key[] = {Regs.rip, Regs.rsp, Regs.orig_rax,
+                    (uint64_t)getFileSize(Out.getStdoutFd()),
+                    (uint64_t)getFileSize(Out.getStderrFd())};
+  return hashBytes(Key, sizeof(Key));
+}
+
+/// Mix the contents of the writable mappings of \p Pid into \p Hash. The dead
+/// part of the stack, below the red zone, is skipped. \Returns the new hash.
+static uint64_t hashWritableMemory(pid_t Pid, unsigned long SP,
+                                   uint64_t Hash) {
+  std::string ProcFile("/proc/" + std::to_string(Pid) + "/maps");
+  std::fstream FS(ProcFile, std::fstream::in);
+  if (FS.fail())
+    die(__FUNCTION__, "(): Failed to open ", ProcFile);
+  ChildMemory Mem(Pid);
+  std::vector<char> Buff(1 << 20);
+  std::string Line;
+  while (std::getline(FS, Line)) {
+    unsigned long From, To;
+    char Permissions[5];
+    if (sscanf(Line.c_str(), "%lx-%lx %4s", &From, &To, Permissions) != 3 ||
+        Permissions[1] != 'w')
+      continue;
+    if (From <= SP && SP < To)
+      From = std::max(From, (SP - RedZoneBytes) & ~7ul);
+    for (unsigned long Addr = From; Addr < To; Addr += Buff.size()) {
+      size_t Size = std::min((unsigned long)Buff.size(), To - Addr);
+      size_t Read = Mem.read(Addr, Buff.data(), Size);
+      // Some special mappings cannot be read, skip them.
+      if (Read == 0)
+        break;
+      Hash = hashBytes(Buff.data(), Read, Hash);
+      if (Read != Size)
+        break;
+    }
+  }
+  return Hash;
+}
+
+/// \Returns the full fingerprint of the stopped process \p Pid, starting from
+/// \p Key: its registers, vector registers and writable memory.
+static uint64_t getStateHash(pid_t Pid, const user_regs_struct &Regs,
+                             uint64_t Key) {
+  uint64_t Hash = hashBytes(&Regs, sizeof(Regs), Key);
+  std::vector<uint8_t> XState(XStateLayout::get().getMaxSize());
+  struct iovec Iov = {XState.data(), XState.size()};
+  if (ptrace(PTRACE_GETREGSET, Pid, NT_X86_XSTATE, &Iov) == 0)
+    Hash = hashBytes(XState.data(), Iov.iov_len, Hash);
+  return hashWritableMemory(Pid, Regs.rsp, Hash);
+}
+
+/// getrandom() may return fewer bytes than requested, so keep it short.
+static constexpr const size_t MaxGetrandomBytes = 256;
+
+void emulateGetrandom(pid_t Tid, unsigned long CallIdx) {
+  user_regs_struct Regs = {};
+  ptraceSafe(PTRACE_GETREGS, Tid, nullptr, &Regs);
+  unsigned long Buff = Regs.rdi;
+  size_t Len = std::min((size_t)Regs.rsi, MaxGetrandomBytes);
+  uint8_t Bytes[MaxGetrandomBytes];
+  for (size_t Off = 0; Off < Len; Off += sizeof(uint64_t)) {
+    uint64_t Seed[] = {CallIdx, Buff, Regs.rsi, Off};
+    uint64_t Word = hashBytes(Seed, sizeof(Seed));
+    memcpy(Bytes + Off, &Word, std::min(sizeof(Word), Len - Off));
+  }
+  pokeChildMemory(Tid, Buff, Bytes, Len);
+  // Skip the system call and return the number of bytes.
+  Regs.orig_rax = -1;
+  Regs.rax = Len;
+  ptraceSafe(PTRACE_SETREGS, Tid, nullptr, &Regs);
+  dbg(2) << "Emulated getrandom() of " << Len << " bytes in " << Tid << "\n";
+}
+
+ConvergenceRunner::ConvergenceRunner(ForkServer *Server, unsigned Interval,
+                                     ConvergenceSet &Fingerprints)
+    : RunnerBase(-3, !NoCleanup.getValue(), Server),
+      Fingerprints(Fingerprints), Interval(Interval) {}
+
+void ConvergenceRunner::runAndWait() {
+  ChildPID = Server->clone();
+  if (ChildPID == 0)
+    userDie("Error: Failed to clone the fork server for the golden run.");
+  setupClone(false /* TimeoutAlarm */);
+  ptraceSafe(PTRACE_SETOPTIONS, ChildPID, 0, (void *)getCloneTraceOptions());
+  TraceSyscalls = true;
+  unsigned long NumSyscalls = 0;
+  int Status = 0;
+  while (true) {
+    ptraceSafe(PTRACE_SYSCALL, ChildPID, 0, 0);
+    Status = waitpidSkipThreadState().Status;
+    if (!isSyscallStop(Status))
+      break;
+    // The fingerprint only covers the main thread.
+    if (!ChildThreads.empty()) {
+      TraceSyscalls = false;
+      warning("Warning: The workload is multi-threaded, so there are no "
+              "convergence checks after system call ",
+              NumSyscalls, ".");
+      ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+      Status = waitpidSkipThreadState().Status;
+      break;
+    }
+    user_regs_struct Regs;
+    ptraceSafe(PTRACE_GETREGS, ChildPID, nullptr, &Regs);
+    // Stop at the entry of the system call, not at the exit.
+    if (Regs.rax != (unsigned long)-ENOSYS)
+      continue;
+    if (++NumSyscalls % Interval == 0)
+      Fingerprints.insert(ChildPID, ExState);
+  }
+  ExState.setExitState(getWaitPidExitState(Status));
+  if (WIFSTOPPED(Status)) {
+    ptrace(PTRACE_KILL, ChildPID, 0, 0);
+    cleanupWaitpidState(ChildPID);
+  }
+}
+
+void ConvergenceSet::create(ForkServer *Server, unsigned Interval) {
+  assert(Server != nullptr && Server->isRunning() && "Need a fork server");
+  GoldenRunner = std::make_unique<ConvergenceRunner>(Server, Interval, *this);
+  GoldenRunner->runAndWait();
+  Dbg(1) << "Convergence points: " << States.size() << "\n";
+}
+
+void ConvergenceSet::insert(pid_t Pid, const ExecutionExitState &Out) {
+  user_regs_struct Regs = {};
+  ptraceSafe(PTRACE_GETREGS, Pid, nullptr, &Regs);
+  uint64_t Key = getKey(Regs, Out);
+  Keys.insert(Key);
+  States.insert(getStateHash(Pid, Regs, Key));
+}
+
+bool ConvergenceSet::contains(pid_t Pid, const ExecutionExitState &Out) const {
+  user_regs_struct Regs = {};
+  ptraceSafe(PTRACE_GETREGS, Pid, nullptr, &Regs);
+  if (Regs.rax != (unsigned long)-ENOSYS)
+    return false;
+  uint64_t Key = getKey(Regs, Out);
+  if (Keys.count(Key) == 0)
+    return false;
+  return States.count(getStateHash(Pid, Regs, Key)) != 0;
+}
+
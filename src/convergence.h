@@ -0,0 +1,93 @@
+//-*- C++ -*-
+// Detect test runs that have converged back to the golden run.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __CONVERGENCE_H__
+#define __CONVERGENCE_H__
+
+#include "exitState.h"
+#include "forkServer.h"
+#include "runner.h"
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <unordered_set>
+
+class ConvergenceSet;
+
+/// Runs the golden process once and records a fingerprint of its state every
+/// few system calls.
+class ConvergenceRunner : public RunnerBase {
+  /// The set that collects the fingerprints.
+  ConvergenceSet &Fingerprints;
+
+  /// Record a fingerprint every Interval system calls.
+  unsigned Interval = 0;
+
+public:
+  ConvergenceRunner(ForkServer *Server, unsigned Interval,
+                    ConvergenceSet &Fingerprints);
+  /// Run the golden process to completion, stopping it at its system calls.
+  void runAndWait() override;
+};
+
+/// The fingerprints of the architectural state of the golden run, taken at
+/// the entry of some of its system calls. A fingerprint is a hash of the
+/// registers and of the writable memory, along with the size of the output
+/// printed so far. A test run whose state matches a fingerprint will behave
+/// exactly like the golden run from then on, so the injected fault is masked.
+class ConvergenceSet {
+  /// Cheap hashes of the registers that identify the execution point and of
+  /// the output sizes. We only compute the full fingerprint if these match.
+  std::unordered_set<uint64_t> Keys;
+
+  /// The full fingerprints.
+  std::unordered_set<uint64_t> States;
+
+  /// The run that recorded the fingerprints.
+  std::unique_ptr<ConvergenceRunner> GoldenRunner;
+
+public:
+  /// Run the workload cloned from \p Server and record a fingerprint every
+  /// \p Interval system calls.
+  void create(ForkServer *Server, unsigned Interval);
+
+  /// \Returns true if there are no fingerprints.
+  bool empty() const { return States.empty(); }
+
+  /// Record the state of the stopped process \p Pid, which has written its
+  /// output to \p Out.
+  void insert(pid_t Pid, const ExecutionExitState &Out);
+
+  /// \Returns true if the state of the stopped process \p Pid, which has
+  /// written its output to \p Out, matches a fingerprint.
+  bool contains(pid_t Pid, const ExecutionExitState &Out) const;
+};
+
+/// Emulate the getrandom() that thread \p Tid is stopped at, with a
+/// PTRACE_EVENT_SECCOMP stop (see ForkServer::trapGetrandom()). The bytes are
+/// derived from the arguments and from \p CallIdx instead of being random, so
+/// that the memory of the runs does not differ because of them.
+void emulateGetrandom(pid_t Tid, unsigned long CallIdx);
+
+/// \Returns true if \p Status is a system call stop, with PTRACE_O_TRACESYSGOOD.
+static inline bool isSyscallStop(int Status) {
+  return WIFSTOPPED(Status) && WSTOPSIG(Status) == (SIGTRAP | 0x80);
+}
+
+#endif //__CONVERGENCE_H__
@@ -0,0 +1,245 @@
+// The CPU topology and the placement of the jobs on it.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "cpuPlacement.h"
+#include "debugstream.h"
+#include "optionsList.h"
+#include "utils.h"
+#include <algorithm>
+#include <cassert>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+
+static const char *SysCpuDir = "/sys/devices/system/cpu";
+
+/// \Returns the CPUs of a list like "0-3,8,10-11", which is how /sys prints
+/// them.
+static std::vector<unsigned> parseCpuList(const std::string &List) {
+  std::vector<unsigned> Cpus;
+  for (const std::string &Entry : splitList(List)) {
+    char *End;
+    unsigned long From = strtoul(Entry.c_str(), &End, 10);
+    unsigned long To = *End == '-' ? strtoul(End + 1, nullptr, 10) : From;
+    for (unsigned long Cpu = From; Cpu <= To; ++Cpu)
+      Cpus.push_back(Cpu);
+  }
+  return Cpus;
+}
+
+/// \Returns the first line of \p Path, or "" if it can't be read.
+static std::string readLine(const std::string &Path) {
+  std::fstream FS(Path, std::fstream::in);
+  std::string Line;
+  if (!FS.fail())
+    std::getline(FS, Line);
+  return Line;
+}
+
+/// \Returns the NUMA node of \p Cpu, which is the nodeN entry of its
+/// directory, or 0 without NUMA.
+static int getNode(unsigned Cpu) {
+  std::string Dir = std::string(SysCpuDir) + "/cpu" + std::to_string(Cpu);
+  DIR *D = opendir(Dir.c_str());
+  if (D == nullptr)
+    return 0;
+  int Node = 0;
+  while (struct dirent *Entry = readdir(D))
+    if (strncmp(Entry->d_name, "node", 4) == 0 && isdigit(Entry->d_name[4])) {
+      Node = atoi(Entry->d_name + 4);
+      break;
+    }
+  closedir(D);
+  return Node;
+}
+
+/// \Returns the lowest CPU that shares the last level cache with \p Cpu, or
+/// \p Cpu if the caches are not listed.
+static int getL3(unsigned Cpu) {
+  std::string Dir =
+      std::string(SysCpuDir) + "/cpu" + std::to_string(Cpu) + "/cache/index";
+  int L3 = Cpu;
+  int MaxLevel = 0;
+  for (unsigned Idx = 0;; ++Idx) {
+    std::string Level = readLine(Dir + std::to_string(Idx) + "/level");
+    if (Level.empty())
+      break;
+    std::vector<unsigned> Shared =
+        parseCpuList(readLine(Dir + std::to_string(Idx) + "/shared_cpu_list"));
+    if (atoi(Level.c_str()) > MaxLevel && !Shared.empty()) {
+      MaxLevel = atoi(Level.c_str());
+      L3 = Shared.front();
+    }
+  }
+  return L3;
+}
+
+CpuTopology::CpuTopology() {
+  cpu_set_t Allowed;
+  if (sched_getaffinity(0, sizeof(Allowed), &Allowed) != 0)
+    die("sched_getaffinity() failed: ", strerror(errno));
+  // The cores by their first SMT sibling.
+  std::map<unsigned, Core> CoreMap;
+  for (unsigned Cpu = 0; Cpu != CPU_SETSIZE; ++Cpu) {
+    if (!CPU_ISSET(Cpu, &Allowed))
+      continue;
+    std::vector<unsigned> Siblings =
+        parseCpuList(readLine(std::string(SysCpuDir) + "/cpu" +
+                              std::to_string(Cpu) +
+                              "/topology/thread_siblings_list"));
+    unsigned First = Siblings.empty() ? Cpu : Siblings.front();
+    Core &C = CoreMap[First];
+    if (C.Cpus.empty()) {
+      C.Node = getNode(Cpu);
+      C.L3 = getL3(Cpu);
+    }
+    C.Cpus.push_back(Cpu);
+  }
+  for (auto &Pair : CoreMap)
+    Cores.push_back(Pair.second);
+  std::stable_sort(Cores.begin(), Cores.end(),
+                   [](const Core &C1, const Core &C2) {
+                     return std::make_pair(C1.Node, C1.L3) <
+                            std::make_pair(C2.Node, C2.L3);
+                   });
+}
+
+unsigned CpuTopology::getNumCpus() const {
+  unsigned NumCpus = 0;
+  for (const Core &C : Cores)
+    NumCpus += C.Cpus.size();
+  return NumCpus;
+}
+
+void CpuTopology::dump() const {
+  for (const Core &C : Cores) {
+    fprintf(stderr, "Core node %d, L3 %d, CPUs", C.Node, C.L3);
+    for (unsigned Cpu : C.Cpus)
+      fprintf(stderr, " %u", Cpu);
+    fprintf(stderr, "\n");
+  }
+}
+
+CpuPlacement &CpuPlacement::get() {
+  static CpuPlacement Placement;
+  return Placement;
+}
+
+bool CpuPlacement::isValidPolicy(const std::string &Policy) {
+  return Policy == "none" || Policy == "core" || Policy == "thread";
+}
+
+unsigned CpuPlacement::getMaxJobs(const std::string &Policy,
+                                  const CpuTopology &Topology) {
+  if (Policy == "core")
+    return Topology.getCores().size();
+  return Topology.getNumCpus();
+}
+
+/// \Returns the cores of \p Topology with consecutive cores in different L3
+/// domains, as long as there are domains with cores left.
+static std::vector<const CpuTopology::Core *>
+spreadOverL3(const CpuTopology &Topology) {
+  // The cores are sorted by domain.
+  std::vector<std::vector<const CpuTopology::Core *>> Domains;
+  const CpuTopology::Core *Prev = nullptr;
+  for (const CpuTopology::Core &C : Topology.getCores()) {
+    if (Prev == nullptr || Prev->Node != C.Node || Prev->L3 != C.L3)
+      Domains.emplace_back();
+    Domains.back().push_back(&C);
+    Prev = &C;
+  }
+  std::vector<const CpuTopology::Core *> Order;
+  for (size_t Idx = 0; Order.size() != Topology.getCores().size(); ++Idx)
+    for (const auto &Domain : Domains)
+      if (Idx < Domain.size())
+        Order.push_back(Domain[Idx]);
+  return Order;
+}
+
+void CpuPlacement::init(const std::string &Policy, unsigned NumJobs) {
+  assert(Slots.empty() && "Already initialized");
+  if (Policy == "none")
+    return;
+  CpuTopology Topology;
+  if (VerboseLevel.getValue() >= 2)
+    Topology.dump();
+  std::vector<const CpuTopology::Core *> Order = spreadOverL3(Topology);
+  // The tracer and the workload of each job.
+  std::vector<std::pair<unsigned, unsigned>> Cpus;
+  if (Policy == "core") {
+    for (const CpuTopology::Core *C : Order)
+      Cpus.emplace_back(C->Cpus.back(), C->Cpus.front());
+  } else {
+    // Use the SMT siblings only once every core has a job.
+    for (size_t Sibling = 0; Cpus.size() != Topology.getNumCpus(); ++Sibling)
+      for (const CpuTopology::Core *C : Order)
+        if (Sibling < C->Cpus.size())
+          Cpus.emplace_back(C->Cpus[Sibling], C->Cpus[Sibling]);
+  }
+  assert(NumJobs <= Cpus.size() && "Expected -j to be capped");
+  Slots.resize(NumJobs);
+  if (sched_getaffinity(0, sizeof(Housekeeping), &Housekeeping) != 0)
+    die("sched_getaffinity() failed: ", strerror(errno));
+  for (unsigned Job = 0; Job != NumJobs; ++Job) {
+    Slot &S = Slots[Job];
+    CPU_ZERO(&S.Tracer);
+    CPU_ZERO(&S.Tracee);
+    CPU_SET(Cpus[Job].first, &S.Tracer);
+    CPU_SET(Cpus[Job].second, &S.Tracee);
+    CPU_CLR(Cpus[Job].first, &Housekeeping);
+    CPU_CLR(Cpus[Job].second, &Housekeeping);
+    dbg(2) << "Job slot " << Job << ": tracer on CPU " << Cpus[Job].first
+           << ", workload on CPU " << Cpus[Job].second << "\n";
+  }
+  SawThreads = static_cast<std::atomic<bool> *>(
+      mmap(nullptr, sizeof(*SawThreads), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  if (SawThreads == MAP_FAILED)
+    die("mmap() failed: ", strerror(errno));
+  // With no CPU left over, the main process shares them with the jobs. It
+  // mostly sleeps while they run anyway.
+  if (CPU_COUNT(&Housekeeping) != 0 &&
+      sched_setaffinity(0, sizeof(Housekeeping), &Housekeeping) != 0)
+    die("sched_setaffinity() failed: ", strerror(errno));
+}
+
+void CpuPlacement::pinWorker(unsigned Slot) {
+  if (Slots.empty())
+    return;
+  assert(Slot < Slots.size() && "Bad slot");
+  CurrentSlot = Slot;
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &Slots[Slot].Tracer) != 0)
+    die("sched_setaffinity() failed: ", strerror(errno));
+}
+
+void CpuPlacement::pinTracee(pid_t Pid) const {
+  if (CurrentSlot < 0)
+    return;
+  if (sched_setaffinity(Pid, sizeof(cpu_set_t), &Slots[CurrentSlot].Tracee) !=
+      0)
+    die("sched_setaffinity() failed for ", Pid, ": ", strerror(errno));
+}
+
+void CpuPlacement::noteWorkloadThread() {
+  if (CurrentSlot < 0 || SawThreads->exchange(true))
+    return;
+  warning("WARNING: The workload is multi-threaded, but '",
+          CpuPlacementPolicy.getFlag(), "' runs all of its threads on a "
+          "single CPU, which serializes them and changes their timing.");
+}
@@ -0,0 +1,123 @@
+//-*- C++ -*-
+// The CPU topology and the placement of the jobs on it.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __CPUPLACEMENT_H__
+#define __CPUPLACEMENT_H__
+
+#include <atomic>
+#include <sched.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/// The CPUs that we may run on, as found in /sys/devices/system/cpu.
+class CpuTopology {
+public:
+  /// A physical core.
+  struct Core {
+    /// Its SMT siblings that we may run on, in ascending order.
+    std::vector<unsigned> Cpus;
+    /// The NUMA node.
+    int Node = 0;
+    /// The lowest CPU that shares the last level cache with it, which
+    /// identifies its L3 domain.
+    int L3 = 0;
+  };
+
+private:
+  /// The cores, by NUMA node, L3 domain and first CPU.
+  std::vector<Core> Cores;
+
+public:
+  /// Read the topology of the CPUs in our affinity mask. CPUs with no
+  /// topology information are taken to be cores of their own.
+  CpuTopology();
+
+  /// \Returns the cores.
+  const std::vector<Core> &getCores() const { return Cores; }
+
+  /// \Returns the number of CPUs.
+  unsigned getNumCpus() const;
+
+  /// Debug print.
+  void dump() const;
+};
+
+/// Pins the jobs to CPUs of their own, as selected by -cpu-placement. With
+/// the "core" policy each job gets a physical core, with the workload on one
+/// of its SMT siblings and its tracer on another, so that the jobs don't
+/// share the execution units. With "thread" each job gets a CPU, for both
+/// the workload and its tracer. The jobs are spread over the L3 domains, and
+/// each worker is pinned before it allocates its memory, so that it stays
+/// local to its NUMA node. The main process runs on the CPUs left over, if
+/// any. Note that all the threads of a workload share its one CPU.
+class CpuPlacement {
+  /// The CPUs of a job.
+  struct Slot {
+    /// The worker, which traces the workload.
+    cpu_set_t Tracer;
+    /// The workload.
+    cpu_set_t Tracee;
+  };
+  /// The CPUs of each job, empty if the kernel places the jobs.
+  std::vector<Slot> Slots;
+  /// The CPUs not used by any job.
+  cpu_set_t Housekeeping;
+  /// The slot of this process, or -1 if it is not a worker.
+  int CurrentSlot = -1;
+  /// Set once a workload has started a thread, in memory shared by the
+  /// workers, so that we warn only once per campaign.
+  std::atomic<bool> *SawThreads = nullptr;
+
+  CpuPlacement() = default;
+
+public:
+  CpuPlacement(const CpuPlacement &) = delete;
+
+  /// \Returns the placement of the process.
+  static CpuPlacement &get();
+
+  /// \Returns true if \p Policy is a valid value of -cpu-placement.
+  static bool isValidPolicy(const std::string &Policy);
+
+  /// \Returns the number of jobs that \p Policy can place on \p Topology.
+  static unsigned getMaxJobs(const std::string &Policy,
+                             const CpuTopology &Topology);
+
+  /// Assign CPUs to \p NumJobs jobs with \p Policy, and move the main process
+  /// to the CPUs left over.
+  void init(const std::string &Policy, unsigned NumJobs);
+
+  /// \Returns true if the jobs are pinned.
+  bool enabled() const { return !Slots.empty(); }
+
+  /// Pin the calling worker to the CPUs of job slot \p Slot.
+  void pinWorker(unsigned Slot);
+
+  /// Pin \p Pid, a workload or a fork server of the calling worker, to the
+  /// CPUs of the workload. Does nothing outside a worker.
+  void pinTracee(pid_t Pid) const;
+
+  /// Called when the workload of the calling worker starts a thread. All the
+  /// threads share the single CPU of the workload, so warn that they will run
+  /// one at a time.
+  void noteWorkloadThread();
+};
+
+#endif // __CPUPLACEMENT_H__
@@ -0,0 +1,175 @@
+// An ahead-of-time index of the decoded instructions of an ELF file.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "decodeIndex.h"
+#include "debugstream.h"
+#include "elfFile.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/stat.h>
+#include <vector>
+
+/// The magic bytes that an index file starts with.
+static const char IndexMagic[8] = {'Z', 'O', 'F', 'I', 'I', 'D', 'X', '\0'};
+
+/// The version of the index file format.
+static constexpr const uint32_t IndexVersion = 1;
+
+DecodeIndex::~DecodeIndex() {
+  if (Data != nullptr)
+    munmapSafe(Data, Size);
+}
+
+bool DecodeIndex::load(const std::string &Path) {
+  int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd == -1)
+    return false;
+  size_t Sz = fileSizeSafe(Fd);
+  if (Sz < sizeof(Header)) {
+    closeSafe(Fd);
+    return false;
+  }
+  Data = mmapFileSafe(Fd, Sz);
+  Size = Sz;
+  closeSafe(Fd);
+  const Header &H = getHeader();
+  return memcmp(H.Magic, IndexMagic, sizeof(IndexMagic)) == 0 &&
+         H.Version == IndexVersion && H.CsVersion == cs_version(nullptr, nullptr) &&
+         Size == sizeof(Header) + H.NumRecords * sizeof(Record) +
+                     H.NumRegs * sizeof(Reg);
+}
+
+bool DecodeIndex::create(const ElfFile &Elf, const std::string &Path) {
+  Disassembler &Disasm = Disassembler::get();
+  std::vector<Record> Records;
+  std::vector<Reg> Regs;
+  for (const ElfFile::CodeSection &Section : Elf.getCodeSections()) {
+    const uint8_t *Code = Elf.getCode(Section.Offset);
+    // A linear sweep. Bytes that don't decode, like padding, are skipped.
+    for (uint64_t Off = 0; Off < Section.Size;) {
+      DecodedInstr Instr;
+      unsigned Len;
+      uint64_t Bytes = Section.Size - Off;
+      if (Bytes > Disassembler::CodeBytes)
+        Bytes = Disassembler::CodeBytes;
+      if (!Disasm.decodeUncached(Code + Off, Bytes, Instr, Len)) {
+        ++Off;
+        continue;
+      }
+      Record R = {};
+      R.Offset = Section.Offset + Off;
+      R.FirstReg = Regs.size();
+      R.Len = Len;
+      R.IsControl = Instr.IsControl;
+      R.NumImplRead = Instr.NumImplRead;
+      R.NumImplWrite = Instr.NumImplWrite;
+      R.NumExpl = Instr.NumExpl;
+      for (unsigned Idx = 0; Idx != Instr.NumImplRead; ++Idx)
+        Regs.push_back({Instr.ImplRead[Idx], CS_AC_READ});
+      for (unsigned Idx = 0; Idx != Instr.NumImplWrite; ++Idx)
+        Regs.push_back({Instr.ImplWrite[Idx], CS_AC_WRITE});
+      for (unsigned Idx = 0; Idx != Instr.NumExpl; ++Idx)
+        Regs.push_back({Instr.Expl[Idx].Reg, Instr.Expl[Idx].Access});
+      Records.push_back(R);
+      Off += Len;
+    }
+  }
+  std::sort(Records.begin(), Records.end(),
+            [](const Record &R1, const Record &R2) {
+              return R1.Offset < R2.Offset;
+            });
+
+  Header H = {};
+  memcpy(H.Magic, IndexMagic, sizeof(IndexMagic));
+  H.Version = IndexVersion;
+  H.CsVersion = cs_version(nullptr, nullptr);
+  H.NumRecords = Records.size();
+  H.NumRegs = Regs.size();
+
+  // Write to a temporary file first, so that a concurrent campaign never maps
+  // a partial index.
+  std::string TmpPath = Path + "." + std::to_string(getpid());
+  FILE *Fp = fopen(TmpPath.c_str(), "w");
+  if (Fp == nullptr)
+    return false;
+  bool OK = fwrite(&H, sizeof(H), 1, Fp) == 1 &&
+            fwrite(Records.data(), sizeof(Record), Records.size(), Fp) ==
+                Records.size() &&
+            fwrite(Regs.data(), sizeof(Reg), Regs.size(), Fp) == Regs.size();
+  OK = fclose(Fp) == 0 && OK;
+  if (!OK || rename(TmpPath.c_str(), Path.c_str()) != 0) {
+    remove(TmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<DecodeIndex> DecodeIndex::getOrCreate(const std::string &File,
+                                                      const std::string &Dir) {
+  ElfFile Elf(File);
+  if (!Elf.isValid())
+    return nullptr;
+  std::string BuildId = Elf.getBuildId();
+  if (BuildId.empty()) {
+    warning("Warning: ", File, " has no build-id, so it is not indexed.");
+    return nullptr;
+  }
+  if (mkdir(Dir.c_str(), 0755) != 0 && errno != EEXIST)
+    userDie("Failed to create directory ", Dir, ".");
+  std::string Path = Dir + "/" + BuildId + ".idx";
+
+  std::unique_ptr<DecodeIndex> Index(new DecodeIndex());
+  if (Index->load(Path)) {
+    Dbg(1) << "Loaded index " << Path << " of " << File << "\n";
+    return Index;
+  }
+  // A stale or partial index is replaced.
+  Index.reset(new DecodeIndex());
+  auto Start = getTime();
+  if (!create(Elf, Path) || !Index->load(Path)) {
+    warning("Warning: Failed to create the index ", Path, " of ", File, ".");
+    return nullptr;
+  }
+  Dbg(1).precision(3) << "Indexed " << Index->size() << " instructions of "
+                      << File << " in " << getTimeDiff(Start, getTime())
+                      << "s\n";
+  return Index;
+}
+
+bool DecodeIndex::lookup(uint64_t Offset, DecodedInstr &Instr) const {
+  const Record *Begin = getRecords();
+  const Record *End = Begin + getHeader().NumRecords;
+  const Record *It = std::lower_bound(
+      Begin, End, Offset,
+      [](const Record &R, uint64_t Off) { return R.Offset < Off; });
+  if (It == End || It->Offset != Offset)
+    return false;
+  const Reg *Regs = getRegs() + It->FirstReg;
+  Instr.IsControl = It->IsControl;
+  Instr.NumImplRead = It->NumImplRead;
+  Instr.NumImplWrite = It->NumImplWrite;
+  Instr.NumExpl = It->NumExpl;
+  for (unsigned Idx = 0; Idx != It->NumImplRead; ++Idx)
+    Instr.ImplRead[Idx] = (Regs++)->Reg;
+  for (unsigned Idx = 0; Idx != It->NumImplWrite; ++Idx)
+    Instr.ImplWrite[Idx] = (Regs++)->Reg;
+  for (unsigned Idx = 0; Idx != It->NumExpl; ++Idx, ++Regs)
+    Instr.Expl[Idx] = {Regs->Reg, Regs->Access};
+  return true;
+}
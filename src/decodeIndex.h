@@ -0,0 +1,110 @@
+//-*- C++ -*-
+// An ahead-of-time index of the decoded instructions of an ELF file.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __DECODEINDEX_H__
+#define __DECODEINDEX_H__
+
+#include "disassembler.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class ElfFile;
+
+/// The decoded instructions of the executable sections of an ELF file, by
+/// their offset in the file. The index is saved in a file named after the
+/// build-id of the ELF file, which is mapped by later campaigns on the same
+/// build instead of disassembling it again.
+class DecodeIndex {
+  /// The header of an index file. It is followed by the records, sorted by
+  /// offset, and then by the registers of the records.
+  struct Header {
+    char Magic[8];
+    /// The version of the file format.
+    uint32_t Version;
+    /// The capstone version, since the register IDs depend on it.
+    uint32_t CsVersion;
+    uint64_t NumRecords;
+    uint64_t NumRegs;
+  };
+
+  /// The decoded instruction at an offset of the ELF file.
+  struct Record {
+    uint64_t Offset;
+    /// The index of the first register of the instruction. The implicitly
+    /// read ones come first, then the implicitly written ones and then the
+    /// explicit ones.
+    uint32_t FirstReg;
+    uint8_t Len;
+    uint8_t IsControl;
+    uint8_t NumImplRead;
+    uint8_t NumImplWrite;
+    uint8_t NumExpl;
+  };
+
+  /// A register accessed by an instruction.
+  struct Reg {
+    uint16_t Reg;
+    /// CS_AC_READ and/or CS_AC_WRITE.
+    uint8_t Access;
+  };
+
+  /// The mapping of the index file.
+  const char *Data = nullptr;
+  size_t Size = 0;
+
+  const Header &getHeader() const {
+    return *reinterpret_cast<const Header *>(Data);
+  }
+  const Record *getRecords() const {
+    return reinterpret_cast<const Record *>(Data + sizeof(Header));
+  }
+  const Reg *getRegs() const {
+    return reinterpret_cast<const Reg *>(
+        Data + sizeof(Header) + getHeader().NumRecords * sizeof(Record));
+  }
+
+  /// Map the index file \p Path. \Returns false if it is missing or invalid.
+  bool load(const std::string &Path);
+
+  /// Disassemble the executable sections of \p Elf and save the index to
+  /// \p Path. \Returns false if the file cannot be written.
+  static bool create(const ElfFile &Elf, const std::string &Path);
+
+public:
+  DecodeIndex() = default;
+  DecodeIndex(const DecodeIndex &) = delete;
+  ~DecodeIndex();
+
+  /// \Returns the index of the ELF file \p File from directory \p Dir, after
+  /// creating it if it is missing. \Returns null if \p File is not an ELF
+  /// file with a build-id.
+  static std::unique_ptr<DecodeIndex> getOrCreate(const std::string &File,
+                                                  const std::string &Dir);
+
+  /// \Returns the number of instructions in the index.
+  uint64_t size() const { return getHeader().NumRecords; }
+
+  /// Set \p Instr to the instruction at \p Offset of the ELF file. \Returns
+  /// false if no instruction starts at \p Offset.
+  bool lookup(uint64_t Offset, DecodedInstr &Instr) const;
+};
+
+#endif // __DECODEINDEX_H__
@@ -0,0 +1,192 @@
+// The disassembler and the cache of decoded instructions.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "disassembler.h"
+#include "debugstream.h"
+#include "decodeIndex.h"
+#include "utils.h"
+#include <algorithm>
+#include <cassert>
+#include <sys/mman.h>
+
+/// The number of entries of the cache.
+static constexpr const size_t NumEntries = 4096;
+
+/// The number of entries we look at before giving up on the cache.
+static constexpr const unsigned MaxProbes = 8;
+
+// The jobs are processes, so the atomics must not need a lock.
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "Expected lock-free atomics");
+
+// Return true if Instr
+static bool isControlInstr(cs_insn &Instr) {
+  cs_detail *InstrDetail = Instr.detail;
+  assert(InstrDetail && "Disasm missing CS_OPT_ON=ON or CS_OP_SKIPDATA=OFF.");
+  bool IsControl = false;
+  for (int Idx = 0, E = InstrDetail->groups_count; Idx != E; ++Idx) {
+    auto Group = InstrDetail->groups[Idx];
+    switch (Group) {
+    case CS_GRP_JUMP:
+    case CS_GRP_CALL:
+    case CS_GRP_RET:
+    case CS_GRP_INT:
+    case CS_GRP_IRET:
+    case CS_GRP_PRIVILEGE:
+    case CS_GRP_BRANCH_RELATIVE:
+      IsControl = true;
+      break;
+    default:
+      break;
+    }
+  }
+  return IsControl;
+}
+
+Disassembler::Disassembler() {
+  // http://www.capstone-engine.org/lang_c.html
+  if (cs_open(CS_ARCH_X86, CS_MODE_64, &Handle) != CS_ERR_OK)
+    die("Error: capstone cs_open failed.");
+
+  if (cs_option(Handle, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK)
+    die("Error: capstone cs_option CS_OPT_DETAIL failed.");
+
+  if (cs_option(Handle, CS_OPT_SKIPDATA, CS_OPT_OFF) != CS_ERR_OK)
+    die("Error: capstone cs_option CS_OPT_SKIPDATA failed.");
+
+  Insn = cs_malloc(Handle);
+  if (Insn == nullptr)
+    die("Error: capstone cs_malloc failed.");
+
+  // The mapping is zero-filled, so all entries start Empty.
+  void *Addr = mmap(nullptr, NumEntries * sizeof(Entry), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (Addr == MAP_FAILED) {
+    perror("mmap()");
+    die("Failed to map the decoded instruction cache.");
+  }
+  Table = static_cast<Entry *>(Addr);
+}
+
+Disassembler::~Disassembler() {
+  munmap(Table, NumEntries * sizeof(Entry));
+  cs_free(Insn, 1);
+  cs_close(&Handle);
+}
+
+Disassembler &Disassembler::get() {
+  static Disassembler Disasm;
+  return Disasm;
+}
+
+bool Disassembler::decodeUncached(const uint8_t *Code, size_t Size,
+                                  DecodedInstr &Instr, unsigned &Len) {
+  uint64_t Addr = 0;
+  if (!cs_disasm_iter(Handle, &Code, &Size, &Addr, Insn)) {
+    dbg(2) << "cs_disasm_iter() failed\n";
+    return false;
+  }
+  dbg(3) << "Mnemonic:" << Insn->mnemonic << ", Operands:" << Insn->op_str
+         << "\n";
+  cs_detail *InstrDetail = Insn->detail;
+  Len = Insn->size;
+
+  Instr.IsControl = isControlInstr(*Insn);
+  unsigned MaxImplRegs = DecodedInstr::MaxImplRegs;
+  Instr.NumImplRead = std::min<unsigned>(InstrDetail->regs_read_count,
+                                         MaxImplRegs);
+  std::copy_n(InstrDetail->regs_read, Instr.NumImplRead, Instr.ImplRead);
+  Instr.NumImplWrite = std::min<unsigned>(InstrDetail->regs_write_count,
+                                          MaxImplRegs);
+  std::copy_n(InstrDetail->regs_write, Instr.NumImplWrite, Instr.ImplWrite);
+
+  Instr.NumExpl = 0;
+  auto AddExpl = [&Instr](unsigned Reg, uint8_t Access) {
+    if (Instr.NumExpl != DecodedInstr::MaxExplRegs)
+      Instr.Expl[Instr.NumExpl++] = {(uint16_t)Reg, Access};
+  };
+  const cs_x86 &X86Data = InstrDetail->x86;
+  for (int Idx = 0, E = X86Data.op_count; Idx != E; ++Idx) {
+    const cs_x86_op &Operand = X86Data.operands[Idx];
+    switch (Operand.type) {
+    case X86_OP_REG:
+      AddExpl(Operand.reg, Operand.access);
+      break;
+    case X86_OP_MEM:
+      // The registers of the address are only read.
+      for (const x86_reg &Reg :
+           {Operand.mem.segment, Operand.mem.base, Operand.mem.index})
+        if (Reg != X86_REG_INVALID)
+          AddExpl(Reg, CS_AC_READ);
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+bool Disassembler::decode(const uint8_t *Code, DecodedInstr &Instr) {
+  uint64_t Key;
+  memcpy(&Key, Code, sizeof(Key));
+  size_t Idx = (Key * 0x9e3779b97f4a7c15ULL) >> 52;
+  static_assert(NumEntries == 1 << 12, "The hash assumes 4096 entries");
+  for (unsigned Probe = 0; Probe != MaxProbes;
+       ++Probe, Idx = (Idx + 1) % NumEntries) {
+    Entry &E = Table[Idx];
+    uint32_t State = E.State.load(std::memory_order_acquire);
+    if (State == Ready && memcmp(E.Code, Code, CodeBytes) == 0) {
+      dbg(2) << "Code 0x" << std::hex << Key << std::dec
+             << " found in the decode cache\n";
+      Instr = E.Instr;
+      return true;
+    }
+    if (State != Empty)
+      continue;
+    unsigned Len;
+    if (!decodeUncached(Code, CodeBytes, Instr, Len))
+      return false;
+    // Another job may be claiming the same entry. If so, it will fill it in.
+    uint32_t Expected = Empty;
+    if (E.State.compare_exchange_strong(Expected, Writing,
+                                        std::memory_order_acq_rel)) {
+      memcpy(E.Code, Code, CodeBytes);
+      E.Instr = Instr;
+      E.State.store(Ready, std::memory_order_release);
+      dbg(2) << "Code 0x" << std::hex << Key << std::dec
+             << " added to the decode cache\n";
+    }
+    return true;
+  }
+  unsigned Len;
+  return decodeUncached(Code, CodeBytes, Instr, Len);
+}
+
+void Disassembler::loadIndexes(const std::vector<std::string> &Files,
+                               const std::string &Dir) {
+  for (const std::string &File : Files) {
+    std::unique_ptr<DecodeIndex> Index = DecodeIndex::getOrCreate(File, Dir);
+    if (Index)
+      Indexes[File] = std::move(Index);
+  }
+}
+
+bool Disassembler::decodeFromIndex(const std::string &Path, uint64_t Offset,
+                                   DecodedInstr &Instr) const {
+  auto It = Indexes.find(Path);
+  return It != Indexes.end() && It->second->lookup(Offset, Instr);
+}
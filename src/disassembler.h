@@ -0,0 +1,133 @@
+//-*- C++ -*-
+// The disassembler and the cache of decoded instructions.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __DISASSEMBLER_H__
+#define __DISASSEMBLER_H__
+
+#include <atomic>
+#include <capstone/capstone.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class DecodeIndex;
+
+/// The registers accessed by an instruction, as capstone register IDs. This
+/// is plain data, so that it can live in memory shared by the jobs.
+struct DecodedInstr {
+  /// The maximum number of implicit / explicit registers we keep track of.
+  static constexpr const unsigned MaxImplRegs = 20;
+  static constexpr const unsigned MaxExplRegs = 24;
+
+  /// An explicitly accessed register, either a register operand or a register
+  /// of a memory operand.
+  struct ExplReg {
+    uint16_t Reg;
+    /// CS_AC_READ and/or CS_AC_WRITE.
+    uint8_t Access;
+  };
+
+  /// The instruction changes the control flow.
+  bool IsControl;
+  uint8_t NumImplRead;
+  uint8_t NumImplWrite;
+  uint8_t NumExpl;
+  uint16_t ImplRead[MaxImplRegs];
+  uint16_t ImplWrite[MaxImplRegs];
+  ExplReg Expl[MaxExplRegs];
+};
+
+/// Disassembles the instructions at the injection points. The capstone handle
+/// is opened once per process, and the decoded instructions are cached in a
+/// table that is shared by all the jobs of the campaign, so a hot instruction
+/// is decoded only once. Create it with get() in the main process before the
+/// jobs are forked, so that they inherit both.
+class Disassembler {
+public:
+  /// The number of code bytes that we decode from, which is the maximum
+  /// length of an x86 instruction. The decode index uses it too, so that an
+  /// instruction is injectable with or without the index.
+  static constexpr const size_t CodeBytes = 15;
+
+private:
+  /// The state of a cache entry.
+  enum EntryState : uint32_t { Empty, Writing, Ready };
+
+  /// An entry of the cache.
+  struct Entry {
+    std::atomic<uint32_t> State;
+    /// The code bytes, which are the key. The registers accessed by an
+    /// instruction don't depend on its address, which ASLR changes across
+    /// runs anyway.
+    uint8_t Code[CodeBytes];
+    DecodedInstr Instr;
+  };
+
+  /// The capstone handle, with CS_OPT_DETAIL on.
+  csh Handle;
+
+  /// The instruction that capstone decodes into, allocated once.
+  cs_insn *Insn = nullptr;
+
+  /// The cache, in shared memory.
+  Entry *Table = nullptr;
+
+  /// The ahead-of-time indexes, by the path of the file they index.
+  std::map<std::string, std::unique_ptr<DecodeIndex>> Indexes;
+
+  Disassembler();
+  ~Disassembler();
+
+public:
+  Disassembler(const Disassembler &) = delete;
+
+  /// \Returns the disassembler of this process.
+  static Disassembler &get();
+
+  /// Decode the instruction at \p Code, which holds CodeBytes bytes, into
+  /// \p Instr. \Returns false if it is not a valid instruction.
+  bool decode(const uint8_t *Code, DecodedInstr &Instr);
+
+  /// Decode the first instruction of the \p Size bytes at \p Code into \p Instr
+  /// and set \p Len to its length, bypassing the cache. \Returns false if it is
+  /// not a valid instruction.
+  bool decodeUncached(const uint8_t *Code, size_t Size, DecodedInstr &Instr,
+                      unsigned &Len);
+
+  /// Load the index of each of \p Files from directory \p Dir, creating the
+  /// ones that are missing.
+  void loadIndexes(const std::vector<std::string> &Files,
+                   const std::string &Dir);
+
+  /// Look up the instruction at \p Offset of file \p Path in its index.
+  /// \Returns false if the file has no index or there is no instruction at
+  /// \p Offset.
+  bool decodeFromIndex(const std::string &Path, uint64_t Offset,
+                       DecodedInstr &Instr) const;
+
+  /// \Returns the name of capstone register \p Reg.
+  const char *getRegName(unsigned Reg) const {
+    return cs_reg_name(Handle, Reg);
+  }
+};
+
+#endif // __DISASSEMBLER_H__
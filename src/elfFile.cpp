@@ -0,0 +1,242 @@
+// A read-only view of an ELF file.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "elfFile.h"
+#include "utils.h"
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+
+// These are missing from <linux/elf.h>, which we use instead of <elf.h>
+// because the two conflict and utils.h already includes the former.
+#ifndef EM_X86_64
+#define EM_X86_64 62
+#endif
+#ifndef DT_RUNPATH
+#define DT_RUNPATH 29
+#endif
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/// The directories that the dynamic linker searches last.
+static const char *DefaultLibDirs[] = {
+    "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64",
+    "/usr/lib64",            "/lib",                      "/usr/lib"};
+
+ElfFile::ElfFile(const std::string &Path) : Path(Path) {
+  int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd == -1)
+    return;
+  size_t Sz = fileSizeSafe(Fd);
+  if (Sz >= sizeof(Elf64_Ehdr)) {
+    Data = mmapFileSafe(Fd, Sz);
+    Size = Sz;
+  }
+  closeSafe(Fd);
+}
+
+ElfFile::~ElfFile() {
+  if (Data != nullptr)
+    munmapSafe(Data, Size);
+}
+
+const char *ElfFile::getBytes(uint64_t Off, uint64_t Sz) const {
+  if (Off > Size || Sz > Size - Off)
+    return nullptr;
+  return Data + Off;
+}
+
+bool ElfFile::isValid() const {
+  if (Data == nullptr)
+    return false;
+  const Elf64_Ehdr *Ehdr = reinterpret_cast<const Elf64_Ehdr *>(Data);
+  return memcmp(Ehdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+         Ehdr->e_ident[EI_CLASS] == ELFCLASS64 &&
+         Ehdr->e_machine == EM_X86_64 &&
+         Ehdr->e_shentsize == sizeof(Elf64_Shdr);
+}
+
+const Elf64_Shdr *ElfFile::getSections(unsigned &Num) const {
+  const Elf64_Ehdr *Ehdr = reinterpret_cast<const Elf64_Ehdr *>(Data);
+  Num = Ehdr->e_shnum;
+  return reinterpret_cast<const Elf64_Shdr *>(
+      getBytes(Ehdr->e_shoff, (uint64_t)Num * sizeof(Elf64_Shdr)));
+}
+
+std::string ElfFile::getBuildId() const {
+  unsigned Num;
+  const Elf64_Shdr *Shdrs = getSections(Num);
+  for (unsigned Idx = 0; Shdrs != nullptr && Idx != Num; ++Idx) {
+    const Elf64_Shdr &Shdr = Shdrs[Idx];
+    if (Shdr.sh_type != SHT_NOTE)
+      continue;
+    // Walk the notes of the section, looking for NT_GNU_BUILD_ID.
+    for (uint64_t Off = 0; Off + sizeof(Elf64_Nhdr) <= Shdr.sh_size;) {
+      const char *Note = getBytes(Shdr.sh_offset + Off, sizeof(Elf64_Nhdr));
+      if (Note == nullptr)
+        break;
+      const Elf64_Nhdr *Nhdr = reinterpret_cast<const Elf64_Nhdr *>(Note);
+      uint64_t NameSz = (Nhdr->n_namesz + 3) & ~3ULL;
+      uint64_t DescSz = (Nhdr->n_descsz + 3) & ~3ULL;
+      const char *Desc =
+          getBytes(Shdr.sh_offset + Off + sizeof(Elf64_Nhdr) + NameSz,
+                   Nhdr->n_descsz);
+      if (Nhdr->n_type == NT_GNU_BUILD_ID && Desc != nullptr) {
+        std::stringstream SS;
+        for (unsigned Byte = 0; Byte != Nhdr->n_descsz; ++Byte)
+          SS << std::hex << std::setw(2) << std::setfill('0')
+             << (unsigned)(uint8_t)Desc[Byte];
+        return SS.str();
+      }
+      Off += sizeof(Elf64_Nhdr) + NameSz + DescSz;
+    }
+  }
+  return "";
+}
+
+std::vector<ElfFile::CodeSection> ElfFile::getCodeSections() const {
+  std::vector<CodeSection> Sections;
+  unsigned Num;
+  const Elf64_Shdr *Shdrs = getSections(Num);
+  for (unsigned Idx = 0; Shdrs != nullptr && Idx != Num; ++Idx) {
+    const Elf64_Shdr &Shdr = Shdrs[Idx];
+    if (Shdr.sh_type != SHT_PROGBITS || !(Shdr.sh_flags & SHF_EXECINSTR) ||
+        getBytes(Shdr.sh_offset, Shdr.sh_size) == nullptr)
+      continue;
+    Sections.push_back({Shdr.sh_offset, Shdr.sh_size});
+  }
+  return Sections;
+}
+
+bool ElfFile::getOffsetOfVAddr(uint64_t VAddr, uint64_t &Offset) const {
+  const Elf64_Ehdr *Ehdr = reinterpret_cast<const Elf64_Ehdr *>(Data);
+  const Elf64_Phdr *Phdrs = reinterpret_cast<const Elf64_Phdr *>(
+      getBytes(Ehdr->e_phoff, (uint64_t)Ehdr->e_phnum * sizeof(Elf64_Phdr)));
+  for (unsigned Idx = 0; Phdrs != nullptr && Idx != Ehdr->e_phnum; ++Idx) {
+    const Elf64_Phdr &Phdr = Phdrs[Idx];
+    if (Phdr.p_type != PT_LOAD || VAddr < Phdr.p_vaddr ||
+        VAddr - Phdr.p_vaddr >= Phdr.p_filesz)
+      continue;
+    Offset = VAddr - Phdr.p_vaddr + Phdr.p_offset;
+    return true;
+  }
+  return false;
+}
+
+std::vector<ElfFile::Function> ElfFile::getFunctions() const {
+  std::vector<Function> Functions;
+  unsigned Num;
+  const Elf64_Shdr *Shdrs = getSections(Num);
+  for (unsigned Idx = 0; Shdrs != nullptr && Idx != Num; ++Idx) {
+    const Elf64_Shdr &Shdr = Shdrs[Idx];
+    if ((Shdr.sh_type != SHT_SYMTAB && Shdr.sh_type != SHT_DYNSYM) ||
+        Shdr.sh_link >= Num)
+      continue;
+    const Elf64_Shdr &StrShdr = Shdrs[Shdr.sh_link];
+    const char *Strs = getBytes(StrShdr.sh_offset, StrShdr.sh_size);
+    const Elf64_Sym *Syms = reinterpret_cast<const Elf64_Sym *>(
+        getBytes(Shdr.sh_offset, Shdr.sh_size));
+    if (Strs == nullptr || Syms == nullptr)
+      continue;
+    for (uint64_t S = 0, E = Shdr.sh_size / sizeof(Elf64_Sym); S != E; ++S) {
+      const Elf64_Sym &Sym = Syms[S];
+      uint64_t Offset;
+      if (ELF64_ST_TYPE(Sym.st_info) != STT_FUNC ||
+          Sym.st_shndx == SHN_UNDEF || Sym.st_size == 0 ||
+          Sym.st_name >= StrShdr.sh_size ||
+          !getOffsetOfVAddr(Sym.st_value, Offset))
+        continue;
+      Functions.push_back({Strs + Sym.st_name, Offset, Sym.st_size});
+    }
+  }
+  return Functions;
+}
+
+/// Append the directories of the colon-separated \p List to \p Dirs,
+/// replacing $ORIGIN with \p Origin.
+static void addSearchDirs(const std::string &List, const std::string &Origin,
+                          std::vector<std::string> &Dirs) {
+  std::stringstream SS(List);
+  std::string Dir;
+  while (std::getline(SS, Dir, ':')) {
+    if (Dir.empty())
+      continue;
+    strReplace(Dir, "$ORIGIN", Origin.c_str());
+    Dirs.push_back(Dir);
+  }
+}
+
+std::vector<std::string> ElfFile::getNeededLibs() const {
+  std::vector<std::string> Needed, Dirs, Libs;
+  std::string RPath, RunPath;
+  unsigned Num;
+  const Elf64_Shdr *Shdrs = getSections(Num);
+  for (unsigned Idx = 0; Shdrs != nullptr && Idx != Num; ++Idx) {
+    const Elf64_Shdr &Shdr = Shdrs[Idx];
+    if (Shdr.sh_type != SHT_DYNAMIC || Shdr.sh_link >= Num)
+      continue;
+    const Elf64_Shdr &StrShdr = Shdrs[Shdr.sh_link];
+    const char *Strs = getBytes(StrShdr.sh_offset, StrShdr.sh_size);
+    const Elf64_Dyn *Dyns =
+        reinterpret_cast<const Elf64_Dyn *>(getBytes(Shdr.sh_offset, Shdr.sh_size));
+    if (Strs == nullptr || Dyns == nullptr)
+      continue;
+    for (uint64_t D = 0, E = Shdr.sh_size / sizeof(Elf64_Dyn); D != E; ++D) {
+      const Elf64_Dyn &Dyn = Dyns[D];
+      if (Dyn.d_tag == DT_NULL)
+        break;
+      if (Dyn.d_un.d_val >= StrShdr.sh_size)
+        continue;
+      const char *Str = Strs + Dyn.d_un.d_val;
+      if (Dyn.d_tag == DT_NEEDED)
+        Needed.push_back(Str);
+      else if (Dyn.d_tag == DT_RPATH)
+        RPath = Str;
+      else if (Dyn.d_tag == DT_RUNPATH)
+        RunPath = Str;
+    }
+  }
+
+  // The same order as the dynamic linker, see ld.so(8).
+  std::string Origin = Path.substr(0, Path.rfind('/'));
+  if (RunPath.empty())
+    addSearchDirs(RPath, Origin, Dirs);
+  if (const char *LdLibraryPath = getenv("LD_LIBRARY_PATH"))
+    addSearchDirs(LdLibraryPath, Origin, Dirs);
+  addSearchDirs(RunPath, Origin, Dirs);
+  Dirs.insert(Dirs.end(), std::begin(DefaultLibDirs), std::end(DefaultLibDirs));
+
+  for (const std::string &Lib : Needed) {
+    std::vector<std::string> Candidates;
+    if (Lib.find('/') != std::string::npos)
+      Candidates.push_back(Lib);
+    else
+      for (const std::string &Dir : Dirs)
+        Candidates.push_back(Dir + "/" + Lib);
+    for (const std::string &Candidate : Candidates) {
+      char Real[PATH_MAX];
+      if (realpath(Candidate.c_str(), Real) != nullptr &&
+          ElfFile(Real).isValid()) {
+        Libs.push_back(Real);
+        break;
+      }
+    }
+  }
+  return Libs;
+}
@@ -0,0 +1,101 @@
+//-*- C++ -*-
+// A read-only view of an ELF file.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __ELFFILE_H__
+#define __ELFFILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/elf.h>
+#include <string>
+#include <vector>
+
+/// A 64-bit x86 ELF file, mapped read-only.
+class ElfFile {
+public:
+  /// An executable section.
+  struct CodeSection {
+    /// The offset of the section in the file.
+    uint64_t Offset;
+    /// The size of the section in bytes.
+    uint64_t Size;
+  };
+
+  /// A function defined in the file.
+  struct Function {
+    /// The symbol name.
+    std::string Name;
+    /// The offset of its code in the file.
+    uint64_t Offset;
+    /// The size of its code in bytes.
+    uint64_t Size;
+  };
+
+private:
+  /// The path the file was opened from.
+  std::string Path;
+
+  /// The mapping of the whole file.
+  const char *Data = nullptr;
+
+  /// The size of the file.
+  size_t Size = 0;
+
+  /// \Returns a pointer to \p Sz bytes at \p Off, or null if out of bounds.
+  const char *getBytes(uint64_t Off, uint64_t Sz) const;
+
+  /// \Returns the section headers.
+  const Elf64_Shdr *getSections(unsigned &Num) const;
+
+  /// Set \p Offset to the file offset of virtual address \p VAddr. \Returns
+  /// false if \p VAddr is not in a loadable segment.
+  bool getOffsetOfVAddr(uint64_t VAddr, uint64_t &Offset) const;
+
+public:
+  /// Map \p Path. \Returns without a mapping if it cannot be read, see
+  /// isValid().
+  explicit ElfFile(const std::string &Path);
+  ElfFile(const ElfFile &) = delete;
+  ~ElfFile();
+
+  /// \Returns true if the file is a 64-bit x86 ELF file.
+  bool isValid() const;
+
+  /// \Returns the GNU build-id as a hex string, or "" if there is none.
+  std::string getBuildId() const;
+
+  /// \Returns the executable sections.
+  std::vector<CodeSection> getCodeSections() const;
+
+  /// \Returns the functions of the symbol tables (.symtab and .dynsym).
+  /// Aliases are all listed.
+  std::vector<Function> getFunctions() const;
+
+  /// \Returns the bytes of the file at \p Offset.
+  const uint8_t *getCode(uint64_t Offset) const {
+    return reinterpret_cast<const uint8_t *>(Data + Offset);
+  }
+
+  /// \Returns the paths of the libraries that the file needs (DT_NEEDED),
+  /// searched for in the same directories as the dynamic linker does, except
+  /// for its cache. Libraries that are not found are skipped.
+  std::vector<std::string> getNeededLibs() const;
+};
+
+#endif // __ELFFILE_H__
@@ -55,7 +55,26 @@ bool ExecutionExitState::isSet() const {
   return StdoutFd != -1 && StderrFd != -1 && State.isSet();
 }
 
+bool ExecutionExitState::useMemFiles() {
+  // Writes to memfds generate no inotify events, which the early corruption
+  // kill relies on.
+  return !NoCleanup.getValue() && !DiffCmd.isSet() &&
+         !EarlyCorruptionKill.getValue();
+}
+
 void ExecutionExitState::initFiles(long Id) {
+  if (useMemFiles()) {
+    // The memfds can be reopened by other processes through /proc, e.g., by
+    // the clones of the fork server.
+    std::string Name = "zofi." + std::to_string(Id);
+    StdoutFd = memfdCreateSafe((Name + ".stdout").c_str());
+    StderrFd = memfdCreateSafe((Name + ".stderr").c_str());
+    pid_t Pid = getpid();
+    snprintf(StdoutFile, FnameSz, "/proc/%d/fd/%d", Pid, StdoutFd);
+    snprintf(StderrFile, FnameSz, "/proc/%d/fd/%d", Pid, StderrFd);
+    InMemory = true;
+    return;
+  }
   // Open the Stdout and Stderr file descriptors.
   snprintf(StdoutFile, FnameSz, "%s.%ld.XXXXXX", Stdout.getValue().c_str(), Id);
   snprintf(StderrFile, FnameSz, "%s.%ld.XXXXXX", Stderr.getValue().c_str(), Id);
@@ -63,11 +82,55 @@ void ExecutionExitState::initFiles(long Id) {
   StderrFd = mkstempSafe(StderrFile);
 }
 
+void ExecutionExitState::shareFiles(const ExecutionExitState &Other) {
+  StdoutFd = Other.StdoutFd;
+  StderrFd = Other.StderrFd;
+  memcpy(StdoutFile, Other.StdoutFile, FnameSz);
+  memcpy(StderrFile, Other.StderrFile, FnameSz);
+  InMemory = Other.InMemory;
+}
+
+void ExecutionExitState::seal() {
+  if (!InMemory)
+    return;
+  for (int Fd : {StdoutFd, StderrFd})
+    if (fcntl(Fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+      die("Failed to seal the output fd ", Fd);
+}
+
+void ExecutionExitState::truncateFiles() {
+  for (int Fd : {StdoutFd, StderrFd})
+    if (ftruncate(Fd, 0) != 0 || lseek(Fd, 0, SEEK_SET) != 0)
+      die("Failed to truncate the output fd ", Fd);
+}
+
+void ExecutionExitState::closeFiles() {
+  for (int *Fd : {&StdoutFd, &StderrFd})
+    if (*Fd >= 0) {
+      closeSafe(*Fd);
+      *Fd = -1;
+    }
+}
+
+void ExecutionExitState::computeDigests() {
+  // Our own fds may belong to the job that wrote the files, so use the paths.
+  int OutFd = openSafe(StdoutFile, O_RDONLY);
+  int ErrFd = openSafe(StderrFile, O_RDONLY);
+  StdoutDigest = OutputDigest(OutFd);
+  StderrDigest = OutputDigest(ErrFd);
+  HasDigests = true;
+  closeSafe(OutFd);
+  closeSafe(ErrFd);
+}
+
 void ExecutionExitState::import(const char *Str) {
 // /path/to/stdout,/path/to/stderr,{exit:<EXIT_CODE>,signaled:<SIGNAL>}
 #define MaxTySz 10
   char ExitTypeStr[MaxTySz];
   int Val;
+  // Don't mistake an earlier error for one of sscanf().
+  errno = 0;
   int Cnt = sscanf(Str, "%" STRFY(FnameSz) "[^,],%" STRFY(
                             FnameSz) "[^,],%" STRFY(MaxTySz) "[^:]:%d",
                    StdoutFile, StderrFile, ExitTypeStr, &Val);
@@ -78,17 +141,37 @@ void ExecutionExitState::import(const char *Str) {
     if (!fileExists(File))
       userDie("File ", File, " does not exist.");
   State.import(ExitTypeStr, Val);
+  InMemory = false;
+  HasDigests = false;
+}
+
+bool ExecutionExitState::sameOutput(int Fd, const char *OtherFile,
+                                    const OutputDigest &OtherDigest) const {
+  if (!OtherDigest.matches(Fd))
+    return false;
+  if (!ExactOutputCompare.getValue())
+    return true;
+  int OtherFd = openSafe(OtherFile, O_RDONLY);
+  bool Same = defaultDiff(Fd, OtherFd);
+  closeSafe(OtherFd);
+  return Same;
 }
 
 bool ExecutionExitState::operator==(const ExecutionExitState &OtherState) const {
+  if (!(State == OtherState.getExitState()))
+    return false;
+  if (OtherState.HasDigests)
+    return sameOutput(StdoutFd, OtherState.getStdoutFile(),
+                      OtherState.StdoutDigest) &&
+           sameOutput(StderrFd, OtherState.getStderrFile(),
+                      OtherState.StderrDigest);
+
   int OtherStdoutFd = openSafe(OtherState.getStdoutFile(), O_RDONLY);
   int OtherStderrFd = openSafe(OtherState.getStderrFile(), O_RDONLY);
-  bool Same = State == OtherState.getExitState() &&
-              defaultDiff(StdoutFd, OtherStdoutFd) &&
+  bool Same = defaultDiff(StdoutFd, OtherStdoutFd) &&
               defaultDiff(StderrFd, OtherStderrFd);
 
   closeSafe(OtherStdoutFd);
   closeSafe(OtherStderrFd);
   return Same;
 }
-
@@ -23,6 +23,7 @@
 #include <linux/limits.h>
 #include "utils.h"
 #include "debugstream.h"
+#include "outputDigest.h"
 
 // The maximum file name size.
 #define FnameSz PATH_MAX
@@ -84,12 +85,48 @@ class ExecutionExitState {
   /// The unique name of the file containing the dump of Stderr.
   char StderrFile[FnameSz];
 
+  /// The files are memfds, named by their /proc/<pid>/fd/ link.
+  bool InMemory = false;
+
+  /// The digests of the stdout and stderr, set for the golden outputs only.
+  OutputDigest StdoutDigest;
+  OutputDigest StderrDigest;
+  bool HasDigests = false;
+
+  /// \Returns true if the contents of \p Fd match the output \p OtherFile with
+  /// digest \p OtherDigest.
+  bool sameOutput(int Fd, const char *OtherFile,
+                  const OutputDigest &OtherDigest) const;
+
 public:
   ExecutionExitState();
   /// Creates the stdout/stderr files. We use \p the Id of this run as part of
   /// the file for being able to track the outputs when debugging.
   void initFiles(long Id);
 
+  /// \Returns true if the outputs are kept in memfds instead of files. Real
+  /// files are only needed by -diff-cmd and -no-cleanup.
+  static bool useMemFiles();
+
+  /// \Returns true if the files are memfds that need no removal.
+  bool isInMemory() const { return InMemory; }
+
+  /// Use the stdout/stderr files of \p Other instead of creating new ones.
+  void shareFiles(const ExecutionExitState &Other);
+
+  /// Make the in-memory files read-only for good.
+  void seal();
+
+  /// Empty the stdout/stderr files and rewind their file offsets.
+  void truncateFiles();
+
+  /// Close the stdout/stderr file descriptors.
+  void closeFiles();
+
+  /// Digest the stdout/stderr files, so that the outputs of the test runs are
+  /// compared against the digests instead of the files.
+  void computeDigests();
+
   /// Return true if the state has been initialized.
   bool isSet() const;
 
@@ -102,7 +139,8 @@ public:
   int getStderrFd() const { return StderrFd; }
   /// Parse \p Str and import the execution state from it.
   void import(const char *Str);
-  /// Comparison using the defaultDiff().
+  /// Comparison against the digests of \p State2, or using the defaultDiff()
+  /// if it has none.
   bool operator==(const ExecutionExitState &State2) const;
 };
 
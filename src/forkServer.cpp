@@ -0,0 +1,226 @@
+// A pre-initialized copy of the workload that test runs are cloned from.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "forkServer.h"
+#include "breakpoint.h"
+#include "debugstream.h"
+#include "elfFile.h"
+#include "optionsList.h"
+#include "remoteSyscall.h"
+#include "runner.h"
+#include "terminal.h"
+#include "utils.h"
+#include <cassert>
+#include <cstddef>
+#include <fstream>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/auxvec.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+/// \Returns the ELF entry point of process \p Pid, as found in its auxv.
+static unsigned long getEntryPoint(pid_t Pid) {
+  std::string AuxvFile = "/proc/" + std::to_string(Pid) + "/auxv";
+  int Fd = openSafe(AuxvFile.c_str(), O_RDONLY);
+  unsigned long Entry = 0;
+  unsigned long Pair[2];
+  while (read(Fd, Pair, sizeof(Pair)) == sizeof(Pair) && Pair[0] != AT_NULL)
+    if (Pair[0] == AT_ENTRY)
+      Entry = Pair[1];
+  closeSafe(Fd);
+  if (Entry == 0)
+    die("No AT_ENTRY in ", AuxvFile);
+  return Entry;
+}
+
+/// Set \p Main to the address of main() in the binary mapped at \p Entry of
+/// \p AS. \Returns false if the binary has no symbol for it, e.g. if it is
+/// stripped.
+static bool getMainAddress(AddressSpace &AS, unsigned long Entry,
+                           unsigned long &Main) {
+  const AddressSpace::Region *R = AS.findRegion(Entry);
+  if (R == nullptr)
+    return false;
+  ElfFile Elf(R->Path);
+  if (!Elf.isValid())
+    return false;
+  for (const ElfFile::Function &Func : Elf.getFunctions())
+    if (Func.Name == "main")
+      return AS.getAddress(R->Path, Func.Offset, Main);
+  return false;
+}
+
+/// Let the stopped process \p Pid run until it reaches \p Addr and leave it
+/// stopped there. \Returns false if it stopped or exited for another reason.
+static bool runToAddress(pid_t Pid, unsigned long Addr) {
+  Breakpoint BP(Pid, Addr);
+  BP.enable();
+  ptraceSafe(PTRACE_CONT, Pid, 0, 0);
+  int Status = waitpidSafe(Pid).Status;
+  user_regs_struct Regs;
+  if (!WIFSTOPPED(Status) || WSTOPSIG(Status) != SIGTRAP ||
+      ptrace(PTRACE_GETREGS, Pid, nullptr, &Regs) == -1 || !BP.isHit(Regs))
+    return false;
+  BP.disable();
+  BP.rewind(Pid);
+  return true;
+}
+
+/// \Returns the Yama ptrace scope, or 0 if Yama is not enabled.
+static int getYamaPtraceScope() {
+  std::fstream FS("/proc/sys/kernel/yama/ptrace_scope", std::fstream::in);
+  int Scope = 0;
+  if (!FS.fail())
+    FS >> Scope;
+  return Scope;
+}
+
+ForkServer::~ForkServer() {
+  if (ServerPID == 0)
+    return;
+  kill(ServerPID, SIGKILL);
+  // We are either the parent or the tracer, so we get to wait for it.
+  int Status;
+  waitpid(ServerPID, &Status, __WALL);
+  if (TerminalFd != -1)
+    closeSafe(TerminalFd);
+}
+
+void ForkServer::start() {
+  // Only the tracer of a process may attach to its clones when Yama is in
+  // "admin-only attach" mode or stricter.
+  if (getYamaPtraceScope() >= 2)
+    userDie("Error: ", UseForkServer.getFlag(),
+            " needs /proc/sys/kernel/yama/ptrace_scope to be 0 or 1.");
+
+  RunnerBase::sanityChecksOrExit();
+  std::vector<const char *> Argv, Argp;
+  RunnerBase::initExecArgs(Argv, Argp);
+  if (!NoRedirect.getValue() && !NoTty.getValue())
+    std::tie(ServerPID, TerminalFd) = forkptySafe();
+  else
+    ServerPID = forkSafe();
+
+  if (ServerPID == 0) {
+    if (NoTty.getValue() && !detachTerminal())
+      die("Failed to detach from the terminal");
+    ptraceSafe(PTRACE_TRACEME, 0, 0, 0);
+    execve(Binary.getValue(), (char *const *)Argv.data(),
+           (char *const *)Argp.data());
+    perror("execve()");
+    die("execve error");
+  }
+  Launched = true;
+  dbg(2) << "Fork server " << ServerPID << "\n";
+
+  // Wait for the server to stop at execve.
+  int Status = waitpidSafe(ServerPID).Status;
+  if (!WIFSTOPPED(Status))
+    userDie("Error: The fork server exited before reaching execve().");
+  ptraceSafe(PTRACE_SETOPTIONS, ServerPID, 0,
+             (void *)(PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL));
+
+  // Let the dynamic linker do its job and stop at the entry point.
+  unsigned long Entry = getEntryPoint(ServerPID);
+  if (!runToAddress(ServerPID, Entry))
+    userDie("Error: The fork server did not reach its entry point ",
+            (void *)Entry, ".");
+  dbg(2) << "Fork server stopped at entry point " << (void *)Entry << "\n";
+  // Parse the mappings once here, instead of once in every clone.
+  AS.reset(new AddressSpace(ServerPID));
+  AS->refresh();
+  // Also run the C runtime start-up code and the static constructors only
+  // once, if we can find main().
+  unsigned long Main;
+  if (!getMainAddress(*AS, Entry, Main)) {
+    dbg(2) << "No symbol for main(), the fork server stays at the entry "
+              "point\n";
+    return;
+  }
+  if (!runToAddress(ServerPID, Main))
+    userDie("Error: The fork server did not reach main() at ", (void *)Main,
+            ".");
+  dbg(2) << "Fork server stopped at main() " << (void *)Main << "\n";
+  // The constructors may have mapped more memory.
+  AS->refresh();
+}
+
+void ForkServer::adopt(pid_t PID, const AddressSpace *Layout) {
+  assert(ServerPID == 0 && "Already have a server");
+  ServerPID = PID;
+  ptraceSafe(PTRACE_SEIZE, ServerPID, 0,
+             (void *)(PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL));
+  // The server is in a group-stop, so seizing it puts it in a ptrace-stop.
+  int Status;
+  if (waitpid(ServerPID, &Status, __WALL) != ServerPID || !WIFSTOPPED(Status))
+    die("Adopted fork server ", ServerPID, " is not stopped.");
+  if (Layout != nullptr)
+    AS.reset(new AddressSpace(*Layout, ServerPID));
+  dbg(2) << "Adopted fork server " << ServerPID << "\n";
+}
+
+pid_t ForkServer::clone() {
+  assert(ServerPID != 0 && "No server");
+  RemoteSyscall RS(ServerPID);
+  return RS.fork(CLONE_PARENT | SIGCHLD);
+}
+
+pid_t ForkServer::cloneForHandover() {
+  assert(Launched && "Only the main process hands over clones");
+  pid_t Clone = clone();
+  if (Clone == 0)
+    die("Failed to clone the fork server.");
+  // With Yama in "restricted" mode only our descendants may attach to it.
+  if (getYamaPtraceScope() == 1) {
+    RemoteSyscall RS(Clone);
+    if (RS.call(SYS_prctl, PR_SET_PTRACER, getpid()) != 0)
+      die("prctl(PR_SET_PTRACER) failed in clone ", Clone);
+  }
+  // Detach it, but leave it stopped until its new tracer picks it up.
+  ptraceSafe(PTRACE_DETACH, Clone, 0, (void *)SIGSTOP);
+  int Status;
+  if (waitpid(Clone, &Status, WUNTRACED) != Clone || !WIFSTOPPED(Status))
+    die("Clone ", Clone, " did not stop after detaching.");
+  return Clone;
+}
+
+void ForkServer::trapGetrandom() {
+  assert(ServerPID != 0 && "No server");
+  struct sock_filter Filter[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_getrandom, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+  RemoteSyscall RS(ServerPID);
+  struct sock_fprog Prog;
+  Prog.len = sizeof(Filter) / sizeof(Filter[0]);
+  Prog.filter = (struct sock_filter *)RS.pushData(Filter, sizeof(Filter));
+  unsigned long ProgAddr = RS.pushData(&Prog, sizeof(Prog));
+  // Unprivileged processes can only install filters with no_new_privs.
+  if (RS.call(SYS_prctl, PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0 ||
+      RS.call(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, ProgAddr) != 0)
+    userDie("Error: Failed to install the seccomp filter in the fork server.");
+  dbg(2) << "Fork server " << ServerPID << " traps getrandom()\n";
+}
@@ -0,0 +1,98 @@
+//-*- C++ -*-
+// A pre-initialized copy of the workload that test runs are cloned from.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __FORKSERVER_H__
+#define __FORKSERVER_H__
+
+#include "addrSpace.h"
+#include <memory>
+#include <sys/types.h>
+
+/// A stopped, traced copy of the workload that we can clone from, instead of
+/// running execve() and the dynamic linker for every run. The clones are
+/// created by making the server call clone() (see RemoteSyscall), so they are
+/// copy-on-write copies of it.
+///
+/// Since only the tracer of the server can clone it, each job gets its own
+/// server: the main process clones its server once per job with
+/// cloneForHandover() and the job adopt()s the clone and creates the copies
+/// for its own runs with clone().
+///
+/// All clones are created with CLONE_PARENT, so they are children of the main
+/// zofi process, which reaps them.
+class ForkServer {
+  /// The stopped process that we clone from.
+  pid_t ServerPID = 0;
+
+  /// The server's terminal fd, as returned by forkpty().
+  int TerminalFd = -1;
+
+  /// True if the main process owns the server, false if adopted by a job.
+  bool Launched = false;
+
+  /// The address space of the server. The clones start with the same one.
+  std::unique_ptr<AddressSpace> AS;
+
+public:
+  ForkServer() = default;
+  ForkServer(const ForkServer &) = delete;
+  ~ForkServer();
+
+  /// Run the binary and stop it at main(), after the dynamic linker and the
+  /// static constructors have run. If the binary has no symbol for main(), it
+  /// stops at its ELF entry point instead.
+  void start();
+
+  /// Take over \p PID, a clone created by cloneForHandover() of some other
+  /// server. \p Layout, if not null, is the address space of that server.
+  void adopt(pid_t PID, const AddressSpace *Layout = nullptr);
+
+  /// Use \p PID as the server. It must be a stopped process that we trace.
+  void own(pid_t PID) {
+    ServerPID = PID;
+    Launched = true;
+    AS.reset(new AddressSpace(PID));
+    AS->refresh();
+  }
+
+  /// \Returns a new copy of the server. The copy is in a ptrace-stop and is
+  /// traced by us. \Returns 0 on failure.
+  pid_t clone();
+
+  /// \Returns a new copy of the server that is not traced by anyone and that
+  /// sits in a group-stop, ready to be adopt()ed by another process.
+  pid_t cloneForHandover();
+
+  /// Install a seccomp filter in the server that traps getrandom() with a
+  /// PTRACE_EVENT_SECCOMP stop, so that the tracers of the clones can feed
+  /// the same bytes to all of them. The tracers need PTRACE_O_TRACESECCOMP,
+  /// otherwise getrandom() fails with ENOSYS.
+  void trapGetrandom();
+
+  /// \Returns true if we have a server to clone from.
+  bool isRunning() const { return ServerPID != 0; }
+
+  /// \Returns the address space of the server, or nullptr if not known.
+  const AddressSpace *getAddressSpace() const { return AS.get(); }
+
+  /// \Returns the PID of the server.
+  pid_t getPID() const { return ServerPID; }
+};
+
+#endif //__FORKSERVER_H__
@@ -0,0 +1,72 @@
+// The functions that faults are injected into.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "funcScope.h"
+#include "debugstream.h"
+#include "elfFile.h"
+#include "utils.h"
+#include <algorithm>
+
+FunctionScope &FunctionScope::get() {
+  static FunctionScope Scope;
+  return Scope;
+}
+
+unsigned FunctionScope::resolve(const std::vector<std::string> &Files,
+                                const std::string &Patterns) {
+  std::vector<std::string> Globs = splitList(Patterns);
+  unsigned NumFunctions = 0;
+  for (const std::string &File : Files) {
+    ElfFile Elf(File);
+    if (!Elf.isValid())
+      continue;
+    std::vector<Range> FileRanges;
+    for (const ElfFile::Function &Func : Elf.getFunctions()) {
+      if (!matchesAny(Globs, Func.Name))
+        continue;
+      dbg(2) << "Injecting to " << Func.Name << " of " << File << "\n";
+      FileRanges.push_back({Func.Offset, Func.Offset + Func.Size});
+      ++NumFunctions;
+    }
+    if (FileRanges.empty())
+      continue;
+    // Merge the aliases and the overlapping functions, so that a binary
+    // search finds the only range that may contain an offset.
+    std::sort(FileRanges.begin(), FileRanges.end(),
+              [](const Range &R1, const Range &R2) { return R1.From < R2.From; });
+    std::vector<Range> &Merged = Ranges[File];
+    for (const Range &R : FileRanges) {
+      if (!Merged.empty() && R.From < Merged.back().To)
+        Merged.back().To = std::max(Merged.back().To, R.To);
+      else
+        Merged.push_back(R);
+    }
+  }
+  return NumFunctions;
+}
+
+bool FunctionScope::contains(const std::string &Path, uint64_t Offset) const {
+  auto FileIt = Ranges.find(Path);
+  if (FileIt == Ranges.end())
+    return false;
+  const std::vector<Range> &FileRanges = FileIt->second;
+  auto It = std::upper_bound(
+      FileRanges.begin(), FileRanges.end(), Offset,
+      [](uint64_t Offset, const Range &R) { return Offset < R.From; });
+  return It != FileRanges.begin() && Offset < std::prev(It)->To;
+}
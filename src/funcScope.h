@@ -0,0 +1,72 @@
+//-*- C++ -*-
+// The functions that faults are injected into.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __FUNCSCOPE_H__
+#define __FUNCSCOPE_H__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// The code of the functions selected with -inject-to-functions, by file and
+/// file offset, so that it does not depend on where the files get mapped.
+/// It is resolved once by the main process and inherited by the jobs.
+class FunctionScope {
+public:
+  /// The code of a function, or of several overlapping ones.
+  struct Range {
+    /// The file offset of the entry point.
+    uint64_t From;
+    /// The file offset of the end, exclusive.
+    uint64_t To;
+  };
+
+private:
+  /// The ranges of each file, sorted and not overlapping.
+  std::map<std::string, std::vector<Range>> Ranges;
+
+  FunctionScope() = default;
+
+public:
+  FunctionScope(const FunctionScope &) = delete;
+
+  /// \Returns the scope of the process.
+  static FunctionScope &get();
+
+  /// Add the functions of \p Files whose names match any of the
+  /// comma-separated glob patterns of \p Patterns. \Returns the number of
+  /// functions added.
+  unsigned resolve(const std::vector<std::string> &Files,
+                   const std::string &Patterns);
+
+  /// \Returns true if no function has been selected, in which case we
+  /// inject anywhere.
+  bool empty() const { return Ranges.empty(); }
+
+  /// \Returns true if offset \p Offset of file \p Path is in the scope.
+  bool contains(const std::string &Path, uint64_t Offset) const;
+
+  /// \Returns the ranges of each file.
+  const std::map<std::string, std::vector<Range>> &getRanges() const {
+    return Ranges;
+  }
+};
+
+#endif //__FUNCSCOPE_H__
@@ -0,0 +1,105 @@
+// Count the instructions executed by a thread using perf_event_open().
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "instrCounter.h"
+#include "debugstream.h"
+#include "utils.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/// \Returns the attributes of a counter of user-space instructions.
+static struct perf_event_attr getInstrCounterAttr() {
+  struct perf_event_attr Attr;
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  // We are only interested in the workload's own instructions.
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  return Attr;
+}
+
+/// Safe perf_event_open() for thread \p Tid on any CPU.
+static int perfEventOpenSafe(struct perf_event_attr &Attr, pid_t Tid) {
+  int Fd = syscall(SYS_perf_event_open, &Attr, Tid, -1 /* any cpu */,
+                   -1 /* no group */, 0);
+  if (Fd == -1)
+    userDie("Error: Failed to count instructions with perf_event_open(): ",
+            strerror(errno), ".\n",
+            "Error: This needs a CPU with a performance monitoring unit and ",
+            "/proc/sys/kernel/perf_event_paranoid set to 2 or less.");
+  return Fd;
+}
+
+void InstrCounter::checkAvailable() {
+  struct perf_event_attr Attr = getInstrCounterAttr();
+  closeSafe(perfEventOpenSafe(Attr, 0 /* self */));
+}
+
+InstrCounter::InstrCounter(pid_t Tid, unsigned long StopAfter) : Tid(Tid) {
+  struct perf_event_attr Attr = getInstrCounterAttr();
+  if (StopAfter != 0) {
+    Attr.sample_period = StopAfter;
+    Attr.wakeup_events = 1;
+    // Enabled below, once the overflow signal is set up.
+    Attr.disabled = 1;
+  }
+  Fd = perfEventOpenSafe(Attr, Tid);
+  if (StopAfter == 0)
+    return;
+  // Route the overflow notification to the thread as a SIGTRAP.
+  struct f_owner_ex Owner;
+  Owner.type = F_OWNER_TID;
+  Owner.pid = Tid;
+  if (fcntl(Fd, F_SETOWN_EX, &Owner) == -1 ||
+      fcntl(Fd, F_SETSIG, SIGTRAP) == -1 ||
+      fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_ASYNC) == -1)
+    die("Failed to set up the perf overflow signal for ", Tid);
+  // Enable the counter for a single overflow.
+  if (ioctl(Fd, PERF_EVENT_IOC_REFRESH, 1) == -1)
+    die("Failed to enable the perf counter for ", Tid);
+  dbg(2) << "Stop " << Tid << " after " << StopAfter << " instructions\n";
+}
+
+void InstrCounter::stopAfter(unsigned long Instrs) {
+  uint64_t Period = Instrs;
+  // The counter was disabled by its last overflow, so enable it again for a
+  // single overflow with the new period.
+  if (ioctl(Fd, PERF_EVENT_IOC_PERIOD, &Period) == -1 ||
+      ioctl(Fd, PERF_EVENT_IOC_REFRESH, 1) == -1)
+    die("Failed to re-arm the perf counter for ", Tid);
+  dbg(2) << "Stop " << Tid << " after " << Instrs << " more instructions\n";
+}
+
+InstrCounter::~InstrCounter() {
+  if (Fd != -1)
+    closeSafe(Fd);
+}
+
+unsigned long InstrCounter::read() const {
+  uint64_t Count = 0;
+  if (::read(Fd, &Count, sizeof(Count)) != sizeof(Count))
+    die("Failed to read the instruction counter of ", Tid);
+  return Count;
+}
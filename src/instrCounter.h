@@ -0,0 +1,56 @@
+//-*- C++ -*-
+// Count the instructions executed by a thread using perf_event_open().
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __INSTRCOUNTER_H__
+#define __INSTRCOUNTER_H__
+
+#include <sys/types.h>
+
+/// Counts the user-space instructions retired by a single thread, using a
+/// hardware performance counter. It can also stop the thread after a given
+/// number of instructions: the counter overflows and the kernel sends a
+/// SIGTRAP to the thread, which stops it since it is being traced.
+class InstrCounter {
+  /// The perf event file descriptor.
+  int Fd = -1;
+
+  /// The thread being counted.
+  pid_t Tid = 0;
+
+public:
+  /// Start counting the instructions of \p Tid, which must be stopped. If
+  /// \p StopAfter is not 0, send a SIGTRAP to \p Tid once it has executed
+  /// \p StopAfter instructions. Dies if the counter is not available.
+  InstrCounter(pid_t Tid, unsigned long StopAfter = 0);
+  InstrCounter(const InstrCounter &) = delete;
+  ~InstrCounter();
+
+  /// Exit with an error if we cannot count instructions on this system.
+  static void checkAvailable();
+
+  /// Send another SIGTRAP to the thread once it has executed \p Instrs more
+  /// instructions. The counter must have been created with a StopAfter.
+  void stopAfter(unsigned long Instrs);
+
+  /// \Returns the number of instructions counted so far. This can be called
+  /// even after the thread has exited.
+  unsigned long read() const;
+};
+
+#endif //__INSTRCOUNTER_H__
@@ -18,14 +18,17 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "options.h"
+#include "cpuPlacement.h"
 #include "debugstream.h"
 #include "optionsList.h"
+#include "regManip.h"
 #include "threads.h"
 #include "utils.h"
 #include <config.h>
 #include <cstring>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 // Warning: Thish should be declared before the individual options.
 OptionsParser Options;
@@ -97,7 +100,8 @@ void OptionsParser::init(int argc, char **argv) {
     userDie("Please use a value in the range 0-125 for the exit code.");
 
   auto HWThreads = std::thread::hardware_concurrency();
-  if (Jobs.getValue() == 0)
+  bool AllJobs = Jobs.getValue() == 0;
+  if (AllJobs)
     Jobs.setValue(HWThreads);
 
   // Limit the number of jobs to the number of hardware threads supported by the
@@ -108,13 +112,28 @@ void OptionsParser::init(int argc, char **argv) {
     Jobs.setValue(HWThreads);
   }
 
+  // Likewise for the CPUs that the placement policy can pin the jobs to.
+  if (CpuPlacementPolicy.getValue() != "none") {
+    if (!CpuPlacement::isValidPolicy(CpuPlacementPolicy.getValue()))
+      userDie("Bad value '", CpuPlacementPolicy.getValue(), "' for '",
+              CpuPlacementPolicy.getFlag(),
+              "'. Expected one of 'none', 'core' or 'thread'.");
+    unsigned MaxJobs = CpuPlacement::getMaxJobs(CpuPlacementPolicy.getValue(),
+                                                CpuTopology());
+    if (Jobs.getValue() > MaxJobs) {
+      if (!AllJobs)
+        warning("WARNING: '", CpuPlacementPolicy.getFlag(), " ",
+                CpuPlacementPolicy.getValue(), "' can place up to ", MaxJobs,
+                " jobs. We are limiting the number of jobs to ", MaxJobs,
+                ".");
+      Jobs.setValue(MaxJobs);
+    }
+  }
+
   // Check if out file exists
   if (OutMoufoplotDir.isSet() && !fileExists(OutMoufoplotDir.getValue()))
     userDie("Directory ", OutMoufoplotDir.getValue(), " does not exist.");
 
-  if (InjectionsPerRun.getValue() > 1)
-    userDie("We only support 0 or 1 injections per run");
-
   if (!fileExists(Binary.getValue()))
     userDie("Cannot find ", Binary.getValue(), " file");
 }
@@ -122,11 +141,76 @@ void OptionsParser::init(int argc, char **argv) {
 OptionsParser::OptionsParser() {}
 
 void OptionsParser::sanityChecks() {
+  // Checkpoints are taken at time points, not instruction counts.
+  if (InjectByInstrCount.getValue() && NumCheckpoints.getValue() > 0)
+    userDie("Cannot enable both '", InjectByInstrCount.getFlag(), "' and '",
+            NumCheckpoints.getFlag(), "' at the same time.");
+  if (UserInjectionInstr.isSet() && !InjectByInstrCount.getValue())
+    userDie("'", UserInjectionInstr.getFlag(), "' requires '",
+            InjectByInstrCount.getFlag(), "'.");
+  if (DecodeIndexLibs.getValue() && !DecodeIndexDir.isSet())
+    userDie("'", DecodeIndexLibs.getFlag(), "' requires '",
+            DecodeIndexDir.getFlag(), "'.");
+
+  // The vfork parent is suspended until execve(), so it cannot attach to a
+  // child that stops itself before it.
+  if (VforkSpawn.getValue() && UseSeize.getValue())
+    userDie("Cannot enable both '", VforkSpawn.getFlag(), "' and '",
+            UseSeize.getFlag(), "' at the same time.");
+
+  // Without redirection we never create a terminal anyway.
+  if (NoTty.getValue() && NoRedirect.getValue())
+    userDie("Cannot enable both '", NoTty.getFlag(), "' and '",
+            NoRedirect.getFlag(), "' at the same time.");
+
+  // A custom diff may accept outputs that differ byte by byte.
+  if (EarlyCorruptionKill.getValue() && !DiffCmd.getValue().empty())
+    userDie("Cannot enable both '", EarlyCorruptionKill.getFlag(), "' and '",
+            DiffCmd.getFlag(), "' at the same time.");
+
+  // Multiple injections are spread over the whole run.
+  if (InjectionsPerRun.getValue() > 1) {
+    if (NumCheckpoints.getValue() > 0)
+      userDie("Cannot enable both '", InjectionsPerRun.getFlag(), "' > 1 and '",
+              NumCheckpoints.getFlag(), "' at the same time.");
+    if (UserInjectionTime.isSet())
+      userDie("Cannot enable both '", InjectionsPerRun.getFlag(), "' > 1 and '",
+              UserInjectionTime.getFlag(), "' at the same time.");
+    if (UserInjectionInstr.isSet())
+      userDie("Cannot enable both '", InjectionsPerRun.getFlag(), "' > 1 and '",
+              UserInjectionInstr.getFlag(), "' at the same time.");
+  }
+
+  // The adaptive timeout starts from the runtimes of the golden runs.
+  if (AdaptiveTimeout.getValue() && DisableTimingRun.getValue())
+    userDie("Cannot enable both '", AdaptiveTimeout.getFlag(), "' and '",
+            DisableTimingRun.getFlag(), "' at the same time.");
+  if (AdaptiveTimeoutPercentile.getValue() <= 0.0 ||
+      AdaptiveTimeoutPercentile.getValue() > 100.0)
+    userDie("'", AdaptiveTimeoutPercentile.getFlag(),
+            "' should be in (0, 100].");
+  if (AdaptiveTimeoutMargin.getValue() < 0.0)
+    userDie("'", AdaptiveTimeoutMargin.getFlag(), "' should not be negative.");
+  if (StepToEligible.getValue() < 0)
+    userDie("'", StepToEligible.getFlag(), "' should not be negative.");
+  if (RunToReturn.getValue() && !DontInjectToLibs.getValue() &&
+      !InjectToModules.isSet() && !DontInjectToModules.isSet())
+    userDie("'", RunToReturn.getFlag(), "' requires '",
+            DontInjectToLibs.getFlag(), "', '", InjectToModules.getFlag(),
+            "' or '", DontInjectToModules.getFlag(), "'.");
+
   // Cannot have both -inject-to and -force-inject-to-reg.
   if (InjectTo.isSet() && ForceInjectToReg.isSet())
     userDie("Cannot enable both '", InjectTo.getFlag(), "' and '",
             ForceInjectToReg.getFlag(), "' at the same time.");
 
+  // Resolve -force-inject-to-reg, so that the injections don't need to.
+  if (ForceInjectToReg.isSet() && ForceInjectToReg.getValue() != "help") {
+    ForcedReg = getRegIdForStr(ForceInjectToReg.getValue());
+    if (ForcedReg == NoReg)
+      userDie("Unknown register: ", ForceInjectToReg.getValue(), ".");
+  }
+
   // Check -inject-to
   for (char C : InjectTo.getValue()) {
     switch (C) {
@@ -163,17 +247,14 @@ void OptionsParser::sanityChecks() {
                 ForceInjectToBit.getFlag(), ".");
 
       // If used along with ForceInjectToReg, check if out of bounds.
-      if (ForceInjectToReg.isSet()) {
-#undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS)                               \
-  if (ForceInjectToReg.getValue() == #REG &&                                   \
-      ForceBitNum >= START_BIT + BITS) {                                       \
-    userDie("Error: ", ForceInjectToBit.getFlag(), " bit '", ForceBitNum,      \
-            "' is out of range.\n", "The valid bit-range for ",                \
-            ForceInjectToReg.getValue(), " is ", START_BIT, "-",               \
-            START_BIT + BITS - 1, ".\n");                                      \
-  }
-#include "regs.def"
+      if (ForcedReg != NoReg) {
+        unsigned StartBit = getRegStartBit(ForcedReg);
+        unsigned Bits = getRegBits(ForcedReg);
+        if (ForceBitNum >= StartBit + Bits)
+          userDie("Error: ", ForceInjectToBit.getFlag(), " bit '", ForceBitNum,
+                  "' is out of range.\n", "The valid bit-range for ",
+                  ForceInjectToReg.getValue(), " is ", StartBit, "-",
+                  StartBit + Bits - 1, ".\n");
       }
     }
   }
@@ -183,7 +264,8 @@ void OptionsParser::helpMessages() {
   // Print help message for -force-inject-to-reg help.
   if (ForceInjectToReg.isSet() && ForceInjectToReg.getValue() == "help") {
 #undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS) std::cout << #REG << "\n";
+#define DEF_REG(REG, CS_REG, REG_FIELD, START_BIT, BITS)                       \
+  std::cout << #REG << "\n";
 #include "regs.def"
     userDie("");
   }
@@ -194,7 +276,7 @@ void OptionsParser::helpMessages() {
               << "Bit range\n";
     std::cout << "--------------------\n";
 #undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS)                               \
+#define DEF_REG(REG, CS_REG, REG_FIELD, START_BIT, BITS)                       \
   std::cout << std::setw(10) << std::left << #REG << " " << START_BIT << "-"   \
             << START_BIT + BITS - 1 << "\n";
 #include "regs.def"
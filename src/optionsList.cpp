@@ -74,6 +74,11 @@ Option<const char *>
     DiffShell("-diff-shell", "/bin/bash",
               "Specify a shell for -diff-cmd. The default is /bin/bash.");
 
+Option<bool> ExactOutputCompare(
+    "-exact-output-compare", false,
+    "Compare the outputs whose length and hash match the original ones byte "
+    "by byte, instead of trusting the hash.");
+
 Option<bool> DiffDisableRedirect("-diff-disable-redirect", false,
                                  "Don't redirect the stdout and stderr of the "
                                  "custom -diff-cmd. This is for debugging.");
@@ -92,6 +97,36 @@ Option<bool> NoProgressBar("-no-progress-bar", false,
 Option<bool>
     DontInjectToLibs("-no-inject-to-libs", false,
                      "Inject faults to external dynamically linked code.");
+Option<std::string>
+    InjectToModules("-inject-to-modules", "",
+                    "Inject faults only to the code of these modules. A comma "
+                    "separated list of glob patterns matched against the file "
+                    "name of each mapping, like 'libfoo*.so,[vdso]'.");
+Option<std::string>
+    DontInjectToModules("-no-inject-to-modules", "",
+                        "Do not inject faults to the code of these modules. "
+                        "Same format as -inject-to-modules.");
+Option<std::string> InjectToFunctions(
+    "-inject-to-functions", "",
+    "Inject faults only to the code of these functions. A comma separated "
+    "list of glob patterns matched against the symbols of the binary and of "
+    "the libraries it needs, like 'solve*,mul_matrix'.");
+Option<int> StepToEligible(
+    "-step-to-eligible", 0,
+    "If we cannot inject to the instruction where the workload stopped, "
+    "single-step up to this many instructions to find one that we can inject "
+    "to, before restarting the run.");
+Option<bool> RunToReturn(
+    "-run-to-return", false,
+    "If the workload stops in code that we don't inject to, like a library "
+    "with -no-inject-to-libs, run it to the return address into the code that "
+    "we inject to, instead of restarting the run.");
+Option<std::string> CpuPlacementPolicy(
+    "-cpu-placement", "none",
+    "Pin the jobs to CPUs of their own. 'core' gives each job a physical core, "
+    "with the workload and its tracer on different SMT siblings of it. "
+    "'thread' gives each job a CPU. 'none' leaves the placement to the "
+    "kernel. Note that all the threads of the workload share its one CPU.");
 Option<bool> NoCleanup("-no-cleanup", false, "Do not remove temparary files.");
 Option<int> DetectionExitCode("-detection-exit-code", 0,
                               "If the binary is protected by an error "
@@ -101,6 +136,11 @@ Option<int> DetectionExitCode("-detection-exit-code", 0,
                               "feature.");
 Option<const char *> OutCsvFile("-out-csv", nullptr,
                                 "Output statistics to this CSV file.");
+Option<const char *>
+    OutRunsCsvFile("-out-runs-csv", nullptr,
+                   "Output one line per fault of each test run to this CSV "
+                   "file, with the outcome and the runtime of the run and the "
+                   "time, instruction, register and bit of the fault.");
 Option<const char *>
     OutMoufoplotDir("-out-moufoplot", nullptr,
                     "Output statistics in Moufoplot format using this dir.");
@@ -113,3 +153,77 @@ Option<const char *> SetOrigExitState("-set-orig-exit-state", nullptr,
                                       "SIGNAL>}");
 Option<bool> DisableTimingRun("-disable-timing-run", false,
                               "Skip the original timing run.");
+Option<bool> UseForkServer("-fork-server", false,
+                           "Clone the test runs from a copy of the workload "
+                           "that is stopped at main(), instead of "
+                           "running execve() for each run.");
+Option<unsigned> NumCheckpoints("-checkpoints", 0,
+                                "Take this many checkpoints of the golden run "
+                                "at evenly spaced time points and clone each "
+                                "test run from the latest checkpoint before "
+                                "its injection time. Implies -fork-server.");
+Option<bool> InjectByInstrCount("-inject-by-instr-count", false,
+                                "Pick the injection point as a random "
+                                "user-space instruction count of the main "
+                                "thread, measured with a hardware counter, "
+                                "instead of a random time.");
+Option<unsigned long>
+    BinInstrCount("-bin-instr-count", 0,
+                  "The number of user-space instructions executed by the "
+                  "binary's main thread. If not set, it will be measured with "
+                  "a test run. Used with -inject-by-instr-count.");
+Option<unsigned long>
+    UserInjectionInstr("-injection-instr", 0,
+                       "Fault injection should occur after this many "
+                       "instructions. Used with -inject-by-instr-count.");
+Option<bool> UseSeize("-seize", false,
+                      "Attach to the workload with PTRACE_SEIZE and stop it "
+                      "for the injection with PTRACE_INTERRUPT instead of a "
+                      "SIGTRAP. Signals that the workload handles are "
+                      "delivered to it.");
+Option<bool> VforkSpawn("-vfork-spawn", false,
+                        "Start the workload with clone(CLONE_VM | "
+                        "CLONE_VFORK) instead of forkpty(), which does not "
+                        "copy the page tables of zofi.");
+Option<bool>
+    EarlyCorruptionKill("-early-corruption-kill", false,
+                        "Compare the output of each test run against the "
+                        "original output while it runs, and kill it as "
+                        "Corrupted as soon as they differ.");
+Option<unsigned>
+    ConvergenceInterval("-convergence-interval", 0,
+                        "Record a fingerprint of the state of the golden run "
+                        "every this many system calls. A test run that "
+                        "reaches the state of a fingerprint after the "
+                        "injection is stopped early as Masked. Implies "
+                        "-fork-server.");
+Option<bool>
+    AdaptiveTimeout("-adaptive-timeout", false,
+                    "Set the infinite execution timeout from the measured "
+                    "runtimes of the golden runs and of the Masked test runs, "
+                    "instead of Base + Time * Mul. It is updated as the test "
+                    "runs complete.");
+Option<double> AdaptiveTimeoutPercentile(
+    "-adaptive-timeout-percentile", 99.0,
+    "The percentile of the runtimes that the adaptive timeout is based on.");
+Option<double> AdaptiveTimeoutMargin(
+    "-adaptive-timeout-margin", 0.5,
+    "The adaptive timeout is the percentile of the runtimes times (1 + "
+    "Margin). This is the 'Margin' part.");
+Option<unsigned>
+    AdaptiveTimeoutSamples("-adaptive-timeout-samples", 5,
+                           "The minimum number of golden runs to measure "
+                           "before the test runs, with -adaptive-timeout.");
+Option<bool> NoTty("-no-tty", false,
+                   "Run the workload in a new session with no controlling "
+                   "terminal and with stdin from /dev/null, instead of on a "
+                   "pseudo-terminal.");
+Option<std::string>
+    DecodeIndexDir("-decode-index", "",
+                   "Disassemble the executable sections of -bin ahead of time "
+                   "and keep the index in this directory, named after the "
+                   "build-id of -bin. Later campaigns on the same build reuse "
+                   "it.");
+Option<bool> DecodeIndexLibs("-decode-index-libs", false,
+                             "Also index the libraries that -bin needs "
+                             "(DT_NEEDED), with -decode-index.");
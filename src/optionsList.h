@@ -26,6 +26,7 @@ extern Option<unsigned long> InfExecTimeoutMul;
 extern Option<double> InfExecTimeoutBase;
 extern Option<std::string> DiffCmd;
 extern Option<const char *> DiffShell;
+extern Option<bool> ExactOutputCompare;
 extern Option<bool> DiffDisableRedirect;
 extern Option<bool> HelpOption;
 extern Option<bool> Version;
@@ -35,11 +36,34 @@ extern Option<std::string> Stderr;
 extern Option<int> VerboseLevel;
 extern Option<bool> NoProgressBar;
 extern Option<bool> DontInjectToLibs;
+extern Option<std::string> InjectToModules;
+extern Option<std::string> DontInjectToModules;
+extern Option<std::string> InjectToFunctions;
+extern Option<int> StepToEligible;
+extern Option<bool> RunToReturn;
+extern Option<std::string> CpuPlacementPolicy;
 extern Option<bool> NoCleanup;
 extern Option<int> DetectionExitCode;
 extern Option<const char *> OutCsvFile;
+extern Option<const char *> OutRunsCsvFile;
 extern Option<const char *> OutMoufoplotDir;
 extern Option<const char *> SetOrigExitState;
 extern Option<bool> DisableTimingRun;
+extern Option<bool> UseForkServer;
+extern Option<unsigned> NumCheckpoints;
+extern Option<bool> InjectByInstrCount;
+extern Option<unsigned long> BinInstrCount;
+extern Option<unsigned long> UserInjectionInstr;
+extern Option<bool> UseSeize;
+extern Option<bool> VforkSpawn;
+extern Option<bool> EarlyCorruptionKill;
+extern Option<unsigned> ConvergenceInterval;
+extern Option<bool> AdaptiveTimeout;
+extern Option<double> AdaptiveTimeoutPercentile;
+extern Option<double> AdaptiveTimeoutMargin;
+extern Option<unsigned> AdaptiveTimeoutSamples;
+extern Option<bool> NoTty;
+extern Option<std::string> DecodeIndexDir;
+extern Option<bool> DecodeIndexLibs;
 
 #endif // __OPTIONSLIST_H__
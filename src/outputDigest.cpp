@@ -0,0 +1,69 @@
+// The length and hash of an output, for comparing it against the golden one.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "outputDigest.h"
+#include "utils.h"
+#include <algorithm>
+
+/// The multiplier of the hash, an odd constant with well mixed bits.
+static constexpr const uint64_t Mul = 0x9e3779b97f4a7c15ULL;
+
+/// The number of independent hash lanes. The lanes hide the latency of the
+/// multiplications, so that hashing keeps up with the memory bandwidth.
+static constexpr const size_t NumLanes = 4;
+
+static inline uint64_t mix(uint64_t H, uint64_t Word) {
+  H = (H ^ Word) * Mul;
+  return H ^ (H >> 29);
+}
+
+uint64_t OutputDigest::hash(const char *Buf, size_t Size) {
+  uint64_t Lanes[NumLanes] = {1, 2, 3, 4};
+  constexpr size_t WordSz = sizeof(uint64_t);
+  size_t Off = 0;
+  for (; Off + NumLanes * WordSz <= Size; Off += NumLanes * WordSz)
+    for (size_t L = 0; L != NumLanes; ++L) {
+      uint64_t Word;
+      memcpy(&Word, Buf + Off + L * WordSz, WordSz);
+      Lanes[L] = mix(Lanes[L], Word);
+    }
+  // The tail is zero-padded, which is fine since the lengths are compared too.
+  for (size_t L = 0; Off < Size; Off += WordSz, L = (L + 1) % NumLanes) {
+    uint64_t Word = 0;
+    memcpy(&Word, Buf + Off, std::min(WordSz, Size - Off));
+    Lanes[L] = mix(Lanes[L], Word);
+  }
+  uint64_t H = Size;
+  for (uint64_t Lane : Lanes)
+    H = mix(H, Lane);
+  return H;
+}
+
+OutputDigest::OutputDigest(int Fd) : Size(fileSizeSafe(Fd)) {
+  if (Size == 0)
+    return;
+  const char *Buf = mmapFileSafe(Fd, Size);
+  Hash = hash(Buf, Size);
+  munmapSafe(Buf, Size);
+}
+
+bool OutputDigest::matches(int Fd) const {
+  if (fileSizeSafe(Fd) != Size)
+    return false;
+  return OutputDigest(Fd).Hash == Hash;
+}
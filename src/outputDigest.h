@@ -0,0 +1,53 @@
+//-*- C++ -*-
+// The length and hash of an output, for comparing it against the golden one.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __OUTPUTDIGEST_H__
+#define __OUTPUTDIGEST_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/// The length and the hash of the contents of an output file. The golden
+/// outputs are digested once, so that comparing a test output against them
+/// reads only the test output, and outputs of a different length are not read
+/// at all.
+class OutputDigest {
+  /// The length of the output in bytes.
+  size_t Size = 0;
+
+  /// The hash of the contents of the output.
+  uint64_t Hash = 0;
+
+  /// \Returns the hash of the \p Size bytes at \p Buf.
+  static uint64_t hash(const char *Buf, size_t Size);
+
+public:
+  /// Digest the contents of the file \p Fd.
+  explicit OutputDigest(int Fd);
+  OutputDigest() = default;
+
+  size_t getSize() const { return Size; }
+  uint64_t getHash() const { return Hash; }
+
+  /// \Returns true if the file \p Fd has the same length and hash as the
+  /// digested output. The contents are hashed only if the lengths match.
+  bool matches(int Fd) const;
+};
+
+#endif // __OUTPUTDIGEST_H__
@@ -0,0 +1,81 @@
+// Compare the output of a running test against the golden output.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "outputMonitor.h"
+#include "debugstream.h"
+#include "exitState.h"
+#include "utils.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/// The size of the chunks that we compare at a time.
+static constexpr const size_t ChunkSize = 4096;
+
+OutputMonitor::OutputMonitor(const ExecutionExitState &Test,
+                             const ExecutionExitState &Golden) {
+  InotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (InotifyFd == -1)
+    die("inotify_init1() failed");
+  const char *TestFiles[] = {Test.getStdoutFile(), Test.getStderrFile()};
+  const char *GoldenFiles[] = {Golden.getStdoutFile(), Golden.getStderrFile()};
+  for (int Idx : {0, 1}) {
+    Stream &S = Streams[Idx];
+    S.TestFd = openSafe(TestFiles[Idx], O_RDONLY | O_CLOEXEC);
+    S.GoldenFd = openSafe(GoldenFiles[Idx], O_RDONLY | O_CLOEXEC);
+    if (inotify_add_watch(InotifyFd, TestFiles[Idx], IN_MODIFY) == -1)
+      die("Failed to watch ", TestFiles[Idx]);
+  }
+}
+
+OutputMonitor::~OutputMonitor() {
+  for (Stream &S : Streams) {
+    closeSafe(S.TestFd);
+    closeSafe(S.GoldenFd);
+  }
+  closeSafe(InotifyFd);
+}
+
+bool OutputMonitor::checkStream(Stream &S) {
+  char TestBuff[ChunkSize];
+  char GoldenBuff[ChunkSize];
+  while (true) {
+    ssize_t TestSz = pread(S.TestFd, TestBuff, ChunkSize, S.Offset);
+    if (TestSz <= 0)
+      return true;
+    // The golden file is complete, so it must have at least as much data.
+    ssize_t GoldenSz = pread(S.GoldenFd, GoldenBuff, TestSz, S.Offset);
+    if (GoldenSz != TestSz || memcmp(TestBuff, GoldenBuff, TestSz) != 0) {
+      dbg(2) << "Output diverged after offset " << S.Offset << "\n";
+      return false;
+    }
+    S.Offset += TestSz;
+  }
+}
+
+bool OutputMonitor::check() {
+  // Drain the pending events, we check all files anyway.
+  char Events[ChunkSize];
+  while (read(InotifyFd, Events, sizeof(Events)) > 0)
+    ;
+  for (Stream &S : Streams)
+    if (!checkStream(S))
+      return false;
+  return true;
+}
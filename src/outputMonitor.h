@@ -0,0 +1,64 @@
+//-*- C++ -*-
+// Compare the output of a running test against the golden output.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __OUTPUTMONITOR_H__
+#define __OUTPUTMONITOR_H__
+
+#include <sys/types.h>
+
+class ExecutionExitState;
+
+/// Compares the output files of a running test run against the output of the
+/// original run, as they grow. This catches a corrupted output long before
+/// the workload exits. An inotify descriptor signals when there is new output.
+class OutputMonitor {
+  /// An output file of the test run and the corresponding golden file.
+  struct Stream {
+    /// The test run's output file, opened for reading.
+    int TestFd = -1;
+    /// The golden output file.
+    int GoldenFd = -1;
+    /// The output up to this offset has already been compared.
+    off_t Offset = 0;
+  };
+  Stream Streams[2];
+
+  /// The inotify file descriptor that watches the test run's files.
+  int InotifyFd = -1;
+
+  /// Compare the new data of \p S. \Returns false if it diverged.
+  bool checkStream(Stream &S);
+
+public:
+  /// Monitor the output files of \p Test against those of \p Golden.
+  OutputMonitor(const ExecutionExitState &Test,
+                const ExecutionExitState &Golden);
+  OutputMonitor(const OutputMonitor &) = delete;
+  ~OutputMonitor();
+
+  /// \Returns a file descriptor that becomes readable when there is new
+  /// output to check.
+  int getFd() const { return InotifyFd; }
+
+  /// Compare the output written since the last call. \Returns false if it
+  /// diverged from the golden output.
+  bool check();
+};
+
+#endif //__OUTPUTMONITOR_H__
@@ -17,10 +17,14 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "regManip.h"
+#include "childMemory.h"
 #include "debugstream.h"
+#include "disassembler.h"
 #include "optionsList.h"
 #include "utils.h"
+#include <algorithm>
 #include <capstone/capstone.h>
+#include <cpuid.h>
 #include <cstdio>
 #include <cstring>
 #include <sstream>
@@ -28,8 +32,105 @@
 #error Unsupported target. ZOFI currently supports only x86_64.
 #endif
 
+namespace {
+/// Where the value of a register is kept.
+enum class RegFile : uint8_t { None, GP, Vec };
+
+/// Data attributes for each register.
+struct RegData {
+  const char *Name;
+  /// gpregs, vecregs, or none if ptrace cannot access the register.
+  RegFile File;
+  /// The offset of the register in user_regs_struct or VecRegsState.
+  uint16_t Offset;
+  /// The first bit being touched by the register.
+  uint16_t StartBit;
+  /// The register size in bits.
+  uint16_t Bits;
+};
+
+/// The capstone ID of each register, in the order of RegTable.
+constexpr const unsigned CsRegTable[] = {
+#undef DEF_REG
+#define DEF_REG(REG, CS_REG, REG_FIELD, START_BIT, BITS) X86_REG_##CS_REG,
+#include "regs.def"
+};
+
+/// The map from capstone register IDs to registers.
+struct CsRegMap {
+  RegId Ids[X86_REG_ENDING];
+};
+} // namespace
+
+#define GP_REG(FIELD) RegFile::GP, offsetof(user_regs_struct, FIELD)
+#define VEC_REG(FIELD) RegFile::Vec, offsetof(VecRegsState, FIELD)
+#define NO_REG RegFile::None, 0
+
+/// The registers of regs.def, indexed by RegId.
+static constexpr const RegData RegTable[] = {
+#undef DEF_REG
+#define DEF_REG(REG, CS_REG, REG_FIELD, START_BIT, BITS)                       \
+  {#REG, REG_FIELD, START_BIT, BITS},
+#include "regs.def"
+};
+
+static constexpr const size_t NumRegs = sizeof(RegTable) / sizeof(RegTable[0]);
+static_assert(NumRegs < NoReg, "RegId is too narrow");
+
+static constexpr bool strEquals(const char *A, const char *B) {
+  while (*A != '\0' && *A == *B)
+    ++A, ++B;
+  return *A == *B;
+}
+
+/// \Returns the ID of register \p Name at compile time.
+static constexpr RegId findReg(const char *Name) {
+  for (size_t Id = 0; Id != NumRegs; ++Id)
+    if (strEquals(RegTable[Id].Name, Name))
+      return Id;
+  return NoReg;
+}
+
+static constexpr CsRegMap buildCsRegMap() {
+  CsRegMap Map = {};
+  for (unsigned CsReg = 0; CsReg != X86_REG_ENDING; ++CsReg)
+    Map.Ids[CsReg] = NoReg;
+  for (size_t Id = 0; Id != NumRegs; ++Id)
+    if (CsRegTable[Id] != X86_REG_INVALID)
+      Map.Ids[CsRegTable[Id]] = Id;
+  return Map;
+}
+
+/// The registers indexed by capstone register ID.
+static constexpr const CsRegMap CsRegs = buildCsRegMap();
+
+/// The instruction pointer.
+static constexpr const RegId RipReg = findReg("rip");
+static_assert(RipReg != NoReg, "Missing rip from regs.def");
+
+RegId ForcedReg = NoReg;
+
+RegId getRegIdForStr(const std::string &Name) {
+  return findReg(Name.c_str());
+}
+
+const char *getRegName(RegId Id) {
+  assert(Id < NumRegs && "Bad register");
+  return RegTable[Id].Name;
+}
+
+unsigned getRegStartBit(RegId Id) {
+  assert(Id < NumRegs && "Bad register");
+  return RegTable[Id].StartBit;
+}
+
+unsigned getRegBits(RegId Id) {
+  assert(Id < NumRegs && "Bad register");
+  return RegTable[Id].Bits;
+}
+
 void RegDescr::dump(std::ostream &OS) const {
-  OS << "<Reg: " << Name << " StartBit:" << StartBit << " Bits:" << Bits << " "
+  OS << "<Reg: " << getName() << " StartBit:" << StartBit << " Bits:" << Bits << " "
      << (Written ? "W" : "R") << ">";
 }
 
@@ -44,135 +145,217 @@ void RegDescr::dump() const {
   std::cerr << "\n";
 }
 
+XStateLayout::XStateLayout() {
+  unsigned EAX, EBX, ECX, EDX;
+  // Without XSAVE enabled by the OS, there is only the legacy area.
+  if (!__get_cpuid(1, &EAX, &EBX, &ECX, &EDX) || !(ECX & bit_OSXSAVE)) {
+    Features = (1u << XCompX87) | (1u << XCompSSE);
+    MaxSize = sizeof(XSave);
+    return;
+  }
+  uint32_t Lo, Hi;
+  asm volatile("xgetbv" : "=a"(Lo), "=d"(Hi) : "c"(0));
+  Features = ((uint64_t)Hi << 32) | Lo;
+  __cpuid_count(0xd, 0, EAX, EBX, ECX, EDX);
+  MaxSize = std::max<uint32_t>(ECX, sizeof(XSave));
+  for (unsigned Comp = XCompYMMHi128; Comp != XCompMax; ++Comp) {
+    if (!(Features & (1ull << Comp)))
+      continue;
+    __cpuid_count(0xd, Comp, EAX, EBX, ECX, EDX);
+    Offsets[Comp] = EBX;
+  }
+}
+
+const XStateLayout &XStateLayout::get() {
+  static const XStateLayout Layout;
+  return Layout;
+}
+
+/// The size of each of the components that hold registers.
+static constexpr const uint32_t XCompBytes[XCompMax] = {
+    0, 0, 16 * YMMHiBytes, 0, 0, 8 * OpmaskBytes, 16 * ZMMHiBytes,
+    16 * ZMMBytes};
+
+uint32_t XStateLayout::getOffset(XComponent Comp, uint32_t Size) const {
+  uint32_t Offset = Offsets[Comp];
+  if (Offset == 0 || Offset + XCompBytes[Comp] > Size)
+    return 0;
+  return Offset;
+}
+
 VecRegsState::VecRegsState() {
   memset(&xsave, 0, sizeof(xsave));
   memset(zmm, 0, sizeof(zmm));
+  memset(opmask, 0, sizeof(opmask));
 }
 
-void VecRegsState::importData() {
-  for (uint32_t Reg = 0; Reg != NumZMMRegs; ++Reg)
-    for (uint32_t Byte = 0; Byte != ZMMBytes; ++Byte)
-      zmm[Reg][Byte] = xsave.getZMM(Reg, Byte);
+void VecRegsState::importData(const uint8_t *Buf, uint32_t Size) {
+  const XStateLayout &Layout = XStateLayout::get();
+  memcpy(&xsave, Buf, std::min<uint32_t>(Size, sizeof(xsave)));
+  uint32_t YMMOff = Layout.getOffset(XCompYMMHi128, Size);
+  uint32_t ZMMHiOff = Layout.getOffset(XCompZMMHi256, Size);
+  uint32_t Hi16Off = Layout.getOffset(XCompHi16ZMM, Size);
+  uint32_t OpmaskOff = Layout.getOffset(XCompOpmask, Size);
+  // The components that are not in the buffer read as zeros.
+  memset(zmm, 0, sizeof(zmm));
+  for (uint32_t Reg = 0; Reg != 16; ++Reg) {
+    memcpy(&zmm[Reg][0], xsave.legacy_xmm_0to15[Reg], XMMBytes);
+    if (YMMOff)
+      memcpy(&zmm[Reg][XMMBytes], Buf + YMMOff + Reg * YMMHiBytes, YMMHiBytes);
+    if (ZMMHiOff)
+      memcpy(&zmm[Reg][YMMBytes], Buf + ZMMHiOff + Reg * ZMMHiBytes,
+             ZMMHiBytes);
+  }
+  if (Hi16Off)
+    memcpy(&zmm[16][0], Buf + Hi16Off, 16 * ZMMBytes);
+  if (OpmaskOff)
+    memcpy(opmask, Buf + OpmaskOff, sizeof(opmask));
+  else
+    memset(opmask, 0, sizeof(opmask));
 }
 
-void VecRegsState::exportData() {
-  for (uint32_t Reg = 0; Reg != NumZMMRegs; ++Reg)
-    for (uint32_t Byte = 0; Byte != ZMMBytes; ++Byte)
-      xsave.setZMM(Reg, Byte, zmm[Reg][Byte]);
+void VecRegsState::exportData(uint8_t *Buf, uint32_t Size) const {
+  const XStateLayout &Layout = XStateLayout::get();
+  XSave *Hdr = (XSave *)Buf;
+  uint64_t XStateBV;
+  memcpy(&XStateBV, Hdr->header_xstate_bv, sizeof(XStateBV));
+  // A component whose XSTATE_BV bit is clear is set to its initial state by
+  // the kernel, so set the bits of the components we write.
+  auto Export = [&](XComponent Comp, uint32_t Offset, const void *Src,
+                    size_t Bytes) {
+    memcpy(Buf + Offset, Src, Bytes);
+    XStateBV |= 1ull << Comp;
+  };
+  for (uint32_t Reg = 0; Reg != 16; ++Reg)
+    Export(XCompSSE, offsetof(XSave, legacy_xmm_0to15) + Reg * XMMBytes,
+           &zmm[Reg][0], XMMBytes);
+  // Keep the legacy registers that we may have modified, e.g. st(0). These
+  // are the x87 component, apart from MXCSR which belongs to SSE.
+  Export(XCompX87, 0, &xsave, offsetof(XSave, legacy_xmm_0to15));
+  if (uint32_t YMMOff = Layout.getOffset(XCompYMMHi128, Size))
+    for (uint32_t Reg = 0; Reg != 16; ++Reg)
+      Export(XCompYMMHi128, YMMOff + Reg * YMMHiBytes, &zmm[Reg][XMMBytes],
+             YMMHiBytes);
+  if (uint32_t ZMMHiOff = Layout.getOffset(XCompZMMHi256, Size))
+    for (uint32_t Reg = 0; Reg != 16; ++Reg)
+      Export(XCompZMMHi256, ZMMHiOff + Reg * ZMMHiBytes, &zmm[Reg][YMMBytes],
+             ZMMHiBytes);
+  if (uint32_t Hi16Off = Layout.getOffset(XCompHi16ZMM, Size))
+    Export(XCompHi16ZMM, Hi16Off, &zmm[16][0], 16 * ZMMBytes);
+  if (uint32_t OpmaskOff = Layout.getOffset(XCompOpmask, Size))
+    Export(XCompOpmask, OpmaskOff, opmask, sizeof(opmask));
+  memcpy(Hdr->header_xstate_bv, &XStateBV, sizeof(XStateBV));
 }
 
-void RegisterManipulator::importRegistersTo(user_regs_struct &GpRegs,
-                                            VecRegsState &VecRegs) {
-  ptraceSafe(PTRACE_GETREGS, ChildPid, nullptr, &GpRegs);
+void RegisterManipulator::fetchGpRegs() {
+  if (HasGpRegs)
+    return;
+  ptraceSafe(PTRACE_GETREGS, ChildPid, nullptr, &gpregs);
+  HasGpRegs = true;
+}
 
+void RegisterManipulator::fetchVecRegs() {
+  if (HasVecRegs)
+    return;
   // PTRACE_GETFPREGS is limited to XMM vector regs.
-  // For full access we need to use PTRACE_GETREGSET.
+  // For full access we need to use PTRACE_GETREGSET. The kernel sets iov_len
+  // to the size of its xstate, which is what PTRACE_SETREGSET expects back.
+  const XStateLayout &Layout = XStateLayout::get();
+  if (!XStateBuf)
+    XStateBuf.reset(new uint8_t[Layout.getMaxSize()]);
+  memset(XStateBuf.get(), 0, Layout.getMaxSize());
   struct iovec iov;
-  iov.iov_base = (uint8_t *)&VecRegs.xsave;
-  iov.iov_len = sizeof(VecRegs.xsave);
-  ptrace(PTRACE_GETREGSET, ChildPid, NT_X86_XSTATE, &iov);
-  VecRegs.importData();
+  iov.iov_base = XStateBuf.get();
+  iov.iov_len = Layout.getMaxSize();
+  if (ptrace(PTRACE_GETREGSET, ChildPid, NT_X86_XSTATE, &iov) == -1) {
+    dbg(3) << "ptrace(PTRACE_GETREGSET) failed\n";
+    iov.iov_len = 0;
+  }
+  XStateSize = iov.iov_len;
+  vecregs.importData(XStateBuf.get(), XStateSize);
+  HasVecRegs = true;
 }
 
-bool RegisterManipulator::exportRegisters() const {
-  if (ptrace(PTRACE_SETREGS, ChildPid, nullptr, &gpregs) == -1) {
-    dbg(3) << "ptrace(PTRACE_SETREGS) failed\n";
-    return false;
+void RegisterManipulator::invalidateRegisters() {
+  assert(!GpRegsDirty && !VecRegsDirty && "Dropping modified registers");
+  HasGpRegs = false;
+  HasVecRegs = false;
+}
+
+bool RegisterManipulator::exportRegisters() {
+  if (GpRegsDirty) {
+    if (ptrace(PTRACE_SETREGS, ChildPid, nullptr, &gpregs) == -1) {
+      dbg(3) << "ptrace(PTRACE_SETREGS) failed\n";
+      return false;
+    }
+    GpRegsDirty = false;
   }
 
-  struct iovec iov;
-  iov.iov_base = (uint8_t *)&vecregs.xsave;
-  iov.iov_len = sizeof(vecregs.xsave);
-  if (ptrace(PTRACE_SETREGSET, ChildPid, NT_X86_XSTATE, &iov) == -1) {
-    dbg(3) << "ptrace(PTRACE_SETREGSET) failed\n";
-    return false;
+  if (VecRegsDirty) {
+    if (XStateSize == 0)
+      return false;
+    vecregs.exportData(XStateBuf.get(), XStateSize);
+    struct iovec iov;
+    iov.iov_base = XStateBuf.get();
+    iov.iov_len = XStateSize;
+    if (ptrace(PTRACE_SETREGSET, ChildPid, NT_X86_XSTATE, &iov) == -1) {
+      dbg(3) << "ptrace(PTRACE_SETREGSET) failed\n";
+      return false;
+    }
+    VecRegsDirty = false;
   }
   return true;
 }
 
-int RegisterManipulator::getStartBit(const std::string &R) const {
-  const RegData &Data = getRegDataForStrSafe(R);
-  return Data.getStartBit();
-}
-
-int RegisterManipulator::getBits(const std::string &R) const {
-  const RegData &Data = getRegDataForStrSafe(R);
-  return Data.getBits();
-}
-
-void *RegisterManipulator::getRegisterPtr(const std::string &R, int Bit) {
-  const RegData &Data = getRegDataForStrSafe(R);
-  auto *RegField = Data.getRegPtr();
-  return (void *)((uint8_t *)RegField + Bit / 8);
+uint8_t *RegisterManipulator::getRegisterPtr(RegId Reg, int Bit) {
+  const RegData &Data = RegTable[Reg];
+  switch (Data.File) {
+  case RegFile::GP:
+    fetchGpRegs();
+    return (uint8_t *)&gpregs + Data.Offset + Bit / 8;
+  case RegFile::Vec:
+    fetchVecRegs();
+    return (uint8_t *)&vecregs + Data.Offset + Bit / 8;
+  case RegFile::None:
+    break;
+  }
+  return nullptr;
 }
 
 template <typename T>
-std::pair<T, bool>
-RegisterManipulator::getRegisterContents(const std::string &Reg, int Bit) {
+std::pair<T, bool> RegisterManipulator::getRegisterContents(RegId Reg,
+                                                            int Bit) {
   T *ValPtr = (T *)getRegisterPtr(Reg, Bit);
   if (!ValPtr)
     return {0, false /*Failed*/};
   return {*ValPtr, true /*Success*/};
 }
 
-bool RegisterManipulator::setRegisterContents(const std::string &R, uint8_t Val,
+bool RegisterManipulator::setRegisterContents(RegId Reg, uint8_t Val,
                                               int Bit) {
-  const RegData &Data = getRegDataForStrSafe(R);
-  auto *RegField = Data.getRegPtr();
+  uint8_t *RegField = getRegisterPtr(Reg, Bit);
   if (!RegField)
     return false;
-  *((uint8_t *)RegField + Bit / 8) = Val;
+  *RegField = Val;
+  if (RegTable[Reg].File == RegFile::GP)
+    GpRegsDirty = true;
+  else
+    VecRegsDirty = true;
   return true;
 }
 
-const RegData &
-RegisterManipulator::getRegDataForStrSafe(const std::string &RegStr,
-                                          bool UserError) const {
-  auto it = StrToRegMap.find(RegStr);
-  if (it == StrToRegMap.end()) {
-    if (UserError)
-      userDie("Unknown register: ", RegStr, ".");
-    else
-      die("Unknown register: ", RegStr, ".");
-  }
-  return it->second;
+RegId RegisterManipulator::getRegIdForCsRegSafe(unsigned CsReg) const {
+  RegId Id = CsReg < X86_REG_ENDING ? CsRegs.Ids[CsReg] : NoReg;
+  if (Id == NoReg)
+    die("Unknown register: ", Disassembler::get().getRegName(CsReg), ".");
+  return Id;
 }
 
 RegisterManipulator::RegisterManipulator(int ChildPid) : ChildPid(ChildPid) {
-// 1. Populate StrToRegMap
-#undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS)                               \
-  StrToRegMap[#REG] = RegData((uint8_t *)REG_FIELD, START_BIT, BITS);
-#include "regs.def"
-  // 2. Initialize data
   memset(&gpregs, 0, sizeof(gpregs));
   // vecregs contents get initialized in its constructor.
 }
 
-// Return true if Instr
-static bool isControlInstr(cs_insn &Instr) {
-  cs_detail *InstrDetail = Instr.detail;
-  assert(InstrDetail && "Disasm missing CS_OPT_ON=ON or CS_OP_SKIPDATA=OFF.");
-  bool IsControl = false;
-  for (int Idx = 0, E = InstrDetail->groups_count; Idx != E; ++Idx) {
-    auto Group = InstrDetail->groups[Idx];
-    switch (Group) {
-    case CS_GRP_JUMP:
-    case CS_GRP_CALL:
-    case CS_GRP_RET:
-    case CS_GRP_INT:
-    case CS_GRP_IRET:
-    case CS_GRP_PRIVILEGE:
-    case CS_GRP_BRANCH_RELATIVE:
-      IsControl = true;
-      break;
-    default:
-      break;
-    }
-  }
-  return IsControl;
-}
-
 using RegsVec = RegisterManipulator::RegsVec;
 
 /// Debug function for
@@ -185,44 +368,32 @@ static void DUMP_METHOD dumpRegsVec(const RegsVec &RVec,
 }
 
 std::tuple<RegsVec, RegsVec, RegsVec>
-RegisterManipulator::getInstrRegisters(uint8_t *ChildIP) {
+RegisterManipulator::getInstrRegisters(uint8_t *ChildIP,
+                                       AddressSpace &AS) {
   RegsVec WRegs, RRegs, AllRegs;
 
-// Now we need to access the child's memory to get the current instruction.
-// We use PEEKTEXT to copy data from the child to a temporary buffer.
-#define MAX_INSTR_BYTES 16
-  uint8_t ChildMem[MAX_INSTR_BYTES];
-  for (int i = 0; i != MAX_INSTR_BYTES; ++i)
-    ChildMem[i] = ptraceSafe(PTRACE_PEEKTEXT, ChildPid, ChildIP + i);
-
-  // Now that we have copied the data to ChildMem, let's create a new IP.
-  uint8_t *IP = ChildMem;
-
-  // http://www.capstone-engine.org/lang_c.html
-  csh handle;
-  if (cs_open(CS_ARCH_X86, CS_MODE_64, &handle) != CS_ERR_OK)
-    die("Error: capstone cs_open failed.");
-
-  if (cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK)
-    die("Error: capstone cs_option CS_OPT_DETAIL failed.");
-
-  if (cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_OFF) != CS_ERR_OK)
-    die("Error: capstone cs_option CS_OPT_SKIPDATA failed.");
-
-  cs_insn *Instrs;
-  size_t Cnt = cs_disasm(handle, IP, 8, 0x0, 1, &Instrs);
-  if (Cnt == 0) {
-    dbg(2) << "cs_disasm() return Cnt == 0\n";
-    return std::make_tuple(WRegs, RRegs, AllRegs); // Empty
+  // The index of the file, if any, has the instruction already decoded.
+  Disassembler &Disasm = Disassembler::get();
+  DecodedInstr Instr;
+  std::string Path;
+  unsigned long Offset;
+  if (AS.getFileOffset((unsigned long)ChildIP, Path, Offset) &&
+      Disasm.decodeFromIndex(Path, Offset, Instr)) {
+    dbg(2) << "IP:" << (void *)ChildIP << " found in the index\n";
+  } else {
+    // Now we need to access the child's memory to get the current
+    // instruction. The instruction may end right before an unmapped page, so
+    // the bytes that cannot be read are zeroed.
+    uint8_t ChildMem[Disassembler::CodeBytes] = {};
+    if (ChildMemory(ChildPid).read((unsigned long)ChildIP, ChildMem,
+                                   sizeof(ChildMem)) == 0) {
+      dbg(2) << "Cannot read the code at IP:" << (void *)ChildIP << "\n";
+      return std::make_tuple(WRegs, RRegs, AllRegs); // Empty
+    }
+    if (!Disasm.decode(ChildMem, Instr))
+      return std::make_tuple(WRegs, RRegs, AllRegs); // Empty
+    dbg(2) << "IP:" << (void *)ChildIP << "\n";
   }
-  cs_insn &Instr = Instrs[0];
-
-  assert(Cnt == 1 && "Disassembled too many instructions!");
-  dbg(2) << "IP:" << (void *)ChildIP << ", Addr:" << (void *)Instr.address
-         << ", Mnemonic:" << Instr.mnemonic << ", Operands:" << Instr.op_str
-         << "\n";
-
-  cs_detail *InstrDetail = Instr.detail;
 
   // We now have to collect the registers accessed by the instruction, based on
   // the -inject-to arguments. We collect them into vectors RRegs, WRegs,
@@ -232,12 +403,9 @@ RegisterManipulator::getInstrRegisters(uint8_t *ChildIP) {
   // the AllRegs vector, once as a 'R' and once as a 'W' register.
 
   // 1. Collect the instruction pointer.
-  if ((isIn(InjectTo, "c") && isControlInstr(Instr)) ||
-      (isIn(InjectTo, "o") && !isControlInstr(Instr))) {
-    const char *IPStr = "rip";
-    const RegData &RData = getRegDataForStrSafe(IPStr);
-    RegDescr RDescr(IPStr, RData.getStartBit(), RData.getBits(),
-                    false /*Written*/);
+  if ((isIn(InjectTo, "c") && Instr.IsControl) ||
+      (isIn(InjectTo, "o") && !Instr.IsControl)) {
+    RegDescr RDescr(RipReg, false /*Written*/);
     WRegs.push_back(RDescr);
     RRegs.push_back(RDescr);
     AllRegs.push_back(RDescr);
@@ -245,67 +413,35 @@ RegisterManipulator::getInstrRegisters(uint8_t *ChildIP) {
 
   // 2. Collect implicitly accessed registers, if enabled.
   if (isIn(InjectTo, "i")) {
-    for (int Idx = 0, E = InstrDetail->regs_read_count; Idx != E; ++Idx) {
-      auto RegId = InstrDetail->regs_read[Idx];
-      std::string RegStr(cs_reg_name(handle, RegId));
-      const RegData &RData = getRegDataForStrSafe(RegStr);
-      RegDescr RDescr(RegStr, RData.getStartBit(), RData.getBits(),
+    for (int Idx = 0, E = Instr.NumImplRead; Idx != E; ++Idx) {
+      RegDescr RDescr(getRegIdForCsRegSafe(Instr.ImplRead[Idx]),
                       false /*Read*/);
       RRegs.push_back(RDescr);
     }
-    for (int Idx = 0, E = InstrDetail->regs_write_count; Idx != E; ++Idx) {
-      auto RegId = InstrDetail->regs_write[Idx];
-      std::string RegStr(cs_reg_name(handle, RegId));
-      const RegData &RData = getRegDataForStrSafe(RegStr);
-      RegDescr RDescr(RegStr, RData.getStartBit(), RData.getBits(),
+    for (int Idx = 0, E = Instr.NumImplWrite; Idx != E; ++Idx) {
+      RegDescr RDescr(getRegIdForCsRegSafe(Instr.ImplWrite[Idx]),
                       true /*Written*/);
       WRegs.push_back(RDescr);
     }
   }
 
-  // 3. Explicitly accessed registers.
+  // 3. Explicitly accessed registers, either register operands or registers
+  // of memory operands.
   if (isIn(InjectTo, "e")) {
-    const cs_x86 &X86Data = InstrDetail->x86;
-    for (int Idx = 0, E = X86Data.op_count; Idx != E; ++Idx) {
-      const cs_x86_op &Operand = X86Data.operands[Idx];
-      switch (Operand.type) {
-      case X86_OP_REG: {
-        std::string RegStr(cs_reg_name(handle, Operand.reg));
-        int StartBit = getStartBit(RegStr);
-        RegDescr RDescr(RegStr, StartBit, getBits(RegStr));
-        if (Operand.access & CS_AC_WRITE) {
-          RDescr.Written = true;
-          WRegs.push_back(RDescr);
-        } else if (Operand.access & CS_AC_READ) {
-          RDescr.Written = false;
-          RRegs.push_back(RDescr);
-        }
-        AllRegs.push_back(RDescr);
-        break;
-      }
-      case X86_OP_MEM: {
-        for (const x86_reg &Reg :
-             {Operand.mem.segment, Operand.mem.base, Operand.mem.index}) {
-          if (Reg == X86_REG_INVALID)
-            continue;
-          std::string RegStr(cs_reg_name(handle, Reg));
-          int StartBit = getStartBit(RegStr);
-          RegDescr RDescr(RegStr, StartBit, getBits(RegStr),
-                          false /* Written */);
-          RRegs.push_back(RDescr);
-          AllRegs.push_back(RDescr);
-        }
-        break;
-      }
-      default:
-        break;
+    for (int Idx = 0, E = Instr.NumExpl; Idx != E; ++Idx) {
+      const DecodedInstr::ExplReg &Expl = Instr.Expl[Idx];
+      RegDescr RDescr(getRegIdForCsRegSafe(Expl.Reg));
+      if (Expl.Access & CS_AC_WRITE) {
+        RDescr.Written = true;
+        WRegs.push_back(RDescr);
+      } else if (Expl.Access & CS_AC_READ) {
+        RDescr.Written = false;
+        RRegs.push_back(RDescr);
       }
+      AllRegs.push_back(RDescr);
     }
   }
 
-  cs_free(Instrs, Cnt);
-  cs_close(&handle);
-
   // Dump the registers we have collected.
   dumpRegsVec(WRegs, "WRegs");
   dumpRegsVec(RRegs, "RRegs");
@@ -315,18 +451,18 @@ RegisterManipulator::getInstrRegisters(uint8_t *ChildIP) {
 }
 
 std::tuple<RegDescr, unsigned, bool>
-RegisterManipulator::getSelectedRegAndBit(uint8_t *IP) {
+RegisterManipulator::getSelectedRegAndBit(uint8_t *IP,
+                                          AddressSpace &AS) {
   // 1. Get the registers accessed by the current instruction.
   RegsVec WRegs, RRegs, AllRegs;
-  std::tie(WRegs, RRegs, AllRegs) = getInstrRegisters(IP);
+  std::tie(WRegs, RRegs, AllRegs) = getInstrRegisters(IP, AS);
 
   // 2. Pick a register. If forced, selecte the forced one, otherwise select a
   // random one written by the instruction.
   RegsVec RegsVec;
   if (ForceInjectToReg.isSet()) {
-    const std::string &ForcedReg = ForceInjectToReg.getValue();
-    const RegData &RData = getRegDataForStrSafe(ForcedReg, /*UserError=*/true);
-    RegsVec = {RegDescr(ForcedReg, RData.getStartBit(), RData.getBits())};
+    assert(ForcedReg != NoReg && "Not resolved by the options parser?");
+    RegsVec = {RegDescr(ForcedReg)};
   } else {
     assert((isIn(InjectTo, "r") || isIn(InjectTo, "w")) &&
            "At least one of 'r', 'w' should be enabled");
@@ -362,21 +498,18 @@ RegisterManipulator::getSelectedRegAndBit(uint8_t *IP) {
 
 uint8_t *RegisterManipulator::getProgramCounter() {
   // We get the Child's Instruction Pointer by looking at its rip register.
-  importRegistersTo(gpregs, vecregs);
   uint8_t *ChildIP;
   bool Success;
-  std::tie(ChildIP, Success) = getRegisterContents<uint8_t *>("rip");
+  std::tie(ChildIP, Success) = getRegisterContents<uint8_t *>(RipReg);
   if (!Success)
     die("Could not read 'rip' register.");
   return ChildIP;
 }
 
-bool RegisterManipulator::tryBitFlip(const std::string &Reg, unsigned Bit) {
+bool RegisterManipulator::tryBitFlip(RegId Reg, unsigned Bit) {
   // We need to convert something like xmm2, bit 46 to xmm_space[5] bit 14
   //                                or zmm2, bit 46 to xmm_space[17] bit 14
-  assert(StrToRegMap.count(Reg) && "Missing register from map");
-
-  importRegistersTo(gpregs, vecregs);
+  assert(Reg < NumRegs && "Bad register");
 
   if (VerboseLevel >= 10) {
     dbg(10) << "=== Before bitflip ===\n";
@@ -394,10 +527,10 @@ bool RegisterManipulator::tryBitFlip(const std::string &Reg, unsigned Bit) {
   bool Legal = setRegisterContents(Reg, NewByte, Bit);
   if (!Legal)
     return false;
-  dbg(2) << "Flip reg: " << Reg << ", bit: " << Bit << ", (=" << BitInByte
-         << " in Byte). Byte before: 0x" << std::setfill('0') << std::setw(2)
+  dbg(2) << "Flip reg: " << getRegName(Reg) << ", bit: " << Bit << ", (="
+         << BitInByte << " in Byte). Byte before: 0x" << std::setfill('0') << std::setw(2)
          << std::hex << (uint32_t)OldByte << ", after: 0x" << std::setfill('0')
-         << std::setw(2) << std::hex << (uint32_t)NewByte << "\n";
+         << std::setw(2) << std::hex << (uint32_t)NewByte << std::dec << "\n";
   // Writing to illegal registers can fail.
   bool ExportSuccess = exportRegisters();
   if (VerboseLevel >= 10) {
@@ -409,36 +542,33 @@ bool RegisterManipulator::tryBitFlip(const std::string &Reg, unsigned Bit) {
 
 
 void RegisterManipulator::dumpMachine() {
-  // Read registers into gpregs2 and vecregs2, so that we do not destroy the
-  // state of the class.
-  user_regs_struct gpregs2;
-  VecRegsState vecregs2;
-  memset(&gpregs2, 0, sizeof(gpregs2));
-  importRegistersTo(gpregs2, vecregs2);
-
-#undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS)                               \
-  if (REG_FIELD)                                                               \
-    fprintf(stderr, "%12s: 0x%016lx\n", #REG, *(unsigned long *)REG_FIELD);    \
-  else                                                                         \
-    fprintf(stderr, "%12s: Unsupported\n", #REG);
-#include "regs.def"
+  // Read the registers into a new manipulator, so that we do not destroy the
+  // state of this one.
+  RegisterManipulator Machine(ChildPid);
+  for (RegId Reg = 0; Reg != NumRegs; ++Reg) {
+    const RegData &Data = RegTable[Reg];
+    uint8_t *Ptr = Machine.getRegisterPtr(Reg);
+    if (Ptr)
+      fprintf(stderr, "%12s: 0x%016lx\n", Data.Name, *(unsigned long *)Ptr);
+    else
+      fprintf(stderr, "%12s: Unsupported\n", Data.Name);
+  }
 }
 
 void RegisterManipulator::dump() {
-#undef DEF_REG
-#define DEF_REG(REG, REG_FIELD, START_BIT, BITS)                               \
-  fprintf(stderr, "%12s: ", #REG);                                             \
-  if (REG_FIELD) {                                                             \
-    fprintf(stderr, "0x");                                                     \
-    for (int Byte = BITS / 8 - 1; Byte >= START_BIT / 8; --Byte) {             \
-      fprintf(stderr, "%02x", ((uint8_t *)REG_FIELD)[Byte]);                   \
-      if (Byte % 8 == 0)                                                       \
-        fprintf(stderr, " ");                                                  \
-    }                                                                          \
-  } else {                                                                     \
-    fprintf(stderr, "Unsupported");                                            \
-  }                                                                            \
-  fprintf(stderr, "\n");
-#include "regs.def"
+  for (RegId Reg = 0; Reg != NumRegs; ++Reg) {
+    const RegData &Data = RegTable[Reg];
+    fprintf(stderr, "%12s: ", Data.Name);
+    if (uint8_t *Ptr = getRegisterPtr(Reg)) {
+      fprintf(stderr, "0x");
+      for (int Byte = Data.Bits / 8 - 1; Byte >= Data.StartBit / 8; --Byte) {
+        fprintf(stderr, "%02x", Ptr[Byte]);
+        if (Byte % 8 == 0)
+          fprintf(stderr, " ");
+      }
+    } else {
+      fprintf(stderr, "Unsupported");
+    }
+    fprintf(stderr, "\n");
+  }
 }
@@ -20,55 +20,49 @@
 #ifndef __REGMANIP_H__
 #define __REGMANIP_H__
 
-#include <map>
 #include <vector>
 #include <string>
 #include <sys/user.h>
 #include <sys/ptrace.h>
 #include <csignal>
 #include <cassert>
+#include <memory>
 #include <tuple>
+#include "addrSpace.h"
 #include "utils.h"
 
-/// Data attributes for each register.
-class RegData {
-  /// Register in gpregs/vectoreg data structure
-  uint8_t *RegPtr = nullptr;
-  /// The first bit being touched by the register.
-  int StartBit = -1;
-  /// The register size in bits.
-  int Bits = -1;
+/// The ID of a register, which is its index in regs.def.
+using RegId = uint16_t;
 
-public:
-  RegData() = default;
-  RegData(uint8_t *RegPtr, int StartBit, int Bits)
-      : RegPtr(RegPtr), StartBit(StartBit), Bits(Bits) {}
-  uint8_t *getRegPtr() const {
-    assert(RegPtr && "Uninitialized?");
-    return RegPtr;
-  }
-  int getStartBit() const {
-    assert(StartBit >= 0 && "Uninitialized?");
-    return StartBit;
-  }
-  int getBits() const {
-    assert(Bits > 0 && "Uninitialized?");
-    return Bits;
-  }
-};
+/// Not a register.
+static constexpr const RegId NoReg = UINT16_MAX;
+
+/// The register of -force-inject-to-reg, resolved when the options are parsed.
+extern RegId ForcedReg;
+
+/// \Returns the ID of register \p Name, or NoReg if there is no such register.
+RegId getRegIdForStr(const std::string &Name);
+
+/// \Returns the name of register \p Id.
+const char *getRegName(RegId Id);
+
+/// \Returns the first accessible bit of register \p Id. This is usually zero,
+/// except for some registers like x86 ah where this is 8.
+unsigned getRegStartBit(RegId Id);
+
+/// \Returns the size of register \p Id in bits.
+unsigned getRegBits(RegId Id);
 
 /// Describes a register.
 struct RegDescr {
   RegDescr() = default;
-  RegDescr(const std::string &Name, unsigned StartBit, unsigned Bits)
-      : Name(Name), StartBit(StartBit), Bits(Bits) {}
-  RegDescr(const std::string &Name, unsigned StartBit, unsigned Bits,
-           bool Written)
-      : Name(Name), StartBit(StartBit), Bits(Bits), Written(Written) {}
-  /// The name of the register, e.g. "rax", "eax" etc.
-  std::string Name;
-
-  /// The first bit in the register that is accessible. For example, this is 4
+  RegDescr(RegId Id, bool Written = false)
+      : Id(Id), StartBit(getRegStartBit(Id)), Bits(getRegBits(Id)),
+        Written(Written) {}
+  /// The register, e.g. rax, eax etc.
+  RegId Id = NoReg;
+
+  /// The first bit in the register that is accessible. For example, this is 8
   /// for the x86 register ah and 0 for most registers, including al.
   unsigned StartBit = 0;
 
@@ -78,6 +72,9 @@ struct RegDescr {
   /// True if this register is written, false if it is read.
   bool Written = false;
 
+  /// \Returns the name of the register.
+  const char *getName() const { return getRegName(Id); }
+
   /// Debug print to \p OS.
   void dump(std::ostream &OS) const;
 
@@ -129,6 +126,10 @@ struct RegDescr {
 // |               ZMM31 full 512                  |        |         |
 // +-----------------------------------------------+-----   -      =======
 
+// The diagram shows the components back to back. In the standard format that
+// ptrace uses, the components after the XSAVE header are at CPU-specific
+// offsets, which XStateLayout gets from CPUID leaf 0xD.
+
 static constexpr const uint32_t XMMBytes = 16;   // Full: 0-128bits
 static constexpr const uint32_t YMMHiBytes = 16; // Hi: 128-256bits
 static constexpr const uint32_t YMMBytes = 32;   // Full: 0-256bits
@@ -138,7 +139,49 @@ static constexpr const uint32_t ZMMBytes = 64;   // Full: 0-512bits
 
 static constexpr const uint32_t MMBytes = 16;    // Full: 0-80bits (+ padding)
 
-/// Holds the buffer returned by PTRACE_GETREGSET NT_X86_STATE.
+/// The XSAVE state components that hold registers we inject to.
+enum XComponent : unsigned {
+  XCompX87 = 0,
+  XCompSSE = 1,
+  XCompYMMHi128 = 2,
+  XCompOpmask = 5,
+  XCompZMMHi256 = 6,
+  XCompHi16ZMM = 7,
+  XCompMax,
+};
+
+/// The layout of the buffer of PTRACE_GETREGSET NT_X86_XSTATE on this CPU.
+class XStateLayout {
+  /// The state components enabled in XCR0.
+  uint64_t Features = 0;
+
+  /// The size of the buffer for all the components supported by the CPU. The
+  /// kernel never reports more than this.
+  uint32_t MaxSize = 0;
+
+  /// The offset of each component, or 0 if it is not enabled.
+  uint32_t Offsets[XCompMax] = {};
+
+  XStateLayout();
+
+public:
+  /// \Returns the layout of this CPU.
+  static const XStateLayout &get();
+
+  /// \Returns the maximum size of the buffer.
+  uint32_t getMaxSize() const { return MaxSize; }
+
+  /// \Returns the state components enabled in XCR0.
+  uint64_t getFeatures() const { return Features; }
+
+  /// \Returns the offset of component \p Comp in a buffer of \p Size bytes, or
+  /// 0 if it is not in it.
+  uint32_t getOffset(XComponent Comp, uint32_t Size) const;
+};
+
+/// The legacy area and the header of the buffer returned by PTRACE_GETREGSET
+/// NT_X86_XSTATE. Unlike the rest of the components, these are at fixed
+/// offsets.
 struct XSave {
   uint8_t legacy_fsave_fcw[2];
   uint8_t legacy_fsave_fsw[2];
@@ -155,44 +198,16 @@ struct XSave {
   uint8_t header_xstate_bv[8];
   uint8_t header_xcomp_bv[8];
   uint8_t header_reserved[48];
-  uint8_t ymm_hi128_0to15[16][YMMHiBytes];
-  uint8_t opmask_0to7[8][OpmaskBytes];
-  uint8_t zmm_hi256_0to15[16][ZMMHiBytes];
-  uint8_t zmm_full_16to31[16][ZMMBytes];
-
-  uint8_t &getZMMInternal(unsigned Reg, unsigned Byte) {
-    if (Reg <= 15) {
-      if (Byte <= XMMBytes)
-        return legacy_xmm_0to15[Reg][Byte];
-      else if (Byte <= YMMBytes)
-        return ymm_hi128_0to15[Reg][Byte - YMMHiBytes];
-      else if (Byte <= ZMMBytes)
-        return zmm_hi256_0to15[Reg][Byte - ZMMHiBytes];
-      else
-        die("Byte out of bounds");
-    } else if (Reg <= 31) {
-      return zmm_full_16to31[Reg][Byte];
-    } else {
-      die("Register out of bounds");
-    }
-  }
-
-public:
-  const uint8_t &getZMM(uint32_t Reg, uint32_t Byte) const {
-    return const_cast<XSave *>(this)->getZMMInternal(Reg, Byte);
-  }
-  void setZMM(uint32_t Reg, uint32_t Byte, uint8_t Val) {
-    getZMMInternal(Reg, Byte) = Val;
-  }
 };
 
-/// The vector register values in XSave are not contiguous in memory. This makes
-/// it harder to inject a bit-flip at a random bit when dealing with vector
-/// registers XMM to ZMM. We therefore use this wrapper class that serializes
-/// the data into the `zmm` array. It provides import/export functions to
-/// read/write data back to the raw xsave buffer.
+/// The vector register values in the xstate buffer are not contiguous in
+/// memory, and most of them are at CPU-specific offsets. This makes it harder
+/// to inject a bit-flip at a random bit when dealing with vector registers XMM
+/// to ZMM. We therefore use this wrapper class that serializes the data into
+/// the `zmm` and `opmask` arrays. It provides import/export functions to
+/// read/write data back to the raw xstate buffer.
 struct VecRegsState {
-  /// The raw data buffer handled by ptrace.
+  /// The legacy area and the header of the raw buffer.
   XSave xsave;
 
   //    64 byte                0 byte
@@ -211,11 +226,16 @@ struct VecRegsState {
   static constexpr const uint32_t NumZMMRegs = 32;
   uint8_t zmm[NumZMMRegs][ZMMBytes];    // =2048 bytes
 
+  /// AVX-512 opmask registers k0-k7.
+  static constexpr const uint32_t NumOpmaskRegs = 8;
+  uint8_t opmask[NumOpmaskRegs][OpmaskBytes];
+
   VecRegsState();
-  /// Copy the raw data from buf into xsave.
-  void importData();
-  /// Export data to xsave.
-  void exportData();
+  /// Copy the raw data from the \p Size bytes of \p Buf.
+  void importData(const uint8_t *Buf, uint32_t Size);
+  /// Export the data to the \p Size bytes of \p Buf, which hold the raw data
+  /// that was imported.
+  void exportData(uint8_t *Buf, uint32_t Size) const;
 };
 
 class RegisterManipulator {
@@ -223,9 +243,6 @@ public:
   using RegsVec = std::vector<RegDescr>;
 
 private:
-  /// Convert register strings to regs
-  std::map<std::string, RegData> StrToRegMap;
-
   /// The PID of the child process
   int ChildPid;
 
@@ -235,54 +252,71 @@ private:
   /// Vector Registers.
   VecRegsState vecregs;
 
-  /// Read all registers into \p GpRegs and \p VecRegs.
-  void importRegistersTo(user_regs_struct &GpRegs, VecRegsState &VecRegs);
+  /// The raw buffer of PTRACE_GETREGSET NT_X86_XSTATE, allocated when the
+  /// vector registers are first needed.
+  std::unique_ptr<uint8_t[]> XStateBuf;
 
-  /// Write all the register values of gpregs and vecregs into the machine.
-  /// This can fail if we modify an illegal register and will \return false.
-  bool exportRegisters() const;
+  /// The size of the xstate reported by the kernel.
+  uint32_t XStateSize = 0;
 
-  /// \Returns the first accessible bit of register \p R. This is usually zero,
-  /// except for some registers like x86 ah where this is 4.
-  int getStartBit(const std::string &R) const;
+  /// The registers are read from the child only when they are first needed,
+  /// and written back only if they are modified.
+  bool HasGpRegs = false;
+  bool HasVecRegs = false;
+  bool GpRegsDirty = false;
+  bool VecRegsDirty = false;
 
-  /// \Returns the size of register \p R in bits.
-  int getBits(const std::string &R) const;
+  /// Read the general purpose registers into gpregs, if not already read.
+  void fetchGpRegs();
 
-  /// Return the register that corresponds to REGSTR
-  const RegData &getRegDataForStrSafe(const std::string &RegStr,
-                                      bool UserError = false) const;
+  /// Read the vector registers into vecregs, if not already read.
+  void fetchVecRegs();
 
-  /// \Returns the registers and their size in bits accessed by the instruction
-  /// at \p IP.
-  std::tuple<RegsVec, RegsVec, RegsVec> getInstrRegisters(uint8_t *ChildIP);
+  /// Write the modified register classes back into the machine. This can fail
+  /// if we modify an illegal register and will \return false.
+  bool exportRegisters();
 
-  /// \Returns the pointer to the value of \p Reg around \p Bit. 
+  /// \Returns the register of capstone register \p CsReg, or dies if it is not
+  /// in regs.def.
+  RegId getRegIdForCsRegSafe(unsigned CsReg) const;
+
+  /// \Returns the registers and their size in bits accessed by the instruction
+  /// at \p IP. The instruction is looked up in the index of the file mapped at
+  /// \p IP in \p AS if there is one, or it is read from the child's memory.
+  std::tuple<RegsVec, RegsVec, RegsVec>
+  getInstrRegisters(uint8_t *ChildIP, AddressSpace &AS);
+
+  /// \Returns the pointer to the value of \p Reg around \p Bit, or nullptr if
+  /// the register is not accessible. This reads the class of \p Reg from the
+  /// child if needed.
   /// Note: this only updates the internal gpregs and vecregs. You need to
   /// exportRegisters() to update the processor's state.
-  void *getRegisterPtr(const std::string &Reg, int Bit = 0);
+  uint8_t *getRegisterPtr(RegId Reg, int Bit = 0);
 
   /// \Returns the contents of \p Reg and true on success.
   template <typename T>
-  std::pair<T, bool> getRegisterContents(const std::string &Reg, int Bit = 0);
+  std::pair<T, bool> getRegisterContents(RegId Reg, int Bit = 0);
 
   /// Set \p Reg to \p Val around \p Bit. This sets a single byte. \Returns
   /// false if the register is not accessible.
   /// Note: this only updates the internal gpregs and vecregs. You need to
   /// exportRegisters() to update the processor's state.
-  bool setRegisterContents(const std::string &Reg, uint8_t Val, int Bit = 0);
+  bool setRegisterContents(RegId Reg, uint8_t Val, int Bit = 0);
 
 public:
-  /// Constructor. Initialize strToRegMap.
   RegisterManipulator(int ChildPid);
 
+  /// Forget the registers read so far, because the child has run since.
+  void invalidateRegisters();
+
   /// Flip the \p Bit of \p Reg. \Returns true on success.
-  bool tryBitFlip(const std::string &Reg, unsigned Bit);
+  bool tryBitFlip(RegId Reg, unsigned Bit);
 
   /// \Returns the register (either a random from the accessed one, or a forced
   /// user-specified register) and bit where the fault will be injected to.
-  /// Returns false on failure.
-  std::tuple<RegDescr, unsigned, bool> getSelectedRegAndBit(uint8_t *IP);
+  /// Returns false on failure. \p AS is the address space of the child.
+  std::tuple<RegDescr, unsigned, bool>
+  getSelectedRegAndBit(uint8_t *IP, AddressSpace &AS);
 
   /// Returns the program counter.
   uint8_t *getProgramCounter();
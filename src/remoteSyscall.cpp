@@ -0,0 +1,176 @@
+// Execute system calls inside a ptrace-stopped process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "remoteSyscall.h"
+#include "childMemory.h"
+#include "debugstream.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/syscall.h>
+#if ! defined (__x86_64__)
+#error Unsupported target. ZOFI currently supports only x86_64.
+#endif
+
+/// The x86_64 encoding of `syscall; int3`.
+static constexpr const uint8_t SyscallCode[] = {0x0f, 0x05, 0xcc};
+
+/// The size of the x86_64 red zone that we must not clobber.
+static constexpr const unsigned long RedZoneBytes = 128;
+
+/// The kernel's internal restart codes, returned by interrupted system calls.
+enum : long {
+  ERestartSys = 512,
+  ERestartNoIntr = 513,
+  ERestartNoHand = 514,
+  ERestartRestartBlock = 516,
+};
+
+/// The tracee may have been stopped in a system call that got interrupted.
+/// The kernel restarts it when the tracee resumes, but a new child that
+/// starts from a copy of \p Regs won't go through the restart logic. So
+/// rewind the IP to the `syscall` instruction, like the kernel would do.
+static void restartInterruptedSyscall(user_regs_struct &Regs) {
+  if ((long)Regs.orig_rax < 0)
+    return;
+  const unsigned long SyscallInstrBytes = 2;
+  switch (-(long)Regs.rax) {
+  case ERestartSys:
+  case ERestartNoIntr:
+  case ERestartNoHand:
+    Regs.rax = Regs.orig_rax;
+    Regs.rip -= SyscallInstrBytes;
+    break;
+  case ERestartRestartBlock:
+    Regs.rax = SYS_restart_syscall;
+    Regs.rip -= SyscallInstrBytes;
+    break;
+  }
+}
+
+void pokeChildMemory(pid_t Pid, unsigned long Addr, const void *Data,
+                     size_t Size) {
+  const uint8_t *Bytes = (const uint8_t *)Data;
+  const size_t WordSz = sizeof(unsigned long);
+  for (size_t Off = 0; Off < Size; Off += WordSz) {
+    unsigned long Word;
+    size_t Left = Size - Off;
+    // Keep the bytes that follow the data in the last partial word.
+    if (Left < WordSz)
+      Word = ChildMemory(Pid).readWordSafe(Addr + Off);
+    memcpy(&Word, Bytes + Off, std::min(Left, WordSz));
+    ptraceSafe(PTRACE_POKEDATA, Pid, (void *)(Addr + Off), (void *)Word);
+  }
+}
+
+RemoteSyscall::RemoteSyscall(pid_t Pid) : Pid(Pid) {
+  ptraceSafe(PTRACE_GETREGS, Pid, nullptr, &SavedRegs);
+  CodeAddr = SavedRegs.rip;
+  SavedWord = ChildMemory(Pid).readWordSafe(CodeAddr);
+  unsigned long PatchedWord = SavedWord;
+  memcpy(&PatchedWord, SyscallCode, sizeof(SyscallCode));
+  ptraceSafe(PTRACE_POKETEXT, Pid, (void *)CodeAddr, (void *)PatchedWord);
+  ScratchTop = (SavedRegs.rsp - RedZoneBytes) & ~15ul;
+}
+
+RemoteSyscall::~RemoteSyscall() {
+  ptraceSafe(PTRACE_POKETEXT, Pid, (void *)CodeAddr, (void *)SavedWord);
+  ptraceSafe(PTRACE_SETREGS, Pid, nullptr, &SavedRegs);
+}
+
+user_regs_struct RemoteSyscall::runPatched(user_regs_struct &Regs,
+                                           pid_t *NewChild) {
+  Regs.rip = CodeAddr;
+  // Don't let the kernel restart an interrupted system call on our behalf.
+  Regs.orig_rax = -1;
+  ptraceSafe(PTRACE_SETREGS, Pid, nullptr, &Regs);
+  ptraceSafe(PTRACE_CONT, Pid, 0, 0);
+  while (true) {
+    int Status = waitpidSafe(Pid).Status;
+    if (!WIFSTOPPED(Status))
+      die("Tracee ", Pid, " terminated while running a system call.");
+    int Event = Status >> 16;
+    if (Event == PTRACE_EVENT_FORK || Event == PTRACE_EVENT_VFORK ||
+        Event == PTRACE_EVENT_CLONE) {
+      unsigned long Child = 0;
+      ptraceSafe(PTRACE_GETEVENTMSG, Pid, nullptr, &Child);
+      dbg(2) << "Tracee " << Pid << " forked " << Child << "\n";
+      if (NewChild)
+        *NewChild = (pid_t)Child;
+    } else if (Event == 0 && WSTOPSIG(Status) == SIGTRAP) {
+      break;
+    } else {
+      // Nobody expects a signal while we are in control, so drop it.
+      dbg(2) << "Dropping stop " << std::hex << Status << std::dec
+             << " of tracee " << Pid << "\n";
+    }
+    ptraceSafe(PTRACE_CONT, Pid, 0, 0);
+  }
+  user_regs_struct After;
+  ptraceSafe(PTRACE_GETREGS, Pid, nullptr, &After);
+  if (After.rip != CodeAddr + sizeof(SyscallCode))
+    die("Tracee ", Pid, " trapped at unexpected address ", (void *)After.rip);
+  return After;
+}
+
+long RemoteSyscall::call(long Nr, long A1, long A2, long A3, long A4, long A5,
+                         long A6) {
+  user_regs_struct Regs = SavedRegs;
+  Regs.rax = Nr;
+  Regs.rdi = A1;
+  Regs.rsi = A2;
+  Regs.rdx = A3;
+  Regs.r10 = A4;
+  Regs.r8 = A5;
+  Regs.r9 = A6;
+  long Ret = (long)runPatched(Regs).rax;
+  dbg(2) << "Tracee " << Pid << " syscall " << Nr << " returned " << Ret
+         << "\n";
+  return Ret;
+}
+
+unsigned long RemoteSyscall::pushData(const void *Data, size_t Size) {
+  ScratchTop = (ScratchTop - Size) & ~15ul;
+  pokeChildMemory(Pid, ScratchTop, Data, Size);
+  return ScratchTop;
+}
+
+pid_t RemoteSyscall::fork(unsigned long Flags) {
+  user_regs_struct Regs = SavedRegs;
+  Regs.rax = SYS_clone;
+  Regs.rdi = Flags;
+  Regs.rsi = Regs.rdx = Regs.r10 = Regs.r8 = 0;
+  pid_t Child = 0;
+  long Ret = (long)runPatched(Regs, &Child).rax;
+  if (Ret < 0 || Child == 0) {
+    dbg(2) << "Remote clone() failed with " << Ret << "\n";
+    return 0;
+  }
+  // The child starts in a ptrace-stop because of PTRACE_O_TRACEFORK.
+  int Status;
+  if (waitpid(Child, &Status, __WALL) != Child || !WIFSTOPPED(Status))
+    die("Expected clone ", Child, " to start stopped.");
+  // The child is a copy of the tracee in the middle of our system call. Undo
+  // our changes, so it looks exactly like the tracee did before.
+  ptraceSafe(PTRACE_POKETEXT, Child, (void *)CodeAddr, (void *)SavedWord);
+  user_regs_struct ChildRegs = SavedRegs;
+  restartInterruptedSyscall(ChildRegs);
+  ptraceSafe(PTRACE_SETREGS, Child, nullptr, &ChildRegs);
+  return Child;
+}
@@ -0,0 +1,83 @@
+//-*- C++ -*-
+// Execute system calls inside a ptrace-stopped process.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __REMOTESYSCALL_H__
+#define __REMOTESYSCALL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/user.h>
+
+/// Runs system calls on behalf of a ptrace-stopped tracee. The code at the
+/// tracee's IP is temporarily replaced by `syscall; int3` and the tracee is
+/// continued until it traps. The original code and registers are restored
+/// when this object is destroyed, so the tracee can resume as if nothing
+/// happened.
+class RemoteSyscall {
+  /// The tracee that executes the system calls.
+  pid_t Pid = 0;
+
+  /// The tracee's registers before we touched them.
+  user_regs_struct SavedRegs;
+
+  /// The original code word at the tracee's IP.
+  unsigned long SavedWord = 0;
+
+  /// The address of the patched code.
+  unsigned long CodeAddr = 0;
+
+  /// Scratch memory in the tracee's stack grows downwards from here.
+  unsigned long ScratchTop = 0;
+
+  /// Run the `syscall; int3` code with registers \p Regs. \Returns the
+  /// registers after the trap. If the call forks, the new PID is returned in
+  /// \p NewChild.
+  user_regs_struct runPatched(user_regs_struct &Regs,
+                              pid_t *NewChild = nullptr);
+
+public:
+  /// Prepare tracee \p Pid for running system calls. It must be stopped.
+  RemoteSyscall(pid_t Pid);
+
+  /// Restore the tracee's code and registers.
+  ~RemoteSyscall();
+
+  /// Execute system call \p Nr with arguments \p A1 - \p A6 in the tracee.
+  /// \Returns the raw return value (negative errno on failure).
+  long call(long Nr, long A1 = 0, long A2 = 0, long A3 = 0, long A4 = 0,
+            long A5 = 0, long A6 = 0);
+
+  /// Copy \p Size bytes of \p Data into scratch memory in the tracee's stack,
+  /// below the red zone. \Returns the address in the tracee.
+  unsigned long pushData(const void *Data, size_t Size);
+
+  /// Call clone() in the tracee with \p Flags, creating a copy-on-write copy
+  /// of it. The tracee must be traced with PTRACE_O_TRACEFORK. The copy is
+  /// restored to the original state of the tracee and left ptrace-stopped.
+  /// \Returns the PID of the copy, or 0 on failure.
+  pid_t fork(unsigned long Flags);
+};
+
+/// Write \p Size bytes from \p Data into the memory of tracee \p Pid at
+/// \p Addr using PTRACE_POKEDATA.
+void pokeChildMemory(pid_t Pid, unsigned long Addr, const void *Data,
+                     size_t Size);
+
+#endif //__REMOTESYSCALL_H__
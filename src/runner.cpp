@@ -17,26 +17,64 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "runner.h"
+#include "breakpoint.h"
+#include "checkpoint.h"
+#include "childMemory.h"
+#include "convergence.h"
+#include "cpuPlacement.h"
 #include "debugstream.h"
+#include "forkServer.h"
+#include "funcScope.h"
 #include "optionsList.h"
+#include "outputMonitor.h"
 #include "regManip.h"
+#include "remoteSyscall.h"
+#include "terminal.h"
 #include "utils.h"
 #include <algorithm>
 #include <capstone/capstone.h>
+#include <cerrno>
 #include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <poll.h>
+#include <sched.h>
+#include <sstream>
 #include <sys/ptrace.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
-#include <thread>
+#include <utmp.h>
 
 extern char **Envp; // zofi.cpp
 
-RunnerBase::RunnerBase(long Id, bool DoCleanup) : Id(Id), DoCleanup(DoCleanup) {
+RunnerBase::RunnerBase(long Id, bool DoCleanup, ForkServer *Server,
+                       const ExecutionExitState *Output)
+    : Id(Id), DoCleanup(DoCleanup), Server(Server) {
+  initExecArgs(Argv, Argp);
+
+  // Check if the arguments make sense, otherwise exit.
+  sanityChecksOrExit();
+
+  // Create the unique stdout/stderr files, unless we were given some.
+  if (Output != nullptr) {
+    ExState.shareFiles(*Output);
+    SharedFiles = true;
+  } else {
+    ExState.initFiles(Id);
+  }
+}
+
+void RunnerBase::initExecArgs(std::vector<const char *> &Argv,
+                              std::vector<const char *> &Argp) {
   // argv[0]
   Argv.push_back(Binary.getValue());
   // argv[1...last]
@@ -50,24 +88,38 @@ RunnerBase::RunnerBase(long Id, bool DoCleanup) : Id(Id), DoCleanup(DoCleanup) {
   for (char **EnvVar = Envp; *EnvVar; ++EnvVar)
     Argp.push_back(*EnvVar);
   Argp.push_back(NULL);
+}
 
-  // Check if the arguments make sense, otherwise exit.
-  sanityChecksOrExit();
+double RunnerBase::getInfExecTimeout() const {
+  // The adaptive timeout, if set by the job scheduler.
+  if (InfExecTimeout > 0.0)
+    return InfExecTimeout;
+  assert(BinExecTime.isSet() && "Should have been set by now");
+  // The timeout is "Base + BinTime * Mul".
+  // The base is required for binaries that run very fast, about a few
+  // milliseconds. Since the timing measurements in this timescale are
+  // small, we may easily go over the infinite loop limit and consider this an
+  // infinite execution.
+  return InfExecTimeoutBase.getValue() +
+         BinExecTime.getValue() * InfExecTimeoutMul.getValue();
+}
 
-  // Create the unique stdout/stderr files.
-  ExState.initFiles(Id);
+void RunnerBase::recordRunTime() {
+  RunTime = getMonoTimeDiff(ChildStartTime, getMonoTime());
+  if (Ckpt != nullptr)
+    RunTime += Ckpt->Time;
 }
 
 RunnerBase::~RunnerBase() {
-  // Close the files.
-  for (int Fd : {ExState.getStdoutFd(), ExState.getStderrFd()})
-    if (Fd >= 0)
-      closeSafe(Fd);
-
   closeOpenTerminal();
+  if (SharedFiles)
+    return;
+
+  // Close the files.
+  ExState.closeFiles();
 
-  // Forced to skip temporary file removal.
-  if (NoCleanup.getValue() || !DoCleanup)
+  // Forced to skip temporary file removal. The memfds are gone once closed.
+  if (NoCleanup.getValue() || !DoCleanup || ExState.isInMemory())
     return;
 
   // Remove temporary files.
@@ -117,20 +169,47 @@ bool RunnerBase::run(bool TimeoutAlarm) {
 
   // Reset the active thread PIDs.
   ChildThreads.clear();
+  Seized = UseSeize.getValue();
+  InterruptedTid = 0;
+  TraceSyscalls = false;
+  NumGetrandomCalls = 0;
+  RunTime = -1.0;
 
   dbg(2) << "ParentPID " << ParentPID << "\n";
 
-  if (!NoRedirect.getValue()) {
+  if (Server != nullptr)
+    return runClone(TimeoutAlarm);
+
+  // The files may have been written by an earlier run, and the child shares
+  // their file offset with us.
+  if (!NoRedirect.getValue())
+    ExState.truncateFiles();
+  if (Term != nullptr && !NoRedirect.getValue())
+    Term->reset();
+
+  if (VforkSpawn.getValue()) {
+    // This returns after the child has called execve(), so the code below
+    // only runs in the parent.
+    ChildPID = spawnVfork(TimeoutAlarm);
+  } else if (!NoRedirect.getValue() && !NoTty.getValue() && Term == nullptr) {
     // We are connecting the child child process to a new pty because some
     // faults from glibc are still printed on the parent's terminal even after
     // stdout and stderr redirection.
     std::tie(ChildPID, ChildTerminalFd) = forkptySafe();
   } else {
-    // Don't create a new terminal if we are not redirecting the output.
+    // Don't create a new terminal if we are not redirecting the output, or if
+    // we reuse one.
     ChildPID = forkSafe();
   }
 
   if (ChildPID == 0) {
+    if (!NoRedirect.getValue()) {
+      if (Term != nullptr && !Term->attach())
+        die("Failed to attach to the terminal");
+      if (NoTty.getValue() && !detachTerminal())
+        die("Failed to detach from the terminal");
+    }
+
     // Duplicate File Descriptors
     int OldStdout = -1, OldStderr = -1;
     if (!NoRedirect.getValue()) {
@@ -139,29 +218,20 @@ bool RunnerBase::run(bool TimeoutAlarm) {
     }
 
     // Infinite execution timeout.
-    if (TimeoutAlarm) {
-      assert(BinExecTime.isSet() && "Should have been set by now");
-      // The timeout is "Base + BinTime * Mul".
-      // The base is required for binaries that run very fast, about a few
-      // milliseconds. Since the timing measurements in this timescale are
-      // small,
-      // we may easily go over the infinite loop limit and consider this an
-      // infinite execution.
-      double InfExecTimeout =
-          InfExecTimeoutBase.getValue() +
-          BinExecTime.getValue() * InfExecTimeoutMul.getValue();
-      alarmSafe(InfExecTimeout);
-    }
+    if (TimeoutAlarm)
+      alarmSafe(getInfExecTimeout());
 
     // Redirect stdout and stderr to files
     if (!NoRedirect.getValue()) {
-      ftruncate(ExState.getStdoutFd(), 0);
-      ftruncate(ExState.getStderrFd(), 0);
       dup2(ExState.getStdoutFd(), 1);
       dup2(ExState.getStderrFd(), 2);
     }
-    // Prepare self for being traced by parent.
-    ptraceSafe(PTRACE_TRACEME, 0, 0, 0);
+    // Prepare self for being traced by parent. With PTRACE_SEIZE we stop
+    // and wait for the parent to attach.
+    if (Seized)
+      raise(SIGSTOP);
+    else
+      ptraceSafe(PTRACE_TRACEME, 0, 0, 0);
 
     // Run given command
     execve(Binary.getValue(), (char *const *)Argv.data(),
@@ -176,15 +246,24 @@ bool RunnerBase::run(bool TimeoutAlarm) {
   } else if (ChildPID > 0) {
     // Parent process
     dbg(2) << "ChildPID " << ChildPID << "\n";
+    // The child inherited the CPUs of the tracer, not those of the workload.
+    CpuPlacement::get().pinTracee(ChildPID);
 
-    // Wait for the child to stop at execve, since it is being traced.
-    waitpidSafe(ChildPID);
+    if (Seized) {
+      if (!seizeChild())
+        return false;
+    } else {
+      // Wait for the child to stop at execve, since it is being traced.
+      waitpidSafe(ChildPID);
 
-    // Let the child continue after execve.
-    // This can fail if the child finishes immediately.
-    if (ptrace(PTRACE_SETOPTIONS, ChildPID, 0, PTRACE_O_TRACECLONE) == -1)
-      return false;
+      // Let the child continue after execve.
+      // This can fail if the child finishes immediately.
+      if (ptrace(PTRACE_SETOPTIONS, ChildPID, 0, PTRACE_O_TRACECLONE) == -1)
+        return false;
+    }
 
+    startInstrCounter();
+    ChildStartTime = getMonoTime();
     ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
     return true;
   } else {
@@ -194,50 +273,477 @@ bool RunnerBase::run(bool TimeoutAlarm) {
   return true;
 }
 
+/// The stack size of the child created by spawnVfork().
+static constexpr const size_t VforkStackSize = 64 * 1024;
+
+/// The arguments of the child created by spawnVfork().
+struct VforkArgs {
+  const char *Binary;
+  char *const *Argv;
+  char *const *Argp;
+  /// The pty slave that becomes the controlling terminal, or -1.
+  int TerminalFd;
+  /// Start a new session without a terminal, for -no-tty.
+  bool Detach;
+  /// The files that stdout and stderr get redirected to, or -1.
+  int StdoutFd, StderrFd;
+  /// Arm the infinite execution timer.
+  bool TimeoutAlarm;
+  struct itimerval Timer;
+  /// Set by the child if it fails before execve().
+  int Errno;
+};
+
+/// Sets the errno of \p Args and exits the child of spawnVfork().
+static int vforkChildFail(VforkArgs *Args) {
+  Args->Errno = errno;
+  _exit(127);
+}
+
+/// The entry point of the child created by spawnVfork(). The child shares the
+/// parent's memory until execve(), so it only makes system calls and writes
+/// nothing but \p Arg.
+static int vforkChildMain(void *Arg) {
+  VforkArgs *Args = (VforkArgs *)Arg;
+  if (Args->TerminalFd != -1 && login_tty(Args->TerminalFd) != 0)
+    return vforkChildFail(Args);
+  if (Args->Detach && !detachTerminal())
+    return vforkChildFail(Args);
+  if (Args->TimeoutAlarm &&
+      setitimer(ITIMER_REAL, &Args->Timer, nullptr) != 0)
+    return vforkChildFail(Args);
+  if (Args->StdoutFd != -1) {
+    if (dup2(Args->StdoutFd, 1) == -1 || dup2(Args->StderrFd, 2) == -1)
+      return vforkChildFail(Args);
+  }
+  if (ptrace(PTRACE_TRACEME, 0, 0, 0) != 0)
+    return vforkChildFail(Args);
+  execve(Args->Binary, Args->Argv, Args->Argp);
+  return vforkChildFail(Args);
+}
+
+pid_t RunnerBase::spawnVfork(bool TimeoutAlarm) {
+  VforkArgs Args = {};
+  Args.Binary = Binary.getValue();
+  Args.Argv = (char *const *)Argv.data();
+  Args.Argp = (char *const *)Argp.data();
+  Args.TerminalFd = Args.StdoutFd = Args.StderrFd = -1;
+  int MasterFd = -1;
+  if (!NoRedirect.getValue()) {
+    if (Term != nullptr) {
+      Args.TerminalFd = Term->getSlaveFd();
+    } else if (!NoTty.getValue()) {
+      if (openpty(&MasterFd, &Args.TerminalFd, nullptr, nullptr, nullptr) != 0)
+        die("Error: openpty() failed.");
+      // The workload should not inherit the master side.
+      fcntl(MasterFd, F_SETFD, FD_CLOEXEC);
+    }
+    Args.Detach = NoTty.getValue();
+    Args.StdoutFd = ExState.getStdoutFd();
+    Args.StderrFd = ExState.getStderrFd();
+  }
+  Args.TimeoutAlarm = TimeoutAlarm;
+  if (TimeoutAlarm)
+    Args.Timer = getITimerVal(getInfExecTimeout());
+
+  // The child only needs a small stack until it calls execve(). We are
+  // suspended until then, so it can live in our stack frame.
+  std::vector<char> Stack(VforkStackSize);
+  pid_t PID = clone(vforkChildMain, Stack.data() + Stack.size(),
+                    CLONE_VM | CLONE_VFORK | SIGCHLD, &Args);
+  if (PID == -1) {
+    perror("clone()");
+    die("Error: clone() failed.");
+  }
+  // The slave of a reused terminal stays open for the next run.
+  if (Args.TerminalFd != -1 && Term == nullptr)
+    closeSafe(Args.TerminalFd);
+  if (Args.Errno != 0) {
+    cleanupWaitpidState(PID);
+    die("Error: Failed to spawn ", Binary.getValue(), ": ",
+        strerror(Args.Errno));
+  }
+  ChildTerminalFd = MasterFd;
+  return PID;
+}
+
+bool RunnerBase::runClone(bool TimeoutAlarm) {
+  ChildPID = Server->clone();
+  if (ChildPID == 0)
+    return false;
+  dbg(2) << "ChildPID " << ChildPID << " (clone)\n";
+  setupClone(TimeoutAlarm);
+  // The clone inherited the server's options, but we need to follow threads.
+  ptraceSafe(PTRACE_SETOPTIONS, ChildPID, 0, (void *)getCloneTraceOptions());
+  startInstrCounter();
+  ChildStartTime = getMonoTime();
+  ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+  return true;
+}
+
+bool RunnerBase::seizeChild() {
+  // The child stops itself before execve(), so that we can attach to it.
+  int Status;
+  if (waitpid(ChildPID, &Status, WUNTRACED) != ChildPID || !WIFSTOPPED(Status))
+    return false;
+  ptraceSafe(PTRACE_SEIZE, ChildPID, 0,
+             (void *)(PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL));
+  // Wake it up from its group-stop, otherwise the group-stop would persist and
+  // PTRACE_INTERRUPT would report a SIGSTOP instead of a SIGTRAP.
+  killSafe(ChildPID, SIGCONT);
+  // Skip the stops on the way to execve().
+  while (true) {
+    Status = waitpidSafe(ChildPID).Status;
+    if (!WIFSTOPPED(Status))
+      return false;
+    if (Status >> 16 == PTRACE_EVENT_EXEC)
+      break;
+    ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+  }
+  // This can fail if the child finishes immediately.
+  return ptrace(PTRACE_SETOPTIONS, ChildPID, 0,
+                (void *)(PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)) != -1;
+}
+
+bool RunnerBase::stopChildThread(pid_t Tid) {
+  dbg(2) << "About to stop " << Tid << (Seized ? " with PTRACE_INTERRUPT\n"
+                                               : " with a SIGTRAP\n");
+  // This can fail if the target thread has finished.
+  if (Seized) {
+    InterruptedTid = Tid;
+    return ptrace(PTRACE_INTERRUPT, Tid, 0, 0) == 0;
+  }
+  return syscall(SYS_tgkill, ChildPID, Tid, SIGTRAP) == 0;
+}
+
+/// \Returns true if \p Sig stops the process by default.
+static bool isStopSignal(int Sig) {
+  return Sig == SIGSTOP || Sig == SIGTSTP || Sig == SIGTTIN || Sig == SIGTTOU;
+}
+
+/// \Returns the signal mask of field \p Field (e.g., "SigCgt") in
+/// /proc/<Pid>/status.
+static uint64_t getProcSignalMask(pid_t Pid, const std::string &Field) {
+  std::string ProcFile("/proc/" + std::to_string(Pid) + "/status");
+  std::fstream FS(ProcFile, std::fstream::in);
+  std::string Line;
+  while (std::getline(FS, Line))
+    if (Line.compare(0, Field.size() + 1, Field + ":") == 0)
+      return strtoull(Line.c_str() + Field.size() + 1, nullptr, 16);
+  return 0;
+}
+
+bool RunnerBase::isExpectedSignal(int Status) const {
+  if (!Seized || !WIFSTOPPED(Status) || Status >> 16 != 0)
+    return false;
+  int Sig = WSTOPSIG(Status);
+  // SIGTRAP is used for single-stepping and by the instruction counter, and
+  // SIGALRM is the infinite execution timeout.
+  if (Sig == SIGTRAP || Sig == SIGALRM)
+    return false;
+  // These are ignored by default, so they are harmless.
+  if (Sig == SIGCHLD || Sig == SIGCONT || Sig == SIGURG || Sig == SIGWINCH)
+    return true;
+  // Signal dispositions are shared by all threads.
+  uint64_t Bit = 1ull << (Sig - 1);
+  return (getProcSignalMask(ChildPID, "SigCgt") & Bit) ||
+         (getProcSignalMask(ChildPID, "SigIgn") & Bit);
+}
+
+long RunnerBase::getCloneTraceOptions() {
+  long Options =
+      PTRACE_O_TRACECLONE | PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL;
+  // The server traps getrandom() when we check for convergence.
+  if (ConvergenceInterval.getValue() > 0)
+    Options |= PTRACE_O_TRACESECCOMP;
+  return Options;
+}
+
+void RunnerBase::resumeThread(pid_t Tid, int Sig) {
+  ptraceSafe(TraceSyscalls && Tid == ChildPID ? PTRACE_SYSCALL : PTRACE_CONT,
+             Tid, 0, (void *)(long)Sig);
+}
+
+void RunnerBase::startInstrCounter() {
+  if (InjectByInstrCount.getValue())
+    Counter = std::make_unique<InstrCounter>(ChildPID, StopAtInstr);
+}
+
+void RunnerBase::copyCheckpointPrefix() {
+  assert(Ckpt != nullptr && "Expected a checkpoint");
+  for (int Fd : {ExState.getStdoutFd(), ExState.getStderrFd()}) {
+    bool IsStdout = Fd == ExState.getStdoutFd();
+    const char *GoldenFile = IsStdout ? Ckpt->Golden->getStdoutFile()
+                                      : Ckpt->Golden->getStderrFile();
+    off_t Size = IsStdout ? Ckpt->StdoutSize : Ckpt->StderrSize;
+    ftruncate(Fd, 0);
+    lseek(Fd, 0, SEEK_SET);
+    int GoldenFd = openSafe(GoldenFile, O_RDONLY);
+    off_t Offset = 0;
+    while (Offset < Size)
+      if (sendfile(Fd, GoldenFd, &Offset, Size - Offset) <= 0)
+        die("Failed to copy the checkpoint output from ", GoldenFile);
+    closeSafe(GoldenFd);
+  }
+}
+
+void RunnerBase::setupClone(bool TimeoutAlarm) {
+  // Runs cloned from a checkpoint continue the golden output.
+  if (Ckpt != nullptr && !NoRedirect.getValue())
+    copyCheckpointPrefix();
+  // The clone shares the server's file descriptors, so redirect its stdout
+  // and stderr from within.
+  RemoteSyscall RS(ChildPID);
+  if (!NoRedirect.getValue()) {
+    int Flags = Ckpt != nullptr ? O_WRONLY : O_WRONLY | O_TRUNC;
+    for (int Fd : {1, 2}) {
+      const char *File =
+          Fd == 1 ? ExState.getStdoutFile() : ExState.getStderrFile();
+      unsigned long FileAddr = RS.pushData(File, strlen(File) + 1);
+      long NewFd = RS.call(SYS_openat, AT_FDCWD, FileAddr, Flags);
+      if (NewFd < 0)
+        die("Failed to open ", File, " in clone ", ChildPID);
+      if (Ckpt != nullptr)
+        RS.call(SYS_lseek, NewFd, 0, SEEK_END);
+      if (RS.call(SYS_dup2, NewFd, Fd) != Fd)
+        die("Failed to redirect fd ", Fd, " in clone ", ChildPID);
+      RS.call(SYS_close, NewFd);
+    }
+  }
+  // Timers are not inherited by clone(), so arm the infinite execution
+  // timeout in the clone itself.
+  if (TimeoutAlarm) {
+    struct itimerval Timer = getITimerVal(getInfExecTimeout());
+    unsigned long TimerAddr = RS.pushData(&Timer, sizeof(Timer));
+    if (RS.call(SYS_setitimer, ITIMER_REAL, TimerAddr, 0) != 0)
+      die("Failed to set the timer in clone ", ChildPID);
+  }
+}
+
+bool RunnerBase::skipStaleBreakpoint(int Status, pid_t Tid) {
+  if (!WIFSTOPPED(Status) || WSTOPSIG(Status) != SIGTRAP || Status >> 16 != 0)
+    return false;
+  // The int3 traps are reported with SI_KERNEL, unlike single-steps and the
+  // overflows of the instruction counter.
+  siginfo_t Info;
+  if (ptrace(PTRACE_GETSIGINFO, Tid, 0, &Info) != 0 ||
+      Info.si_code != SI_KERNEL)
+    return false;
+  user_regs_struct Regs;
+  ptraceSafe(PTRACE_GETREGS, Tid, nullptr, &Regs);
+  if (std::find(StaleBreakpoints.begin(), StaleBreakpoints.end(),
+                Regs.rip - 1) == StaleBreakpoints.end())
+    return false;
+  dbg(2) << "Thread " << Tid << " trapped on a removed breakpoint\n";
+  Regs.rip -= 1;
+  ptraceSafe(PTRACE_SETREGS, Tid, nullptr, &Regs);
+  resumeThread(Tid);
+  return true;
+}
+
+bool RunnerBase::handleThreadStateChange(int Status, pid_t PidWaited) {
+  if (!StaleBreakpoints.empty() && skipStaleBreakpoint(Status, PidWaited))
+    return true;
+  // The clones of the server stop at getrandom(), see trapGetrandom().
+  if (WIFSTOPPED(Status) && Status >> 16 == PTRACE_EVENT_SECCOMP) {
+    emulateGetrandom(PidWaited, NumGetrandomCalls++);
+    resumeThread(PidWaited);
+    return true;
+  }
+  // The stop that we requested with PTRACE_INTERRUPT.
+  bool IsOurInterrupt = PidWaited == InterruptedTid && WIFSTOPPED(Status) &&
+                        Status >> 16 == PTRACE_EVENT_STOP &&
+                        WSTOPSIG(Status) == SIGTRAP;
+  if (Seized && !IsOurInterrupt) {
+    // Deliver the signals that the workload expects.
+    if (isExpectedSignal(Status)) {
+      dbg(2) << "Delivering signal " << WSTOPSIG(Status) << " to " << PidWaited
+             << "\n";
+      resumeThread(PidWaited, WSTOPSIG(Status));
+      return true;
+    }
+    // Nobody would ever resume a workload in group-stop, so suppress the stop
+    // signals and resume the threads that got into a group-stop anyway.
+    if (WIFSTOPPED(Status) && isStopSignal(WSTOPSIG(Status)) &&
+        (Status >> 16 == 0 || Status >> 16 == PTRACE_EVENT_STOP)) {
+      dbg(2) << "Suppressing stop " << WSTOPSIG(Status) << " of " << PidWaited
+             << "\n";
+      resumeThread(PidWaited);
+      return true;
+    }
+  }
+  // Check if we are being stopped by changes in thread status.
+  if (WIFSTOPPED(Status) &&
+      Status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+    pid_t ChildThread;
+    ptraceSafe(PTRACE_GETEVENTMSG, PidWaited, 0, &ChildThread);
+    dbg(2) << "New Child Thread " << ChildThread << " PID Waited " << PidWaited
+           << "\n";
+    // Update the active threads set.
+    ChildThreads.insert(ChildThread);
+    CpuPlacement::get().noteWorkloadThread();
+    dumpChildThreads();
+
+    ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
+    return true;
+  }
+  // This is the stopped child. We need to let it continue.
+  if (ChildThreads.count(PidWaited)) {
+    // Threads of cloned children start with a PTRACE_EVENT_STOP instead.
+    if (WIFSTOPPED(Status) && !IsOurInterrupt &&
+        (WSTOPSIG(Status) == SIGSTOP || Status >> 16 == PTRACE_EVENT_STOP)) {
+      dbg(2) << "ChildThread " << PidWaited << " STOPPED, let it continue\n";
+      ptraceSafe(PTRACE_CONT, PidWaited, 0, 0);
+      return true;
+    }
+    // Remove thread from active set.
+    if (WIFEXITED(Status)) {
+      dbg(2) << "Child Thread " << PidWaited << " Exited\n";
+      ChildThreads.erase(PidWaited);
+      return true;
+    }
+    if (WIFSIGNALED(Status)) {
+      dbg(2) << "Child Thread " << PidWaited << " Signaled\n";
+      ChildThreads.erase(PidWaited);
+      return true;
+    }
+  }
+  return false;
+}
+
 WaitPidData RunnerBase::waitpidSkipThreadState() {
-  bool ThreadStateChanged = false;
-  int Status = 0;
-  pid_t PidWaited = 0;
+  WaitPidData Data;
   do {
-    const auto &StatusPid = waitpidSafe(-1);
-    Status = StatusPid.Status;
-    PidWaited = StatusPid.Pid;
-    dbg(2) << "After waitpid, PidWaited " << PidWaited << "\n";
-    ThreadStateChanged = false;
-    // Check if we are being stopped by changes in thread status.
-    if (WIFSTOPPED(Status) &&
-        Status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
-      pid_t ChildThread;
-      ptraceSafe(PTRACE_GETEVENTMSG, PidWaited, 0, &ChildThread);
-      dbg(2) << "New Child Thread " << ChildThread << " PID Waited "
-             << PidWaited << "\n";
-      // Update the active threads set.
-      ChildThreads.insert(ChildThread);
-      dumpChildThreads();
-      ThreadStateChanged = true;
-
-      ptraceSafe(PTRACE_CONT, ChildPID, 0, 0);
-    }
-    // This is the stopped child. We need to let it continue.
-    else if (ChildThreads.count(PidWaited)) {
-      if (WIFSTOPPED(Status) && WSTOPSIG(Status) == SIGSTOP) {
-        dbg(2) << "ChildThread " << PidWaited << " STOPPED, let it continue\n";
-        ptraceSafe(PTRACE_CONT, PidWaited, 0, 0);
-        ThreadStateChanged = true;
-      }
-      // Remove thread from active set.
-      else if (WIFEXITED(Status)) {
-        dbg(2) << "Child Thread " << PidWaited << " Exited\n";
-        ChildThreads.erase(PidWaited);
-        ThreadStateChanged = true;
-      } else if (WIFSIGNALED(Status)) {
-        dbg(2) << "Child Thread " << PidWaited << " Signaled\n";
-        ChildThreads.erase(PidWaited);
-        ThreadStateChanged = true;
-      }
+    Data = waitpidSafe(-1);
+    dbg(2) << "After waitpid, PidWaited " << Data.Pid << "\n";
+  } while (handleThreadStateChange(Data.Status, Data.Pid));
+  return Data;
+}
+
+/// Blocks SIGCHLD and makes it available as a file descriptor, along with a
+/// timer that expires at a given deadline. We can then wait for both without
+/// spawning a thread. The signal mask is restored on destruction, so that the
+/// children that we spawn later don't inherit it.
+class DeadlineWaiter {
+  sigset_t OldMask;
+  int SigFd = -1;
+  int TimerFd = -1;
+  /// An optional extra file descriptor to wait for, or -1.
+  int ExtraFd = -1;
+
+public:
+  /// The reason why wait() returned.
+  enum class Event { Deadline, Child, Fd };
+
+  /// Wait until \p Deadline, or forever if it is MonoTimePoint::max(). If
+  /// \p ExtraFd is not -1, also wait for it to become readable.
+  DeadlineWaiter(MonoTimePoint Deadline, int ExtraFd = -1) : ExtraFd(ExtraFd) {
+    sigset_t ChldMask;
+    sigemptyset(&ChldMask);
+    sigaddset(&ChldMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &ChldMask, &OldMask);
+    SigFd = signalfd(-1, &ChldMask, SFD_CLOEXEC | SFD_NONBLOCK);
+    TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (SigFd == -1 || TimerFd == -1)
+      die("Failed to create the signalfd/timerfd.");
+    if (Deadline == MonoTimePoint::max())
+      return;
+    struct itimerspec Timer = {};
+    Timer.it_value = toTimespec(Deadline);
+    // A deadline in the past expires immediately.
+    if (Timer.it_value.tv_sec == 0 && Timer.it_value.tv_nsec == 0)
+      Timer.it_value.tv_nsec = 1;
+    if (timerfd_settime(TimerFd, TFD_TIMER_ABSTIME, &Timer, nullptr) != 0)
+      die("Failed to set the timerfd.");
+  }
+  ~DeadlineWaiter() {
+    closeSafe(TimerFd);
+    closeSafe(SigFd);
+    sigprocmask(SIG_SETMASK, &OldMask, nullptr);
+  }
+  /// Block until the deadline, a SIGCHLD, or until the extra file descriptor
+  /// is readable. \Returns the event that woke us up.
+  Event wait() {
+    // poll() ignores negative file descriptors.
+    struct pollfd Fds[3] = {
+        {TimerFd, POLLIN, 0}, {SigFd, POLLIN, 0}, {ExtraFd, POLLIN, 0}};
+    while (poll(Fds, 3, -1) == -1)
+      if (errno != EINTR)
+        die("poll() failed");
+    if (Fds[0].revents & POLLIN)
+      return Event::Deadline;
+    if (!(Fds[1].revents & POLLIN))
+      return Event::Fd;
+    // Drain the pending SIGCHLDs. They are merged anyway.
+    struct signalfd_siginfo Info;
+    while (read(SigFd, &Info, sizeof(Info)) == sizeof(Info))
+      ;
+    return Event::Child;
+  }
+};
+
+bool RunnerBase::reapThreadStates(WaitPidData &Data) {
+  while ((Data.Pid = waitpid(-1, &Data.Status, WNOHANG)) > 0) {
+    dbg(2) << "After waitpid, PidWaited " << Data.Pid << "\n";
+    if (!handleThreadStateChange(Data.Status, Data.Pid))
+      return true;
+  }
+  if (Data.Pid == -1) {
+    perror("waitpid()");
+    die("waitpid() failed");
+  }
+  return false;
+}
+
+bool RunnerBase::waitpidSkipThreadStateUntil(MonoTimePoint Deadline,
+                                             WaitPidData &Data) {
+  DeadlineWaiter Waiter(Deadline);
+  do {
+    // Reap all state changes, including those that happened before we
+    // blocked SIGCHLD.
+    if (reapThreadStates(Data))
+      return false;
+  } while (Waiter.wait() != DeadlineWaiter::Event::Deadline);
+  return true;
+}
+
+bool Runner::checksConvergence() const {
+  return Convergence != nullptr && !Convergence->empty() &&
+         !NoRedirect.getValue();
+}
+
+bool Runner::hasConverged(pid_t Pid) const {
+  // The fingerprints only cover the main thread.
+  if (Pid != ChildPID || !ChildThreads.empty())
+    return false;
+  if (!Convergence->contains(ChildPID, ExState))
+    return false;
+  // The output so far must also match.
+  return OutputMonitor(ExState, *OrigExState).check();
+}
+
+FtStatus Runner::waitpidSkipThreadStateOrEarlyOutcome(WaitPidData &Data) {
+  std::unique_ptr<OutputMonitor> Monitor;
+  if (EarlyCorruptionKill.getValue())
+    Monitor = std::make_unique<OutputMonitor>(ExState, *OrigExState);
+  DeadlineWaiter Waiter(MonoTimePoint::max(), Monitor ? Monitor->getFd() : -1);
+  while (true) {
+    while (reapThreadStates(Data)) {
+      // We only get system call stops after the injection, when checking
+      // for convergence.
+      if (!isSyscallStop(Data.Status))
+        return FtStatus::None;
+      if (hasConverged(Data.Pid))
+        return FtStatus::Masked;
+      // Multi-threaded runs never converge, so stop checking.
+      if (!ChildThreads.empty())
+        TraceSyscalls = false;
+      resumeThread(Data.Pid);
     }
-  } while (ThreadStateChanged);
-  return {Status, PidWaited};
+    if (Monitor && !Monitor->check())
+      return FtStatus::Corrupted;
+    Waiter.wait();
+  }
 }
 
 void RunnerBase::dumpChildThreads() const {
@@ -272,7 +778,9 @@ void RunnerBase::closeOpenTerminal() const {
     closeSafe(ChildTerminalFd);
 }
 
-OrigRunner::OrigRunner(long Id, bool DoCleanup) : RunnerBase(-1, DoCleanup) {}
+OrigRunner::OrigRunner(long Id, bool DoCleanup, ForkServer *Server,
+                       const ExecutionExitState *Output)
+    : RunnerBase(-1, DoCleanup, Server, Output) {}
 
 void OrigRunner::runAndWait() {
   // Start a timing run. Note: This is non-blocking.
@@ -286,16 +794,41 @@ void OrigRunner::runAndWait() {
   dbg(2) << "Waiting for ChildPID " << ChildPID << " Done\n";
 
   ExState.setExitState(getWaitPidExitState(Status));
+  recordRunTime();
   dbg(2) << "ExitState=" << ExState.getExitState().getDumpStr() << "\n";
+  if (Counter) {
+    InstrCount = Counter->read();
+    dbg(2) << "InstrCount=" << InstrCount << "\n";
+  }
 }
 
 FtStatus Runner::waitChildAndGetStatus() {
   // Wait until child process has finished (or early exited)
   dbg(2) << "Before waitpid()\n";
-  const auto &Data = waitpidSkipThreadState();
+  WaitPidData Data;
+  if (HasPendingState) {
+    // The child finished while we were waiting to inject another fault.
+    Data = PendingState;
+  } else if ((EarlyCorruptionKill.getValue() || checksConvergence()) &&
+             !NoRedirect.getValue()) {
+    FtStatus Early = waitpidSkipThreadStateOrEarlyOutcome(Data);
+    if (Early != FtStatus::None) {
+      dbg(2) << (Early == FtStatus::Masked
+                     ? "CHECK: Masked (converged with the original run).\n"
+                     : "CHECK: Corrupted (output diverged before exit).\n");
+      ExState.setExitState({ExitType::Signaled, SIGKILL});
+      ptraceSafe(PTRACE_KILL, ChildPID, 0, 0);
+      cleanupWaitpidState(ChildPID);
+      return Early;
+    }
+  } else {
+    Data = waitpidSkipThreadState();
+  }
   int WaitStatus = Data.Status;
   dbg(2) << "After waitpid()\n";
   ExState.setExitState(getWaitPidExitState(WaitStatus));
+  if (ExState.getExitState().Type == ExitType::Exited)
+    recordRunTime();
 
   // If we disable redirection to a file, then we should disable output checks.
   SkipCheck = NoRedirect.getValue() ? true : SkipCheck;
@@ -360,9 +893,10 @@ FtStatus Runner::waitChildAndGetStatus() {
 }
 
 Runner::Runner(long Id, const ExecutionExitState *OrigExState,
-               Statistics *Stats)
-    : RunnerBase(Id, true /* Cleanup */), OrigExState(OrigExState),
-      Stats(Stats) {}
+               Statistics *Stats, ForkServer *Server,
+               const ExecutionExitState *Output)
+    : RunnerBase(Id, true /* Cleanup */, Server, Output),
+      OrigExState(OrigExState), Stats(Stats) {}
 
 double Runner::getRandomInjectionTime() {
   assert(BinExecTime.isSet() && "Execution time not set");
@@ -373,6 +907,55 @@ double Runner::getRandomInjectionTime() {
   return Rand * BinExecTimeWithOvershoot;
 }
 
+unsigned long Runner::getInjectionInstr() {
+  if (UserInjectionInstr.isSet())
+    return UserInjectionInstr.getValue();
+  assert(BinInstrCount.isSet() && "Instruction count not set");
+  // Get a random number in [0, 1].
+  double Rand = (double)randSafe() / RAND_MAX;
+  return 1 + (unsigned long)(Rand * (BinInstrCount.getValue() - 1));
+}
+
+double Runner::getInjectionTime() {
+  if (Ckpt == nullptr)
+    return UserInjectionTime.isSet() ? UserInjectionTime.getValue()
+                                     : getRandomInjectionTime();
+  // We only run the suffix of the golden run after the checkpoint.
+  if (UserInjectionTime.isSet())
+    return UserInjectionTime.getValue() - Ckpt->Time;
+  double Rand = (double)randSafe() / RAND_MAX;
+  return Rand * (Ckpt->EndTime - Ckpt->Time);
+}
+
+void InjectionRecord::dump(std::ostream &OS) const {
+  if (InjectByInstrCount.getValue())
+    OS << "<Instr: " << Instr;
+  else
+    OS << "<Time: " << Time << "s";
+  OS << " Tid: " << Tid << " " << Reg.dumpStr() << " Bit: " << Bit << ">";
+}
+
+std::string InjectionRecord::dumpStr() const {
+  std::stringstream SS;
+  dump(SS);
+  return SS.str();
+}
+
+std::vector<InjectionRecord> Runner::getInjectionPoints() {
+  std::vector<InjectionRecord> Points(InjectionsPerRun.getValue());
+  for (InjectionRecord &Point : Points) {
+    if (InjectByInstrCount.getValue())
+      Point.Instr = getInjectionInstr();
+    else
+      Point.Time = getInjectionTime();
+  }
+  std::sort(Points.begin(), Points.end(),
+            [](const InjectionRecord &P1, const InjectionRecord &P2) {
+              return std::tie(P1.Time, P1.Instr) < std::tie(P2.Time, P2.Instr);
+            });
+  return Points;
+}
+
 void Runner::runAndWait() {
   unsigned Attempts = MaxInjectionAttempts;
   bool InjectOK = false;
@@ -386,20 +969,35 @@ void Runner::runAndWait() {
               MaxInjectionAttempts.getFlag(), " (currently set to ",
               MaxInjectionAttempts.getValue(), ").\n");
     }
+    Injections.clear();
+    HasPendingState = false;
+    StaleBreakpoints.clear();
+    // If the user has not set the injection time, set it to a random value.
+    std::vector<InjectionRecord> Points = getInjectionPoints();
+    // The instruction counter stops the child, so set it up before the run.
+    if (InjectByInstrCount.getValue() && !Points.empty())
+      StopAtInstr = Points.front().Instr;
     // Start an injection run. Note: This is non-blocking.
     bool Success = run(true /* Timeout Alarm */);
     if (!Success)
       continue;
 
-    if (InjectionsPerRun.getValue() > 0) {
-      // If the user has not set the injection time, set it to a random value.
-      double InjectionTime = UserInjectionTime.isSet()
-                                 ? UserInjectionTime.getValue()
-                                 : getRandomInjectionTime();
-      InjectOK = tryInjectFaultAt(*Stats, InjectionTime);
-    }
+    if (!Points.empty())
+      InjectOK = tryInjectFaults(*Stats, Points);
   } while (!InjectOK && InjectionsPerRun.getValue() > 0);
 
+  // The average latency of stopping the child for the injections.
+  double LatencySum = 0.0;
+  unsigned LatencyCnt = 0;
+  for (const InjectionRecord &Injection : Injections) {
+    dbg(2) << "Injected " << Injection.dumpStr() << "\n";
+    if (Injection.Latency >= 0.0) {
+      LatencySum += Injection.Latency;
+      LatencyCnt++;
+    }
+  }
+  InjectionLatency = LatencyCnt != 0 ? LatencySum / LatencyCnt : -1.0;
+
   // Wait until the child has finished.
   FaultInjectionStatus = waitChildAndGetStatus();
 
@@ -408,46 +1006,72 @@ void Runner::runAndWait() {
   cleanupWaitpidState(ChildPID);
 }
 
-void Runner::sleepAndStopRandomChildThread(double SleepTime, bool *Ret) {
-  // Sleep until the time comes to inject the fault.
-  dbg(2) << "Sleeping " << SleepTime << " s...\n";
-  std::this_thread::sleep_for(
-      std::chrono::milliseconds((unsigned long)(SleepTime * 1000)));
-  dbg(2) << "Sleeping " << SleepTime << " Done\n";
-
+bool Runner::stopRandomChildThread() {
   // Pick a random thread.
   ChildPIDToInject = getRandomChildThreadPID();
 
-  // Now stop it with a kill().
-  dbg(2) << "About to kill " << ChildPIDToInject << " with signal " << SIGTRAP
-         << "\n";
-  // Kill can fail if the target process has finished.
-  if (kill(ChildPIDToInject, SIGTRAP) != 0) {
-    dbg(2) << "Kill failed\n";
-    *Ret = false;
-    return;
+  // Now stop that specific thread.
+  if (!stopChildThread(ChildPIDToInject)) {
+    dbg(2) << "Stop failed\n";
+    return false;
   }
-  *Ret = true;
-  dbg(2) << "Kill done\n";
+  dbg(2) << "Stop done\n";
+  return true;
 }
 
-bool Runner::stopChildAfter(double SleepTime) {
-  // Don't block for the sleep + kill, because in multi-threaded applications we
-  // need to process the spawned threads.
-  bool KillSuccess = false;
-  std::thread SleepAndKillThread(&Runner::sleepAndStopRandomChildThread, this,
-                                 SleepTime, &KillSuccess);
+bool Runner::keepPendingState(const WaitPidData &Data) {
+  if (Injections.empty())
+    return false;
+  dbg(2) << "Child changed state before injection " << Injections.size() + 1
+         << ", keeping its state\n";
+  PendingState = Data;
+  HasPendingState = true;
+  return true;
+}
 
-  const auto &Data = waitpidSkipThreadState();
-  int Status = Data.Status;
-  // waitpid() is waiting for the signal sent by SleepAndKillTHread. So at this
-  // point join() will not block and will return right away.
-  SleepAndKillThread.join();
-  // Kill failed. ChildPID must have finished.
-  if (!KillSuccess)
+bool Runner::stopChildAfter(InjectionRecord &Point) {
+  double SleepTime = Point.Time;
+  // Wait until the injection time, while processing the spawned threads of
+  // multi-threaded applications.
+  MonoTimePoint Deadline = addSecs(ChildStartTime, SleepTime);
+  dbg(2) << "Waiting until " << SleepTime << " s...\n";
+  WaitPidData Data;
+  if (!waitpidSkipThreadStateUntil(Deadline, Data)) {
+    // The child changed state before we got to stop it. If we have already
+    // injected a fault, this is the outcome of the run.
+    if (keepPendingState(Data))
+      return false;
+    ExitState ChildState = getWaitPidExitState(Data.Status);
+    if (ChildState.Type == ExitType::Exited) {
+      dbg(2) << "Waited too long? Child has already exited\n";
+      return false;
+    }
+    dbg(2) << "Child stopped or terminated before the injection time\n";
+    ptrace(PTRACE_KILL, ChildPID, 0, 0);
+    cleanupWaitpidState(ChildPID);
     return false;
+  }
+  dbg(2) << "Waiting " << SleepTime << " Done\n";
+  // Stop failed. ChildPID must have finished.
+  if (!stopRandomChildThread()) {
+    // Collect its state if it is the outcome of the run.
+    if (!Injections.empty())
+      keepPendingState(waitpidSkipThreadState());
+    return false;
+  }
+
+  Data = waitpidSkipThreadState();
+  int Status = Data.Status;
+  Point.Latency = getMonoTimeDiff(Deadline, getMonoTime());
+  dbg(2) << "Injection latency " << Point.Latency * 1000000 << " us\n";
 
   ExitState ChildState = getWaitPidExitState(Status);
+  // After the first injection, anything but our stop, e.g. a crash caused by
+  // an earlier fault, is the outcome of the run.
+  if (!Injections.empty() &&
+      (ChildState.Type != ExitType::Stopped || ChildState.Val != SIGTRAP) &&
+      keepPendingState(Data))
+    return false;
   if (ChildState.Type == ExitType::Exited) {
     dbg(2) << "Waited too long? Child has already exited\n";
     return false;
@@ -469,31 +1093,276 @@ bool Runner::stopChildAfter(double SleepTime) {
   return true;
 }
 
-bool Runner::doBitFlip() {
-  // This is where the actual fault injection takes place.
-  assert(ChildPIDToInject > 0 && "Uninitialized?");
-  RegisterManipulator RM(ChildPIDToInject);
+bool Runner::stopChildAtInstr() {
+  // The counter overflow sends a SIGTRAP to the main thread.
+  const auto &Data = waitpidSkipThreadState();
+  ExitState ChildState = getWaitPidExitState(Data.Status);
+  bool IsOurStop = ChildState.Type == ExitType::Stopped &&
+                   ChildState.Val == SIGTRAP && Data.Pid == ChildPID;
+  // After the first injection, anything else is the outcome of the run.
+  if (!IsOurStop && keepPendingState(Data))
+    return false;
+  if (ChildState.Type == ExitType::Exited) {
+    dbg(2) << "Child exited before instruction " << StopAtInstr << "\n";
+    return false;
+  }
+  if (!IsOurStop) {
+    dbg(2) << "Child stopped before instruction " << StopAtInstr << "\n";
+    ptrace(PTRACE_KILL, ChildPID, 0, 0);
+    cleanupWaitpidState(ChildPID);
+    return false;
+  }
+  dbg(2) << "Stopped " << ChildPID << " after "
+         << (Counter ? Counter->read() : 0) << " instructions\n";
+  ChildPIDToInject = ChildPID;
+  return true;
+}
+
+AddressSpace &Runner::getChildAS() {
+  // The clones of the fork server start with its address space, so only
+  // parse it again if the child has changed it since.
+  if (!ChildAS) {
+    const AddressSpace *ServerAS =
+        Server != nullptr ? Server->getAddressSpace() : nullptr;
+    ChildAS.reset(ServerAS != nullptr
+                      ? new AddressSpace(*ServerAS, ChildPIDToInject)
+                      : new AddressSpace(ChildPIDToInject));
+  } else if (ChildAS->getPid() != ChildPIDToInject) {
+    // Another thread of the same process, which may outlive the previous one.
+    ChildAS.reset(new AddressSpace(*ChildAS, ChildPIDToInject));
+  }
+  ChildAS->refresh();
+  return *ChildAS;
+}
+
+bool Runner::isInFunctionScope(unsigned long IP) {
+  const FunctionScope &Scope = FunctionScope::get();
+  if (Scope.empty())
+    return true;
+  std::string Path;
+  unsigned long Offset;
+  return ChildAS->getFileOffset(IP, Path, Offset) &&
+         Scope.contains(Path, Offset);
+}
+
+/// The maximum number of instructions of the selected functions that we step
+/// over after entering them.
+static constexpr const unsigned MaxScopeSteps = 64;
+/// The maximum number of instructions that we step, including those of the
+/// functions called from the selected ones.
+static constexpr const unsigned MaxScopeStepBudget = 4096;
+
+/// \Returns the instruction pointer of the stopped thread \p Tid.
+static unsigned long getIP(pid_t Tid) {
+  return ptraceSafe(PTRACE_PEEKUSER, Tid,
+                    (void *)offsetof(user_regs_struct, rip), 0);
+}
+
+bool Runner::failStop(const WaitPidData *Data) {
+  if (Data != nullptr) {
+    if (keepPendingState(*Data))
+      return false;
+    if (getWaitPidExitState(Data->Status).Type == ExitType::Exited)
+      return false;
+  }
+  ptrace(PTRACE_KILL, ChildPID, 0, 0);
+  cleanupWaitpidState(ChildPID);
+  return false;
+}
 
-  uint8_t *IP = RM.getProgramCounter();
-  dbg(2) << "IP: " << (void *)IP << "\n";
+bool Runner::runToBreakpoints(const std::vector<unsigned long> &Addrs) {
+  std::vector<std::unique_ptr<Breakpoint>> BPs;
+  for (unsigned long Addr : Addrs) {
+    BPs.emplace_back(new Breakpoint(ChildPIDToInject, Addr));
+    BPs.back()->enable();
+  }
+  resumeThread(ChildPIDToInject);
+  const Breakpoint *HitBP = nullptr;
+  WaitPidData Data;
+  while (HitBP == nullptr) {
+    Data = waitpidSkipThreadState();
+    // We may be stopping at the system calls after an earlier injection.
+    if (WIFSTOPPED(Data.Status) && WSTOPSIG(Data.Status) == (SIGTRAP | 0x80)) {
+      resumeThread(Data.Pid);
+      continue;
+    }
+    user_regs_struct Regs;
+    if (!WIFSTOPPED(Data.Status) || WSTOPSIG(Data.Status) != SIGTRAP ||
+        ptrace(PTRACE_GETREGS, Data.Pid, nullptr, &Regs) != 0)
+      return failStop(&Data);
+    for (const auto &BP : BPs)
+      if (BP->isHit(Regs))
+        HitBP = BP.get();
+    if (HitBP == nullptr)
+      return failStop(&Data);
+  }
+  // Other threads may be trapping on the breakpoints as we remove them. They
+  // overlap within a word, so remove them in the reverse order.
+  for (auto It = BPs.rbegin(), E = BPs.rend(); It != E; ++It) {
+    (*It)->setTid(Data.Pid);
+    (*It)->disable();
+    StaleBreakpoints.push_back((*It)->getAddr());
+  }
+  HitBP->rewind(Data.Pid);
+  ChildPIDToInject = Data.Pid;
+  dbg(2) << "Thread " << Data.Pid << " reached " << (void *)HitBP->getAddr()
+         << "\n";
+  return true;
+}
 
-  // Parse the address space of the child.
-  AddressSpace ChildAS(ChildPIDToInject);
+bool Runner::reachFunctionScope() {
+  AddressSpace &AS = getChildAS();
+  if (isInFunctionScope(getIP(ChildPIDToInject)))
+    return true;
 
-  // Check if we are in library
-  if (DontInjectToLibs && ChildAS.isInLibrary((uint64_t)IP)) {
-    dbg(2) << "We are in a library, skipping\n";
+  // Stop at the entry points of the selected functions.
+  std::vector<unsigned long> Entries;
+  for (const auto &File : FunctionScope::get().getRanges())
+    for (const FunctionScope::Range &R : File.second) {
+      unsigned long Addr;
+      if (AS.getAddress(File.first, R.From, Addr))
+        Entries.push_back(Addr);
+    }
+  if (Entries.empty()) {
+    dbg(2) << "None of the functions is mapped\n";
+    return failStop(nullptr);
+  }
+  dbg(2) << "Running to one of " << Entries.size() << " functions\n";
+  if (!runToBreakpoints(Entries))
     return false;
+
+  // Step a random number of instructions of the selected functions.
+  unsigned Steps = randSafe() % MaxScopeSteps;
+  for (unsigned Budget = MaxScopeStepBudget; Steps != 0; --Budget) {
+    if (Budget == 0) {
+      dbg(2) << "Left the functions for too long\n";
+      return failStop(nullptr);
+    }
+    ptraceSafe(PTRACE_SINGLESTEP, ChildPIDToInject, 0, 0);
+    WaitPidData Data = waitpidSafe(ChildPIDToInject);
+    if (!WIFSTOPPED(Data.Status) || WSTOPSIG(Data.Status) != SIGTRAP)
+      return failStop(&Data);
+    if (isInFunctionScope(getIP(ChildPIDToInject)))
+      --Steps;
   }
+  return true;
+}
 
-  RegDescr Reg;
-  unsigned Bit;
+/// The number of stack words that we search for a return address.
+static constexpr const unsigned MaxStackScanWords = 4096;
+
+/// \Returns true if the code \p Before, which ends right before \p RetAddr,
+/// ends with a call instruction, so that \p RetAddr is a return address.
+static bool isAfterCall(const uint8_t (&Before)[8]) {
+  // A direct call: e8 rel32.
+  if (Before[8 - 5] == 0xe8)
+    return true;
+  // An indirect call: ff /2, with a ModRM and up to 5 more bytes.
+  for (unsigned Len : {2, 3, 4, 6, 7}) {
+    uint8_t ModRM = Before[8 - Len + 1];
+    if (Before[8 - Len] == 0xff && ((ModRM >> 3) & 7) == 2)
+      return true;
+  }
+  return false;
+}
+
+bool Runner::leaveExcludedCode() {
+  AddressSpace &AS = getChildAS();
+  if (AS.isInjectable(getIP(ChildPIDToInject)))
+    return true;
+
+  // Without frame pointers or unwind tables, look for the innermost return
+  // address into code that we can inject to, by scanning the stack for words
+  // that point right after a call instruction.
+  unsigned long SP = ptraceSafe(PTRACE_PEEKUSER, ChildPIDToInject,
+                                (void *)offsetof(user_regs_struct, rsp), 0);
+  std::vector<unsigned long> Stack(MaxStackScanWords);
+  ChildMemory Mem(ChildPIDToInject);
+  size_t Words = Mem.read(SP, Stack.data(), Stack.size() * sizeof(Stack[0])) /
+                 sizeof(Stack[0]);
+  unsigned long RetAddr = 0;
+  for (size_t Idx = 0; Idx != Words && RetAddr == 0; ++Idx) {
+    unsigned long Addr = Stack[Idx];
+    uint8_t Before[8];
+    if (Addr < sizeof(Before) || AS.findRegion(Addr) == nullptr ||
+        !AS.isInjectable(Addr) ||
+        Mem.read(Addr - sizeof(Before), Before, sizeof(Before)) !=
+            sizeof(Before) ||
+        !isAfterCall(Before))
+      continue;
+    RetAddr = Addr;
+  }
+  if (RetAddr == 0) {
+    dbg(2) << "No return address to injectable code on the stack\n";
+    return failStop(nullptr);
+  }
+  dbg(2) << "Running to return address " << (void *)RetAddr << "\n";
+  return runToBreakpoints({RetAddr});
+}
+
+bool Runner::singleStep() {
+  ptraceSafe(PTRACE_SINGLESTEP, ChildPIDToInject, 0, 0);
+  const auto &StatusPid = waitpidSafe(ChildPIDToInject);
+  ExitState State = getWaitPidExitState(StatusPid.Status);
+  // If we are *exteremely* unlucky, the alarm or some other signal might have
+  // gone off. We will just restart test run.
+  if (State.Type != ExitType::Stopped || State.Val != SIGTRAP) {
+    dbg(2) << "SINGLESTEP did not stop with a SIGTRAP\n";
+    return false;
+  }
+  return true;
+}
+
+bool Runner::selectRegAndBit(RegisterManipulator &RM, uint8_t *IP,
+                             RegDescr &Reg, unsigned &Bit) {
+  AddressSpace &AS = getChildAS();
+  // Check if we are in a module that we should not inject to.
+  if (!AS.isInjectable((uint64_t)IP)) {
+    dbg(2) << "We are in an excluded module, skipping\n";
+    return false;
+  }
+  if (!isInFunctionScope((uint64_t)IP)) {
+    dbg(2) << "We are not in the selected functions, skipping\n";
+    return false;
+  }
   bool Success;
-  std::tie(Reg, Bit, Success) = RM.getSelectedRegAndBit(IP);
+  std::tie(Reg, Bit, Success) = RM.getSelectedRegAndBit(IP, AS);
   // This can fail for instructions accessing no registers, like jne.
-  if (!Success) {
+  if (!Success)
     dbg(2) << "failed to get random reg and bit\n";
-    return false;
+  return Success;
+}
+
+/// \Returns true if the instruction at \p IP of process \p Pid is a system
+/// call. Single-stepping it may end the process or block.
+static bool isSyscallInstr(pid_t Pid, uint8_t *IP) {
+  uint8_t Code[2] = {0, 0};
+  ChildMemory(Pid).read((unsigned long)IP, Code, sizeof(Code));
+  return Code[0] == 0x0f && Code[1] == 0x05;
+}
+
+bool Runner::doBitFlip(InjectionRecord &Point) {
+  // This is where the actual fault injection takes place.
+  assert(ChildPIDToInject > 0 && "Uninitialized?");
+  RegisterManipulator RM(ChildPIDToInject);
+
+  // Find the register and bit to flip. With -step-to-eligible, step to the
+  // next instruction that we can inject to instead of giving up the run.
+  RegDescr Reg;
+  unsigned Bit;
+  uint8_t *IP;
+  for (int Steps = 0;; ++Steps) {
+    IP = RM.getProgramCounter();
+    dbg(2) << "IP: " << (void *)IP << "\n";
+    if (selectRegAndBit(RM, IP, Reg, Bit)) {
+      if (Steps != 0)
+        dbg(2) << "Stepped " << Steps << " instructions to an eligible one\n";
+      break;
+    }
+    if (Steps == StepToEligible.getValue() ||
+        isSyscallInstr(ChildPIDToInject, IP) || !singleStep())
+      return false;
+    RM.invalidateRegisters();
   }
 
   // If we are injecting the fault into a register that gets written, then step
@@ -503,34 +1372,41 @@ bool Runner::doBitFlip() {
   if (Reg.Written) {
     // Step to next instruction.
     dbg(2) << "about to SINGLESTEP\n";
-    ptraceSafe(PTRACE_SINGLESTEP, ChildPIDToInject, 0, 0);
-    int Status;
-    const auto &StatusPid = waitpidSafe(ChildPIDToInject);
-    ExitState State = getWaitPidExitState(StatusPid.Status);
-    // If we are *exteremely* unlucky, the alarm might have gone off.
-    // We will just restart test run.
-    if (State.Type == ExitType::Stopped && State.Val == SIGALRM)
+    if (!singleStep())
       return false;
-    assert(State.Type == ExitType::Stopped && State.Val == SIGTRAP &&
-           "SingleStep should stop the program with a SIGTRAP.");
+    RM.invalidateRegisters();
   }
 
   // Now try to flip the bit.
-  if (!RM.tryBitFlip(Reg.Name, Bit))
+  if (!RM.tryBitFlip(Reg.Id, Bit))
     return false;
 
-  // Continue the execution.
-  ptraceSafe(PTRACE_CONT, ChildPIDToInject, 0, 0);
-
-  dbg(2) << "PTRACE_CONT\n";
+  if (const AddressSpace::Region *R = getChildAS().findRegion((unsigned long)IP))
+    dbg(2) << "Injected to module " << R->getModuleName() << "\n";
+  Point.Tid = ChildPIDToInject;
+  Point.IP = (unsigned long)IP;
+  Point.Reg = Reg;
+  Point.Bit = Bit;
   return true;
 }
 
 // Stop and inject the fault. Upon failure make sure that the child is killed.
-bool Runner::tryInjectFaultAt(Statistics &Stats, double InjectionTime) {
+bool Runner::tryInjectFaultAt(Statistics &Stats, InjectionRecord &Point) {
   // Try to stop the child. This fails if the binary has already stopped, so no
   // need to kill it.
-  if (!stopChildAfter(InjectionTime)) {
+  bool Stopped = InjectByInstrCount.getValue() ? stopChildAtInstr()
+                                               : stopChildAfter(Point);
+  // Get into the selected functions, if any, instead of restarting the run
+  // until we happen to stop in them.
+  if (Stopped && !FunctionScope::get().empty())
+    Stopped = reachFunctionScope();
+  // Similarly, return from the excluded code, e.g., a library.
+  if (Stopped && RunToReturn.getValue())
+    Stopped = leaveExcludedCode();
+  if (!Stopped) {
+    // The child has finished after an earlier injection.
+    if (HasPendingState)
+      return false;
     Stats.incr(Type::InjFailed);
     dbg(2) << "stopChildAfter() failed. Child has already stopped?\n";
     return false;
@@ -539,7 +1415,7 @@ bool Runner::tryInjectFaultAt(Statistics &Stats, double InjectionTime) {
   // Now that the child has stopped, try to inject a fault.
   // Fault injection could fail for various reasons (e.g., instruction
   // accessing no registers, unimplemented features, etc.) so keep trying.
-  if (!doBitFlip()) {
+  if (!doBitFlip(Point)) {
     Stats.incr(Type::InjFailed);
     dbg(2) << "doBitFlip() failed\n";
     // We failed to inject a bit-flip, so kill the child.
@@ -550,6 +1426,29 @@ bool Runner::tryInjectFaultAt(Statistics &Stats, double InjectionTime) {
   return true;
 }
 
+bool Runner::tryInjectFaults(Statistics &Stats,
+                             std::vector<InjectionRecord> &Points) {
+  for (size_t Idx = 0, E = Points.size(); Idx != E; ++Idx) {
+    if (!tryInjectFaultAt(Stats, Points[Idx]))
+      return HasPendingState;
+    Injections.push_back(Points[Idx]);
+    bool IsLast = Idx + 1 == E;
+    // Count the instructions up to the next injection point from here.
+    if (!IsLast && InjectByInstrCount.getValue()) {
+      unsigned long Count = Counter->read();
+      StopAtInstr = std::max(Points[Idx + 1].Instr, Count + 1);
+      Counter->stopAfter(StopAtInstr - Count);
+    }
+    // Continue the execution. After the last injection, stop at every system
+    // call if we are checking whether the run converges back to the original
+    // run.
+    TraceSyscalls = IsLast && checksConvergence();
+    resumeThread(ChildPIDToInject);
+    dbg(2) << "PTRACE_CONT\n";
+  }
+  return true;
+}
+
 bool Runner::systemCustom(const char *Cmd, const char *Shell) {
   pid_t ChildPID = forkSafe();
   if (ChildPID == 0) {
@@ -23,14 +23,23 @@
 #include "addrSpace.h"
 #include "debugstream.h"
 #include "exitState.h"
+#include "instrCounter.h"
+#include "regManip.h"
 #include "statistics.h"
 #include "utils.h"
 #include <cassert>
 #include <climits>
+#include <memory>
+#include <set>
 #include <string>
 #include <unistd.h>
 #include <vector>
 
+class ForkServer;
+struct Checkpoint;
+class ConvergenceSet;
+class Terminal;
+
 /// The injection status of the process.
 enum class FtStatus {
   None,      ///< Uninitialized.
@@ -43,6 +52,50 @@ enum class FtStatus {
   Skipped,   ///< Skipped checking.
 };
 
+/// A fault injected into a test run.
+struct InjectionRecord {
+  /// The time since the start of the child, in seconds.
+  double Time = 0.0;
+  /// The main thread's instruction count, with -inject-by-instr-count.
+  unsigned long Instr = 0;
+  /// The thread that we injected the fault into.
+  pid_t Tid = 0;
+  /// The instruction whose register we flipped.
+  unsigned long IP = 0;
+  /// The register and the bit that we flipped.
+  RegDescr Reg;
+  unsigned Bit = 0;
+  /// The delay from Time until the thread stopped, or negative if not
+  /// measured.
+  double Latency = -1.0;
+
+  /// Debug print to \p OS.
+  void dump(std::ostream &OS) const;
+
+  /// Debug print returning an std::string.
+  std::string dumpStr() const;
+};
+
+/// The outcome of a test run, as sent from the job to the main process.
+struct RunResult {
+  /// The fault injection status.
+  FtStatus Status;
+  /// The injection latency in seconds, or negative if not measured.
+  double InjectionLatency;
+  /// The runtime in seconds if the child exited, otherwise negative.
+  double RunTime;
+  /// The number of faults injected.
+  unsigned NumInjections;
+  /// The maximum number of faults whose InjectionRecords follow the
+  /// RunResult. The rest are only counted.
+  static constexpr const unsigned MaxRecords = 64;
+
+  /// \Returns the number of InjectionRecords that follow the RunResult.
+  unsigned getNumRecords() const {
+    return NumInjections < MaxRecords ? NumInjections : MaxRecords;
+  }
+};
+
 /// The base class for the orig/test runners.
 class RunnerBase {
 protected:
@@ -64,6 +117,9 @@ protected:
   /// Execution time of the binary.
   double ExecTime = 0.0;
 
+  /// The time when the child started running, right after execve().
+  MonoTimePoint ChildStartTime;
+
   /// The exit status of this run. We keep track of the exit type (i.e., exited
   /// normally/signaled/stopped and the exit code/signal number).
   ExecutionExitState ExState;
@@ -80,12 +136,81 @@ protected:
   /// Remove temporary files.
   bool DoCleanup = true;
 
-  /// Check that the arguments are valid, or exit.
-  void sanityChecksOrExit();
+  /// The stdout/stderr files are shared with the job scheduler, which closes
+  /// them.
+  bool SharedFiles = false;
+
+  /// If set, the child is cloned from this server instead of exec'ed.
+  ForkServer *Server = nullptr;
+
+  /// If set, the server is a clone of this checkpoint of the golden run.
+  const Checkpoint *Ckpt = nullptr;
+
+  /// If set, the child runs on this terminal instead of on a new one.
+  const Terminal *Term = nullptr;
+
+  /// Counts the instructions of the child with -inject-by-instr-count.
+  std::unique_ptr<InstrCounter> Counter;
+
+  /// If not 0, the counter stops the child after this many instructions.
+  unsigned long StopAtInstr = 0;
+
+  /// The child was attached with PTRACE_SEIZE (-seize), so we stop it with
+  /// PTRACE_INTERRUPT and deliver the signals that it handles.
+  bool Seized = false;
+
+  /// Resume the main thread with PTRACE_SYSCALL instead of PTRACE_CONT.
+  bool TraceSyscalls = false;
+
+  /// The number of getrandom() calls that we have emulated.
+  unsigned long NumGetrandomCalls = 0;
+
+  /// The infinite execution timeout in seconds, if set with
+  /// setInfExecTimeout().
+  double InfExecTimeout = -1.0;
+
+  /// The runtime of the child in seconds if it exited, otherwise negative.
+  double RunTime = -1.0;
+
+  /// Set RunTime to the time since the child started. Runs cloned from a
+  /// checkpoint also count the golden run's time up to the checkpoint.
+  void recordRunTime();
+
+  /// The thread that we stopped with PTRACE_INTERRUPT, if any. Its
+  /// PTRACE_EVENT_STOP is ours and must not be skipped.
+  pid_t InterruptedTid = 0;
+
+  /// The addresses of the breakpoints that we removed while other threads
+  /// may have been trapping on them. Those threads are moved back to the
+  /// original instruction and resumed.
+  std::vector<unsigned long> StaleBreakpoints;
+
+  /// \Returns true if thread \p Tid, stopped with \p Status, has trapped on
+  /// one of the StaleBreakpoints, in which case it is rewound and resumed.
+  bool skipStaleBreakpoint(int Status, pid_t Tid);
 
 public:
   /// Inspects the waitpid() \p Status and \returns the exit state.
   static ExitState getWaitPidExitState(int Status);
+
+  /// Check that the arguments are valid, or exit.
+  static void sanityChecksOrExit();
+
+  /// Fill in \p Argv and \p Argp with the arguments and environment for
+  /// execve().
+  static void initExecArgs(std::vector<const char *> &Argv,
+                           std::vector<const char *> &Argp);
+
+  /// \Returns the infinite execution timeout in seconds.
+  double getInfExecTimeout() const;
+
+  /// Override the infinite execution timeout with \p Secs, for
+  /// -adaptive-timeout.
+  void setInfExecTimeout(double Secs) { InfExecTimeout = Secs; }
+
+  /// \Returns the runtime of the child in seconds if it exited, otherwise a
+  /// negative value.
+  double getRunTime() const { return RunTime; }
 protected:
 
   /// Close open terminal to avoid "too many open files" error.
@@ -94,10 +219,58 @@ protected:
   /// Run the workload. Note: This is non-blocking. \Returns false on failure.
   bool run(bool TimeoutAlarm = false);
 
+  /// Start the workload with clone(CLONE_VM | CLONE_VFORK), which avoids
+  /// copying our page tables (-vfork-spawn). This returns once the child has
+  /// called execve() and \returns its PID.
+  pid_t spawnVfork(bool TimeoutAlarm);
+
+  /// Like run(), but clone the child from the fork server.
+  bool runClone(bool TimeoutAlarm);
+
+  /// Redirect the output of the stopped clone ChildPID and arm its timer.
+  void setupClone(bool TimeoutAlarm);
+
+  /// Fill the output files with the golden output produced up to Ckpt.
+  void copyCheckpointPrefix();
+
+  /// Attach to ChildPID with PTRACE_SEIZE and let it run until it has
+  /// completed execve(). \Returns false if the child is gone.
+  bool seizeChild();
+
+  /// Stop thread \p Tid of the child, with PTRACE_INTERRUPT if Seized, or
+  /// with a SIGTRAP otherwise. \Returns false if the thread is gone.
+  bool stopChildThread(pid_t Tid);
+
+  /// \Returns true if a signal-delivery-stop with \p Status is a signal that
+  /// the seized child expects, so it should be delivered to it.
+  bool isExpectedSignal(int Status) const;
+
+  /// \Returns the ptrace options for the clones of the fork server.
+  static long getCloneTraceOptions();
+
+  /// Resume the stopped thread \p Tid, delivering signal \p Sig.
+  void resumeThread(pid_t Tid, int Sig = 0);
+
+  /// Start counting the instructions of the stopped child, if enabled.
+  void startInstrCounter();
+
   /// Wait for a state change, skipping any stops due to thread
   /// state update. This maintains the children thread state.
   WaitPidData waitpidSkipThreadState();
 
+  /// If \p Status of \p Pid is a change in the thread state, update the
+  /// state, let the thread continue and \returns true.
+  bool handleThreadStateChange(int Status, pid_t Pid);
+
+  /// Reap the pending state changes without blocking, skipping the thread
+  /// state changes. \Returns true if there was some other state change, which
+  /// is in \p Data.
+  bool reapThreadStates(WaitPidData &Data);
+
+  /// Like waitpidSkipThreadState(), but give up at \p Deadline. \Returns true
+  /// if the deadline expired, otherwise the state change is in \p Data.
+  bool waitpidSkipThreadStateUntil(MonoTimePoint Deadline, WaitPidData &Data);
+
   /// Debug print child threads.
   void dumpChildThreads() const;
 
@@ -107,7 +280,10 @@ protected:
   ~RunnerBase();
 
 public:
-  RunnerBase(long Id, bool DoCleanup);
+  /// If \p Output is set, the child writes to its stdout/stderr files instead
+  /// of new ones.
+  RunnerBase(long Id, bool DoCleanup, ForkServer *Server = nullptr,
+             const ExecutionExitState *Output = nullptr);
 
   /// \Returns the exit state.
   const ExecutionExitState &getExecutionExitState() const { return ExState; }
@@ -115,6 +291,10 @@ public:
   /// \Returns the exit state.
   const FtStatus &getFtStatus() const { return FaultInjectionStatus; }
 
+  /// Run the child on \p T, which outlives the runs, instead of opening a new
+  /// terminal for each run.
+  void setTerminal(const Terminal *T) { Term = T; }
+
   /// Run the workload, wait for it to finish and set \p ThreadFinished to true.
   virtual void runAndWait() = 0;
 };
@@ -124,11 +304,17 @@ public:
 
 // This class launches binaries and
 class OrigRunner : public RunnerBase {
+  /// The number of instructions executed, with -inject-by-instr-count.
+  unsigned long InstrCount = 0;
+
 public:
-  OrigRunner(long Id, bool DoCleanup);
+  OrigRunner(long Id, bool DoCleanup, ForkServer *Server = nullptr,
+             const ExecutionExitState *Output = nullptr);
   /// In the original run we just run and wait to finish. No injection takes
   /// place, therefore there is no \p Stats to update.
   void runAndWait() override;
+  /// \Returns the number of instructions executed by the main thread.
+  unsigned long getInstrCount() const { return InstrCount; }
 };
 
 /// Runner for the test program.
@@ -143,25 +329,120 @@ class Runner : public RunnerBase {
   /// Wait until the child has stopped and return its status.
   FtStatus waitChildAndGetStatus();
 
+  /// The fingerprints of the golden run, if we check for convergence.
+  const ConvergenceSet *Convergence = nullptr;
+
+  /// \Returns true if we stop the child at its system calls after the
+  /// injection, to check whether it has converged back to the golden run.
+  bool checksConvergence() const;
+
+  /// \Returns true if thread \p Pid, stopped at a system call, has converged
+  /// back to the golden run.
+  bool hasConverged(pid_t Pid) const;
+
+  /// Like waitpidSkipThreadState(), but also compare the output against the
+  /// original output as it is written (-early-corruption-kill) and check for
+  /// convergence at system call stops. \Returns FtStatus::None if the child
+  /// changed state, which is in \p Data, otherwise the early outcome.
+  FtStatus waitpidSkipThreadStateOrEarlyOutcome(WaitPidData &Data);
+
   /// Statistics collection.
   Statistics *Stats = nullptr;
 
   /// The PID of the child that we are stopping for fault injection.
   pid_t ChildPIDToInject = 0;
 
+  /// The address space of the child, kept across its injections.
+  std::unique_ptr<AddressSpace> ChildAS;
+
+  /// \Returns the address space of ChildPIDToInject, refreshed.
+  AddressSpace &getChildAS();
+
+  /// \Returns true if \p IP is in the functions of -inject-to-functions.
+  bool isInFunctionScope(unsigned long IP);
+
+  /// Kill the child after it failed to stop where we wanted, unless its state
+  /// \p Data, if not null, is the outcome of the run. \Returns false.
+  bool failStop(const WaitPidData *Data);
+
+  /// Set breakpoints at \p Addrs and resume ChildPIDToInject until some
+  /// thread hits one of them. That thread becomes ChildPIDToInject, stopped
+  /// at the breakpoint address. On failure the child is handled as in
+  /// failStop().
+  bool runToBreakpoints(const std::vector<unsigned long> &Addrs);
+
+  /// With -run-to-return, if the stopped ChildPIDToInject is in code that we
+  /// don't inject to, run it to the innermost return address into code that
+  /// we do inject to. On failure the child is handled as in failStop().
+  bool leaveExcludedCode();
+
+  /// With -inject-to-functions, move the stopped ChildPIDToInject into the
+  /// selected functions: if it is not in them, run until some thread enters
+  /// one of them. Then step a random number of their instructions, so that
+  /// we don't always inject at the entry points. On failure the child is
+  /// killed, or its state is kept if it is the outcome of the run.
+  bool reachFunctionScope();
+
+  /// The delay from the injection time until the child actually stopped, in
+  /// seconds, averaged over the injections. Negative if not measured.
+  double InjectionLatency = -1.0;
+
+  /// The faults injected into the current run, sorted by time.
+  std::vector<InjectionRecord> Injections;
+
+  /// The child changed state, e.g. it crashed or exited, while we were waiting
+  /// for a later injection point. waitChildAndGetStatus() uses this state
+  /// instead of waiting for a new one.
+  bool HasPendingState = false;
+  WaitPidData PendingState;
+
+  /// Keep the state \p Data of the child if we have already injected a fault.
+  /// \Returns true if we did.
+  bool keepPendingState(const WaitPidData &Data);
+
   /// Similar to system(), run \p Cmd, but using a custom \p Shell. \Returns
   /// true on success.
   static bool systemCustom(const char *Cmd, const char *Shell);
 
 public:
   /// Test runs need to access data from the original timed run in \p OrigR.
-  Runner(long Id, const ExecutionExitState *OrigExState, Statistics *Stats);
+  Runner(long Id, const ExecutionExitState *OrigExState, Statistics *Stats,
+         ForkServer *Server = nullptr,
+         const ExecutionExitState *Output = nullptr);
+
+  /// \Returns the outcome of this run, to be sent to the main process.
+  RunResult getRunResult() const {
+    return {FaultInjectionStatus, InjectionLatency, RunTime,
+            (unsigned)Injections.size()};
+  }
 
   /// Set injection time provided by user.
   void setUserInjectionTime(long UserInjectionTime);
 
   /// Get a random injection time point.
-  double getRandomInjectionTime();
+  static double getRandomInjectionTime();
+
+  /// Clone the runs from checkpoint \p C. The injection time is then relative
+  /// to the checkpoint's time.
+  void setCheckpoint(const Checkpoint *C) { Ckpt = C; }
+
+  /// Declare the run Masked as soon as it matches a fingerprint of \p C.
+  void setConvergence(const ConvergenceSet *C) { Convergence = C; }
+
+  /// \Returns the time since the start of the child when we should inject.
+  double getInjectionTime();
+
+  /// \Returns the number of instructions after which we should inject.
+  static unsigned long getInjectionInstr();
+
+  /// \Returns -injections-per-run injection points, sorted by time or by
+  /// instruction count.
+  std::vector<InjectionRecord> getInjectionPoints();
+
+  /// \Returns the faults injected into the last run, sorted by time.
+  const std::vector<InjectionRecord> &getInjections() const {
+    return Injections;
+  }
 
   /// Start the child process, inject the faults and wait for completion. When
   /// finished update \p Stats.
@@ -170,19 +451,37 @@ public:
   /// Start the injection threads. This blocks until all threads have joined.
   void launchInjectionThreads();
 
-  /// Sleep for \p SleepTime, then pick a random thread and kill it once we wake
-  /// up. \Return true in \p Ret on success.
-  void sleepAndStopRandomChildThread(double SleepTime, bool *Ret);
+  /// Pick a random thread and stop it. \Returns false if the child is gone.
+  bool stopRandomChildThread();
 
-  /// Wait for \p SleepTime seconds, and stop the child.
-  bool stopChildAfter(double SleepTime);
+  /// Wait until Time of \p Point after the child started, and stop it. Sets
+  /// the Latency of \p Point.
+  bool stopChildAfter(InjectionRecord &Point);
 
-  /// Stop the execution of the child, and inject a fault.
-  bool doBitFlip();
+  /// Wait for the instruction counter to stop the child at StopAtInstr.
+  bool stopChildAtInstr();
 
-  /// Inject a fault by stopping at \p InjectionTime the child and performaing a
+  /// Execute one instruction of ChildPIDToInject. \Returns false if it did
+  /// not stop right after it, e.g., because a signal arrived.
+  bool singleStep();
+
+  /// Check that we can inject to the instruction at \p IP and pick the
+  /// register \p Reg and bit \p Bit to flip. \Returns false if we cannot.
+  bool selectRegAndBit(RegisterManipulator &RM, uint8_t *IP, RegDescr &Reg,
+                       unsigned &Bit);
+
+  /// Inject a fault into the stopped child and record it in \p Point. The
+  /// child is left stopped.
+  bool doBitFlip(InjectionRecord &Point);
+
+  /// Inject a fault by stopping the child at \p Point and performaing a
   /// bit-flip. \Returns true on success.
-  bool tryInjectFaultAt(Statistics &Stats, double InjectionTime);
+  bool tryInjectFaultAt(Statistics &Stats, InjectionRecord &Point);
+
+  /// Inject a fault at each of \p Points in turn. If the child finishes
+  /// before a later point, the run ends with the faults injected so far.
+  /// \Returns false if we should retry the run.
+  bool tryInjectFaults(Statistics &Stats, std::vector<InjectionRecord> &Points);
 
   /// Compares the origingal stdout, stderr and exit status against the new
   /// ones.
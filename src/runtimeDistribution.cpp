@@ -0,0 +1,65 @@
+// The runtime distribution of the workload and the adaptive timeout.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "runtimeDistribution.h"
+#include "optionsList.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+/// The timeout is never set below this, to tolerate scheduling noise.
+static constexpr const double MinTimeout = 0.01;
+
+void RuntimeDistribution::add(double Secs) {
+  if (!Lower.empty() && Secs > Lower.top())
+    Upper.push(Secs);
+  else
+    Lower.push(Secs);
+  // Move runtimes across so that Lower holds the nearest-rank ones.
+  size_t N = size();
+  size_t Rank = (size_t)std::ceil(AdaptiveTimeoutPercentile.getValue() /
+                                  100.0 * N);
+  Rank = std::min(std::max<size_t>(Rank, 1), N);
+  while (Lower.size() > Rank) {
+    Upper.push(Lower.top());
+    Lower.pop();
+  }
+  while (Lower.size() < Rank) {
+    Lower.push(Upper.top());
+    Upper.pop();
+  }
+  Timeout = std::max(MinTimeout,
+                     getPercentile() * (1.0 + AdaptiveTimeoutMargin.getValue()));
+}
+
+double RuntimeDistribution::getPercentile() const {
+  assert(!Lower.empty() && "No runtimes recorded");
+  return Lower.top();
+}
+
+double RuntimeDistribution::getFalseInfExecRisk() const {
+  // If k of the n runtimes exceed the timeout, the next run exceeds it with a
+  // probability of about (k + 1) / (n + 1). Unlike k / n, this does not drop
+  // to zero when none of them did. The timeout is above the percentile, so
+  // they are all in Upper. This is called once per campaign, so popping a
+  // copy is fine.
+  auto Above = Upper;
+  while (!Above.empty() && Above.top() <= Timeout)
+    Above.pop();
+  return (double)(Above.size() + 1) / (size() + 1);
+}
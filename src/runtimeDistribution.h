@@ -0,0 +1,61 @@
+//-*- C++ -*-
+// The runtime distribution of the workload and the adaptive timeout.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __RUNTIMEDISTRIBUTION_H__
+#define __RUNTIMEDISTRIBUTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/// Collects the runtimes of the runs that completed normally and sets the
+/// infinite execution timeout at a high percentile of them plus a margin.
+/// The runtimes are split into two heaps at the percentile, so that adding one
+/// takes O(log n) instead of keeping them all sorted.
+class RuntimeDistribution {
+  /// The runtimes up to and including the percentile, largest on top.
+  std::priority_queue<double> Lower;
+
+  /// The runtimes above the percentile, smallest on top.
+  std::priority_queue<double, std::vector<double>, std::greater<double>>
+      Upper;
+
+  /// The current timeout in seconds.
+  double Timeout = 0.0;
+
+public:
+  /// Record a runtime of \p Secs seconds and update the timeout.
+  void add(double Secs);
+
+  /// \Returns the number of runtimes recorded.
+  size_t size() const { return Lower.size() + Upper.size(); }
+
+  /// \Returns the percentile of -adaptive-timeout-percentile of the runtimes.
+  double getPercentile() const;
+
+  /// \Returns the infinite execution timeout in seconds.
+  double getTimeout() const { return Timeout; }
+
+  /// \Returns the estimated probability that a run that would have completed
+  /// normally exceeds the current timeout and is counted as InfExec.
+  double getFalseInfExecRisk() const;
+};
+
+#endif // __RUNTIMEDISTRIBUTION_H__
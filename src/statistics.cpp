@@ -35,15 +35,11 @@ Statistics::Statistics() {
 }
 
 void Statistics::zero() {
-  for (const auto &S :
-       {Type::Masked, Type::Exception, Type::InfExec, Type::Corrupted,
-        Type::Detected, Type::InjFailed, Type::Skipped})
-    ULongMap[S] = 0;
+  for (std::atomic<unsigned long> &Cnt : Outcomes)
+    Cnt.store(0, std::memory_order_relaxed);
 }
 
 void Statistics::incr(Type S) {
-  std::lock_guard<std::mutex> Lock(Mtx);
-
   switch (S) {
   case Type::Masked:
   case Type::Exception:
@@ -52,7 +48,7 @@ void Statistics::incr(Type S) {
   case Type::Detected:
   case Type::InjFailed:
   case Type::Skipped:
-    ULongMap[S]++;
+    Outcomes[static_cast<unsigned>(S)].fetch_add(1, std::memory_order_relaxed);
     break;
   default:
     die("Bad type");
@@ -64,10 +60,28 @@ void Statistics::incr(Type S) {
   case Type::Skipped:
     break;
   default:
-    TotalInjOK++;
+    TotalInjOK.fetch_add(1, std::memory_order_relaxed);
   }
 
-  GrandTotal++;
+  GrandTotal.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Statistics::addInjectionLatency(double Secs) {
+  std::lock_guard<std::mutex> Lock(Mtx);
+  InjectionLatencySum += Secs;
+  InjectionLatencyCnt++;
+}
+
+void Statistics::addInjections(unsigned Num) {
+  std::lock_guard<std::mutex> Lock(Mtx);
+  InjectionsSum += Num;
+  InjectionsCnt++;
+}
+
+void Statistics::setInfExecTimeout(double Secs, double Risk) {
+  std::lock_guard<std::mutex> Lock(Mtx);
+  InfExecTimeout = Secs;
+  FalseInfExecRisk = Risk;
 }
 
 template <> void Statistics::set<unsigned long>(Type S, unsigned long Val) {
@@ -107,6 +121,7 @@ std::string Statistics::getStr(Type S) {
   case Type::Detected:
   case Type::InjFailed:
   case Type::Skipped:
+    return std::to_string(getCount(S));
   case Type::NumTests:
   case Type::TestRuns:
     return std::to_string(ULongMap.at(S));
@@ -143,16 +158,40 @@ void Statistics::dump() {
     StatsToPrint.push_back(Type::Detected);
 
   // If we skipped, print the skipped ones.
-  if (ULongMap.at(Type::Skipped))
+  if (getCount(Type::Skipped))
     StatsToPrint.push_back(Type::Skipped);
 
   // Iterate and print.
   for (const auto &S : StatsToPrint) {
     std::cout.precision(3);
     std::cout << std::setw(Col0) << std::left << getTypeStr(S) << ": "
-              << std::right << std::setw(Col1) << ULongMap.at(S) << ", "
+              << std::right << std::setw(Col1) << getCount(S) << ", "
               << std::right << std::setw(Col2) << std::right << std::setw(Col3)
-              << (float)(ULongMap.at(S) * 100) / TotalInjOK << "%\n";
+              << (float)(getCount(S) * 100) / TotalInjOK << "%\n";
+  }
+
+  // How late we stopped the child, compared to the injection time.
+  if (InjectionLatencyCnt != 0) {
+    std::cout << "-------------------------------\n";
+    std::cout << std::setw(Col0) << std::left << "Avg. latency"
+              << ": " << InjectionLatencySum * 1000000 / InjectionLatencyCnt
+              << " us\n";
+  }
+
+  // A run may end before all of its injection points.
+  if (InjectionsPerRun.getValue() > 1 && InjectionsCnt != 0) {
+    std::cout << "-------------------------------\n";
+    std::cout << std::setw(Col0) << std::left << "Avg. injections"
+              << ": " << (double)InjectionsSum / InjectionsCnt << "\n";
+  }
+
+  // The adaptive timeout and how likely it is to cut a normal run short.
+  if (InfExecTimeout >= 0.0) {
+    std::cout << "-------------------------------\n";
+    std::cout << std::setw(Col0) << std::left << "InfExec timeout"
+              << ": " << InfExecTimeout << " s\n";
+    std::cout << std::setw(Col0) << std::left << "False InfExec"
+              << ": " << FalseInfExecRisk * 100 << "% (est.)\n";
   }
 }
 
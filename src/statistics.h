@@ -20,6 +20,8 @@
 #ifndef __STATISTICS_H__
 #define __STATISTICS_H__
 
+#include <array>
+#include <atomic>
 #include <map>
 #include <mutex>
 
@@ -79,21 +81,54 @@ class Statistics {
   /// Mutex for thread safety.
   std::mutex Mtx;
 
+  /// The number of outcome counters, which are the Types up to Skipped.
+  static constexpr const unsigned NumOutcomes =
+      static_cast<unsigned>(Type::Skipped) + 1;
+
+  /// The outcome counters, indexed by Type. They are bumped once per run, so
+  /// they are atomics in an array instead of map entries behind Mtx.
+  std::array<std::atomic<unsigned long>, NumOutcomes> Outcomes;
+
+  /// \Returns the counter of outcome \p S.
+  unsigned long getCount(Type S) const {
+    return Outcomes[static_cast<unsigned>(S)].load(std::memory_order_relaxed);
+  }
+
   std::map<Type, unsigned long> ULongMap;
   std::map<Type, std::string> StringMap;
   std::map<Type, double> DoubleMap;
 
   /// Total count of runs where injection did not fail.
-  unsigned long TotalInjOK = 0;
+  std::atomic<unsigned long> TotalInjOK{0};
   /// The grand total of all runs.
-  unsigned long GrandTotal = 0;
+  std::atomic<unsigned long> GrandTotal{0};
+
+  /// The sum and count of the injection latencies, in seconds.
+  double InjectionLatencySum = 0.0;
+  unsigned long InjectionLatencyCnt = 0;
+
+  /// The sum and count of the faults injected per run.
+  unsigned long InjectionsSum = 0;
+  unsigned long InjectionsCnt = 0;
+
+  /// The final adaptive timeout in seconds and its false InfExec risk, or
+  /// negative if not adaptive.
+  double InfExecTimeout = -1.0;
+  double FalseInfExecRisk = 0.0;
 
 public:
   Statistics();
   /// Zero out all counters.
   void zero();
-  /// Increment counter for \p S. Note: this is thread safe.
+  /// Increment counter for \p S. Note: this is thread safe and lock-free.
   void incr(Type S);
+  /// Record the latency \p Secs of stopping the child for an injection.
+  void addInjectionLatency(double Secs);
+  /// Record that \p Num faults were injected into a run.
+  void addInjections(unsigned Num);
+  /// Record the adaptive infinite execution timeout \p Secs and the estimated
+  /// probability \p Risk that a run is wrongly counted as InfExec.
+  void setInfExecTimeout(double Secs, double Risk);
   /// Set statistic \p S to \p Val.
   template <typename T> void set(Type S, T Val);
   /// Get string form of statistic \p S.
@@ -0,0 +1,61 @@
+// A pseudo-terminal that is reused by the runs of a job.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "terminal.h"
+#include "utils.h"
+#include <termios.h>
+#include <utmp.h>
+
+void Terminal::open() {
+  if (openpty(&MasterFd, &SlaveFd, nullptr, nullptr, nullptr) != 0) {
+    perror("openpty()");
+    die("Error: openpty() failed.");
+  }
+  for (int Fd : {MasterFd, SlaveFd})
+    fcntl(Fd, F_SETFD, FD_CLOEXEC);
+}
+
+void Terminal::close() {
+  for (int *Fd : {&MasterFd, &SlaveFd})
+    if (*Fd != -1) {
+      closeSafe(*Fd);
+      *Fd = -1;
+    }
+}
+
+void Terminal::reset() const {
+  if (tcflush(MasterFd, TCIOFLUSH) != 0)
+    die("Failed to flush terminal ", MasterFd);
+}
+
+bool Terminal::attach() const {
+  // This closes our copy of the slave fd, but the caller is a child with its
+  // own fd table.
+  return login_tty(SlaveFd) == 0;
+}
+
+bool detachTerminal() {
+  if (setsid() == -1)
+    return false;
+  int Fd = ::open("/dev/null", O_RDONLY);
+  if (Fd == -1 || dup2(Fd, 0) == -1)
+    return false;
+  if (Fd != 0)
+    ::close(Fd);
+  return true;
+}
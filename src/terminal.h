@@ -0,0 +1,57 @@
+//-*- C++ -*-
+// A pseudo-terminal that is reused by the runs of a job.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __TERMINAL_H__
+#define __TERMINAL_H__
+
+/// A pseudo-terminal pair that is opened once and becomes the controlling
+/// terminal of each run of a job in turn. Opening a new pty for every run
+/// serializes on the kernel's pty lock and runs out of ptys with many jobs.
+class Terminal {
+  /// The master side, which we never read.
+  int MasterFd = -1;
+
+  /// The slave side, which becomes the run's controlling terminal.
+  int SlaveFd = -1;
+
+public:
+  /// Open the pty pair. Neither side is inherited by the workload.
+  void open();
+
+  /// Close the pty pair.
+  void close();
+
+  /// Discard whatever the previous run left in the terminal, so that it does
+  /// not fill up and block a later run that writes to it.
+  void reset() const;
+
+  /// Make the terminal the controlling terminal of the calling process, and
+  /// its stdin, stdout and stderr. This is run by the child after the fork.
+  /// \Returns false on error.
+  bool attach() const;
+
+  int getSlaveFd() const { return SlaveFd; }
+};
+
+/// Start a new session with no controlling terminal, with stdin from
+/// /dev/null. This is run by the child after the fork, for -no-tty.
+/// \Returns false on error.
+bool detachTerminal();
+
+#endif // __TERMINAL_H__
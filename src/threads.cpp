@@ -17,70 +17,221 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "threads.h"
+#include "cpuPlacement.h"
 #include "optionsList.h"
 #include "progressbar.h"
 #include "runner.h"
 #include "statistics.h"
 #include <algorithm>
 
-/// Helper function for incrementing statistics for \p S.
-static void incrStatsCounter(Statistics *Stats, FtStatus S) {
+/// \Returns the statistics counter of status \p S.
+static Type getStatsType(FtStatus S) {
   switch (S) {
   case FtStatus::None:
-    assert(0 && "Unreachable");
     break;
   case FtStatus::Masked:
-    Stats->incr(Type::Masked);
-    break;
+    return Type::Masked;
   case FtStatus::Exception:
-    Stats->incr(Type::Exception);
-    break;
+    return Type::Exception;
   case FtStatus::InfExec:
-    Stats->incr(Type::InfExec);
-    break;
+    return Type::InfExec;
   case FtStatus::Corrupted:
-    Stats->incr(Type::Corrupted);
-    break;
+    return Type::Corrupted;
   case FtStatus::Detected:
-    Stats->incr(Type::Detected);
-    break;
+    return Type::Detected;
   case FtStatus::InjFailed:
-    Stats->incr(Type::InjFailed);
-    break;
+    return Type::InjFailed;
   case FtStatus::Skipped:
-    Stats->incr(Type::Skipped);
-    break;
+    return Type::Skipped;
   }
+  die("Unreachable");
 }
 
-void OrigJobScheduler::jobFinishedParentCode(const JobData &Data) {
+void OrigJobScheduler::jobFinishedParentCode(unsigned Id) {
+  ExecutionExitState ExState;
+  unsigned long InstrCount;
+  double RunTime;
+  readResult(&ExState, sizeof(ExState));
+  readResult(&InstrCount, sizeof(InstrCount));
+  readResult(&RunTime, sizeof(RunTime));
   // The first run sets the OrigExitState to be used by the test runs.
-  if (Data.Id == 0)
-    read(Data.Pipe[0], &OrigExitState, sizeof(OrigExitState));
+  if (Id == 0) {
+    OrigExitState = ExState;
+    OrigInstrCount = InstrCount;
+  }
+  RunTimes.push_back(RunTime);
 }
 
-void TestJobScheduler::jobFinishedParentCode(const JobData &Data) {
-  // Get the fault injection status from child process.
-  FtStatus FaultStatus;
-  read(Data.Pipe[0], &FaultStatus, sizeof(FaultStatus));
-  incrStatsCounter(Stats, FaultStatus);
+void TestJobScheduler::jobFinishedParentCode(unsigned Id) {
+  // Get the fault injection status from the worker.
+  RunResult Result;
+  readResult(&Result, sizeof(Result));
+  // Followed by the records of its faults.
+  std::vector<InjectionRecord> Records(Result.getNumRecords());
+  readResult(Records.data(), Records.size() * sizeof(InjectionRecord));
+  Stats->incr(getStatsType(Result.Status));
+  if (RunsCsv.is_open())
+    writeRunToCsv(Id, Result, Records);
+  if (Result.InjectionLatency >= 0.0)
+    Stats->addInjectionLatency(Result.InjectionLatency);
+  Stats->addInjections(Result.NumInjections);
+  // Runs that were not affected by the fault tell us how long the workload
+  // normally runs for. The next runs get the updated timeout.
+  if (Runtimes != nullptr && Result.Status == FtStatus::Masked &&
+      Result.RunTime >= 0.0)
+    Runtimes->add(Result.RunTime);
 }
 
-void JobSchedulerBase::waitForJob() {
+void TestJobScheduler::openRunsCsv() {
+  RunsCsv.open(OutRunsCsvFile.getValue(), std::fstream::out);
+  if ((RunsCsv.rdstate() & std::fstream::failbit) != 0)
+    userDie("Error opening file ", OutRunsCsvFile.getValue());
+  RunsCsv << "Run, Outcome, RunTime, Injections, Fault, "
+          << (InjectByInstrCount.getValue() ? "Instr" : "Time")
+          << ", Tid, IP, Reg, Bit\n";
+}
+
+void TestJobScheduler::writeRunToCsv(
+    unsigned Id, const RunResult &Result,
+    const std::vector<InjectionRecord> &Records) {
+  const char *Delim = ", ";
+  auto WriteRun = [&]() {
+    RunsCsv << Id << Delim << getTypeStr(getStatsType(Result.Status))
+            << Delim << Result.RunTime << Delim << Result.NumInjections;
+  };
+  // The runs that we failed to inject to have no fault to show.
+  if (Records.empty()) {
+    WriteRun();
+    RunsCsv << ", , , , , , \n";
+    return;
+  }
+  // One line per fault.
+  for (size_t Idx = 0; Idx != Records.size(); ++Idx) {
+    const InjectionRecord &Inj = Records[Idx];
+    WriteRun();
+    RunsCsv << Delim << Idx << Delim;
+    if (InjectByInstrCount.getValue())
+      RunsCsv << Inj.Instr;
+    else
+      RunsCsv << Inj.Time;
+    RunsCsv << Delim << Inj.Tid << Delim << "0x" << std::hex << Inj.IP
+            << std::dec << Delim << Inj.Reg.getName() << Delim << Inj.Bit
+            << "\n";
+  }
+}
+
+void JobSchedulerBase::writeResult(const void *Buf, size_t Size) {
+  assert(JobResult != nullptr && "Not in a worker");
+  if (JobResult->Size + Size > WorkResult::MaxSize)
+    die("The result of run ", JobResult->Id, " does not fit in ",
+        WorkResult::MaxSize, " bytes.");
+  memcpy(JobResult->Data + JobResult->Size, Buf, Size);
+  JobResult->Size += Size;
+}
+
+void JobSchedulerBase::readResult(void *Buf, size_t Size) {
+  assert(FinishedResult != nullptr && "No result");
+  if (FinishedResultOffset + Size > FinishedResult->Size)
+    die("The result of run ", FinishedResult->Id, " is too short.");
+  memcpy(Buf, FinishedResult->Data + FinishedResultOffset, Size);
+  FinishedResultOffset += Size;
+}
+
+void JobSchedulerBase::reapChildren() {
   int Status;
-  pid_t Pid = waitpid(-1, &Status, 0);
-  auto State = Runner::getWaitPidExitState(Status);
-  assert(WIFEXITED(Status) && "Expected child to have exited.");
-  auto HasPid = [&](const JobData &Data) { return Data.ChildPID == Pid; };
-  auto it = std::find_if(ActiveJobs.begin(), ActiveJobs.end(), HasPid);
-  assert(it != ActiveJobs.end() && "Pid not found in Active Jobs!");
-  int ChildPipe[2] = {it->Pipe[0], it->Pipe[1]};
+  pid_t Pid;
+  // Clones of the fork server are our children too, and so are the workers.
+  while ((Pid = waitpid(-1, &Status, WNOHANG)) > 0)
+    if (std::find(Workers.begin(), Workers.end(), Pid) != Workers.end())
+      die("Worker ", Pid, " exited unexpectedly.");
+}
 
-  jobFinishedParentCode(*it);
+void JobSchedulerBase::waitForJob() {
+  WorkResult Result;
+  // Wake up now and then to reap the clones of the fork servers and to check
+  // that no worker has died.
+  while (!Queue->popResult(Result, 0.1))
+    reapChildren();
+  reapChildren();
+  FinishedResult = &Result;
+  FinishedResultOffset = 0;
+  jobFinishedParentCode(Result.Id);
+  FinishedResult = nullptr;
+}
 
-  // Cleanup
-  close(ChildPipe[0]);
-  ActiveJobs.erase(it);
+void JobSchedulerBase::workerCode(unsigned Worker, pid_t HandoverPID) {
+  // Pin the worker before it touches its memory, so that it gets allocated
+  // on its NUMA node.
+  CpuPlacement &Placement = CpuPlacement::get();
+  Placement.pinWorker(Worker);
+  ForkServer ServerClone;
+  if (HandoverPID != 0) {
+    ServerClone.adopt(HandoverPID, Server->getAddressSpace());
+    // Its clones inherit the CPUs of the workload.
+    Placement.pinTracee(HandoverPID);
+  }
+  JobOutput = !OutputSlots.empty() ? &OutputSlots[Worker] : nullptr;
+  JobTerminal = !TerminalSlots.empty() ? &TerminalSlots[Worker] : nullptr;
+  WorkResult Result;
+  JobResult = &Result;
+  while (true) {
+    WorkRequest Req;
+    Queue->popRequest(Req);
+    if (Req.Id < 0)
+      break;
+    Dbg(2) << "-------------------------\n";
+    dbg(2) << "Job " << Req.Id << " begin on worker " << Worker << "\n";
+    Dbg(2) << "-------------------------\n";
+    // Initialize the rand() seed for this run with a random value.
+    setRandSeed(Req.Seed);
+    JobCheckpointIdx = Req.CheckpointIdx;
+    JobInfExecTimeout = Req.InfExecTimeout;
+    // Only the tracer of the server can clone it, so the runs from a
+    // checkpoint come with a clone of its server.
+    ForkServer CkptClone;
+    if (Req.HandoverPID != 0) {
+      CkptClone.adopt(Req.HandoverPID,
+                      getCheckpointServer(Req.CheckpointIdx)->getAddressSpace());
+      Placement.pinTracee(Req.HandoverPID);
+      JobServer = &CkptClone;
+    } else {
+      JobServer = ServerClone.isRunning() ? &ServerClone : nullptr;
+    }
+    Result.Id = Req.Id;
+    Result.Size = 0;
+    childJobCode(Req.Id);
+    JobServer = nullptr;
+    Queue->pushResult(Worker, Result);
+  }
+  JobResult = nullptr;
+  JobOutput = nullptr;
+  JobTerminal = nullptr;
+}
+
+void JobSchedulerBase::startWorkers() {
+  for (unsigned Worker = 0; Worker != NumSlots; ++Worker) {
+    // Only the tracer of the server can clone it, so hand over a clone of our
+    // server to the worker.
+    pid_t HandoverPID = Server != nullptr ? Server->cloneForHandover() : 0;
+    pid_t WorkerPID = forkSafe();
+    if (WorkerPID == 0) {
+      workerCode(Worker, HandoverPID);
+      exit(0);
+    }
+    Workers.push_back(WorkerPID);
+  }
+}
+
+void JobSchedulerBase::stopWorkers() {
+  for (size_t Cnt = 0; Cnt != Workers.size(); ++Cnt)
+    Queue->pushRequest(WorkRequest());
+  for (pid_t Worker : Workers) {
+    int Status;
+    if (waitpid(Worker, &Status, 0) != Worker || !WIFEXITED(Status))
+      die("Worker ", Worker, " did not exit cleanly.");
+  }
+  Workers.clear();
+  reapChildren();
 }
 
 void JobSchedulerBase::run(unsigned long TotalNumJobs) {
@@ -89,78 +240,120 @@ void JobSchedulerBase::run(unsigned long TotalNumJobs) {
   bool ShowingBar = VerboseLevel.getValue() == 1 && !NoProgressBar.getValue();
   if (ShowingBar)
     Bar.init();
+  if (TotalNumJobs == 0) {
+    if (ShowingBar)
+      Bar.finalize();
+    return;
+  }
 
+  // Create the output files of the workers once, instead of once per run.
+  NumSlots = std::min<unsigned long>(Jobs.getValue(), TotalNumJobs);
+  if (ExecutionExitState::useMemFiles() && !NoRedirect.getValue()) {
+    OutputSlots.resize(NumSlots);
+    for (size_t Slot = 0; Slot != OutputSlots.size(); ++Slot)
+      OutputSlots[Slot].initFiles(Slot);
+  }
+  // Likewise for the terminals, unless the runs are clones of the fork server,
+  // which share its terminal.
+  if (!NoRedirect.getValue() && !NoTty.getValue() && Server == nullptr) {
+    TerminalSlots.resize(NumSlots);
+    for (Terminal &Term : TerminalSlots)
+      Term.open();
+  }
+
+  Queue.reset(new WorkQueue(NumSlots, NumSlots));
+  startWorkers();
+  unsigned long Pending = 0;
   for (unsigned Id = 0; Id != TotalNumJobs; ++Id) {
-    // Block until we can spawn a new process.
-    while (ActiveJobs.size() == Jobs.getValue()) {
+    // Block until a worker is free.
+    while (Pending == NumSlots) {
       waitForJob();
+      --Pending;
       // Update the progress bar. Don't display it for Verbose > 1 as it will
       // mess up the dumps.
       if (ShowingBar)
         Bar.display(++BarCnt);
     }
-    Dbg(2) << "-------------------------\n";
-    dbg(2) << "Job " << Id << " begin\n";
-    Dbg(2) << "-------------------------\n";
-
-    // Set up a pipe for communication from child to parent.
-    pipeSafe(Pipe);
-    ActiveJobs.push_back(JobData(Id, Pipe));
-
-    // Get a random seed for the child process.
-    unsigned SeedForChild = randSafe();
-
-    // Launch thread and insert the ThreadLauncher into the set.
-    pid_t ChildJobPID = forkSafe();
-    if (ChildJobPID == 0) {
-      // Child process
-      close(Pipe[0]);
-
-      // Initialize the rand() seed for this process with a random value.
-      setRandSeed(SeedForChild);
-
-      childJobCode(Id);
-
-      close(Pipe[1]);
-      exit(0);
-    } else if (ChildJobPID > 0) {
-      // Parent process.
-      close(Pipe[1]);
-      parentJobCode(Id);
-
-      ActiveJobs.back().ChildPID = ChildJobPID;
-    } else
-      die("Job fork() failed");
+    WorkRequest Req;
+    Req.Id = Id;
+    // Get a random seed for the run.
+    Req.Seed = randSafe();
+    Req.CheckpointIdx = pickJobCheckpoint();
+    if (Req.CheckpointIdx >= 0)
+      Req.HandoverPID =
+          getCheckpointServer(Req.CheckpointIdx)->cloneForHandover();
+    Req.InfExecTimeout = getJobInfExecTimeout();
+    parentJobCode(Id);
+    Queue->pushRequest(Req);
+    ++Pending;
   }
-  // Busy loop until all threads have joined.
-  while (ActiveJobs.size() > 0) {
+  // Wait for the remaining runs.
+  for (; Pending != 0; --Pending) {
     waitForJob();
     if (ShowingBar)
       Bar.display(++BarCnt);
   }
+  stopWorkers();
+  Queue.reset();
+  for (ExecutionExitState &Output : OutputSlots)
+    Output.closeFiles();
+  OutputSlots.clear();
+  for (Terminal &Term : TerminalSlots)
+    Term.close();
+  TerminalSlots.clear();
   if (ShowingBar)
     Bar.finalize();
 }
 
 void OrigJobScheduler::childJobCode(unsigned Id) {
-  // Child process.
-  OrigRunner OR(Id, NoCleanup);
+  // The first run writes the golden output, see getOrigExitState().
+  const ExecutionExitState *Output =
+      Id == 0 && Golden != nullptr ? Golden : JobOutput;
+  OrigRunner OR(Id, NoCleanup, JobServer, Output);
+  OR.setTerminal(JobTerminal);
   OR.runAndWait();
-  // Send exit state to parent process.
+  // Send exit state to the main process.
   auto ExState = OR.getExecutionExitState();
-  write(Pipe[1], &ExState, sizeof(ExState));
+  writeResult(&ExState, sizeof(ExState));
+  unsigned long InstrCount = OR.getInstrCount();
+  writeResult(&InstrCount, sizeof(InstrCount));
+  double RunTime = OR.getRunTime();
+  writeResult(&RunTime, sizeof(RunTime));
 }
 
 void OrigJobScheduler::parentJobCode(unsigned Id) {
 }
 
 void TestJobScheduler::childJobCode(unsigned Id) {
-  Runner TR(Id, OrigExState, Stats);
+  Runner TR(Id, OrigExState, Stats, JobServer, JobOutput);
+  TR.setTerminal(JobTerminal);
+  TR.setCheckpoint(JobCheckpointIdx >= 0 ? &Checkpoints->get(JobCheckpointIdx)
+                                         : nullptr);
+  TR.setConvergence(Convergence);
+  if (JobInfExecTimeout >= 0.0)
+    TR.setInfExecTimeout(JobInfExecTimeout);
   TR.runAndWait();
-  // Send this run's fault injection status to parent.
-  auto FaultStatus = TR.getFtStatus();
-  write(Pipe[1], &FaultStatus, sizeof(FaultStatus));
+  // Send this run's fault injection status to the main process.
+  RunResult Result = TR.getRunResult();
+  writeResult(&Result, sizeof(Result));
+  const std::vector<InjectionRecord> &Injections = TR.getInjections();
+  writeResult(Injections.data(),
+              Result.getNumRecords() * sizeof(InjectionRecord));
 }
 
 void TestJobScheduler::parentJobCode(unsigned Id) {
 }
+
+int TestJobScheduler::pickJobCheckpoint() {
+  if (Checkpoints == nullptr || Checkpoints->empty())
+    return -1;
+  return Checkpoints->pickRandom();
+}
+
+ForkServer *TestJobScheduler::getCheckpointServer(int Idx) {
+  return &Checkpoints->get(Idx).Server;
+}
+
+double TestJobScheduler::getJobInfExecTimeout() {
+  return Runtimes != nullptr ? Runtimes->getTimeout() : -1.0;
+}
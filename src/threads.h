@@ -20,53 +20,125 @@
 #ifndef __THREADS_H__
 #define __THREADS_H__
 
+#include "checkpoint.h"
+#include "convergence.h"
+#include "forkServer.h"
 #include "options.h"
+#include "optionsList.h"
 #include "runner.h"
+#include "runtimeDistribution.h"
 #include "statistics.h"
-#include <thread>
-#include <set>
-
-/// Data for tracking the active jobs.
-struct JobData {
-  pid_t ChildPID = 0;
-  int Id = -1;
-  int Pipe[2] = {0, 0};
-  JobData(int Id, int Pipe2[2]) : Id(Id) {
-    Pipe[0] = Pipe2[0];
-    Pipe[1] = Pipe2[1];
-  }
-};
-
-/// Base class for scheduler classes.
+#include "terminal.h"
+#include "workQueue.h"
+#include <fstream>
+#include <memory>
+#include <vector>
+
+/// Base class for scheduler classes. The runs are done by a pool of worker
+/// processes, one per parallel job, which are forked once and get the runs
+/// from a WorkQueue. A worker keeps its state, like its clone of the fork
+/// server and its caches, across the runs.
 class JobSchedulerBase {
 protected:
-  /// ActiveJobs and their communication pipe.
-  std::vector<JobData> ActiveJobs;
+  /// The runs to the workers and their results back.
+  std::unique_ptr<WorkQueue> Queue;
+
+  /// The PIDs of the workers.
+  std::vector<pid_t> Workers;
+
+  /// The result of the run of the worker, valid within childJobCode() only.
+  WorkResult *JobResult = nullptr;
+
+  /// The result being read, valid within jobFinishedParentCode() only.
+  const WorkResult *FinishedResult = nullptr;
+
+  /// The offset in FinishedResult of the next readResult().
+  size_t FinishedResultOffset = 0;
+
+  /// Append \p Size bytes at \p Buf to the result of the run. Call this from
+  /// childJobCode().
+  void writeResult(const void *Buf, size_t Size);
+
+  /// Read the next \p Size bytes of the result of the run into \p Buf, in
+  /// the order they were written. Call this from jobFinishedParentCode().
+  void readResult(void *Buf, size_t Size);
+
+  /// The main process' fork server, if any. Each worker gets its own clone of
+  /// it.
+  ForkServer *Server = nullptr;
+
+  /// The job's own fork server, valid within childJobCode() only.
+  ForkServer *JobServer = nullptr;
+
+  /// The checkpoint of the run, valid within childJobCode() only, or -1.
+  int JobCheckpointIdx = -1;
+
+  /// The infinite execution timeout of the run, valid within childJobCode()
+  /// only, or negative for the default.
+  double JobInfExecTimeout = -1.0;
+
+  /// In-memory stdout/stderr files, one set per worker. A worker truncates
+  /// them before each run.
+  std::vector<ExecutionExitState> OutputSlots;
+
+  /// The job's output files, valid within childJobCode() only. If null the
+  /// job creates its own.
+  const ExecutionExitState *JobOutput = nullptr;
+
+  /// Pseudo-terminals, one per worker, reused like the output files.
+  std::vector<Terminal> TerminalSlots;
+
+  /// The job's terminal, valid within childJobCode() only. If null each run
+  /// opens its own.
+  const Terminal *JobTerminal = nullptr;
+
+  /// The number of workers, which is also the number of slots of output
+  /// files and terminals.
+  unsigned long NumSlots = 0;
+
+  /// Fork the workers.
+  void startWorkers();
 
-  /// Check if any of the active threads can join and if so remove it from the
-  /// active set. \Returns the number of threads joined.
-  unsigned tryJoinActiveThreads();
+  /// Make the workers exit and wait for them.
+  void stopWorkers();
 
-  /// Communication pipe from child to parent.
-  int Pipe[2];
+  /// The loop of worker \p Worker, which adopts \p HandoverPID, if not 0, as
+  /// its fork server.
+  void workerCode(unsigned Worker, pid_t HandoverPID);
 
-  /// Wait for a job to finish and cleanup.
+  /// Reap our children that have exited, which are the clones of the fork
+  /// servers. Dies if a worker has exited.
+  void reapChildren();
+
+  /// Wait for a run to finish and process its result.
   void waitForJob();
 
-  /// The code run right after the fork.
+  /// The code run by a worker for run \p Id.
   virtual void childJobCode(unsigned Id) = 0;
 
   /// The code run by the parent.
   virtual void parentJobCode(unsigned Id) = 0;
 
-  /// Parent code once job has finished.
-  virtual void jobFinishedParentCode(const JobData &Data) = 0;
+  /// Parent code once run \p Id has finished.
+  virtual void jobFinishedParentCode(unsigned Id) = 0;
+
+  /// \Returns the checkpoint that the next run will clone from, or -1 to
+  /// clone from Server.
+  virtual int pickJobCheckpoint() { return -1; }
+
+  /// \Returns the server of the checkpoint with the given index.
+  virtual ForkServer *getCheckpointServer(int) { return nullptr; }
+
+  /// \Returns the infinite execution timeout of the next run, or negative for
+  /// the default.
+  virtual double getJobInfExecTimeout() { return -1.0; }
 
 public:
-  JobSchedulerBase() = default;
+  JobSchedulerBase(ForkServer *Server = nullptr) : Server(Server) {}
+  virtual ~JobSchedulerBase() = default;
 
-  /// Launch \p TotalNumThreads threads.
-  void run(unsigned long TotalNumThreads);
+  /// Do \p TotalNumJobs runs.
+  void run(unsigned long TotalNumJobs);
 };
 
 /// Scheduler for the original runs.
@@ -74,19 +146,37 @@ class OrigJobScheduler : public JobSchedulerBase {
   /// The exit state of the original run.
   ExecutionExitState OrigExitState;
 
-  /// The child code run right after the fork.
-  void childJobCode(unsigned Id);
+  /// The instructions executed by the original run.
+  unsigned long OrigInstrCount = 0;
+
+  /// The files that the first run writes its output to, if any.
+  const ExecutionExitState *Golden = nullptr;
 
-  /// The parent code run after the fork.
-  void parentJobCode(unsigned Id);
+  /// The runtimes of the original runs in seconds.
+  std::vector<double> RunTimes;
 
-  void jobFinishedParentCode(const JobData &Data);
+  /// The code run by a worker for each run.
+  void childJobCode(unsigned Id) override;
+
+  /// The parent code run when the run is queued.
+  void parentJobCode(unsigned Id) override;
+
+  void jobFinishedParentCode(unsigned Id) override;
 
 public:
-  OrigJobScheduler() = default;
+  /// The first run writes its output to the files of \p Golden, if set.
+  OrigJobScheduler(ForkServer *Server = nullptr,
+                   const ExecutionExitState *Golden = nullptr)
+      : JobSchedulerBase(Server), Golden(Golden) {}
 
   /// \Returns the exit state of the original run.
   const ExecutionExitState &getOrigExitState() const { return OrigExitState; }
+
+  /// \Returns the instruction count of the original run.
+  unsigned long getOrigInstrCount() const { return OrigInstrCount; }
+
+  /// \Returns the runtimes of the original runs in seconds.
+  const std::vector<double> &getRunTimes() const { return RunTimes; }
 };
 
 /// Scheduler for test runs.
@@ -96,17 +186,54 @@ class TestJobScheduler : public JobSchedulerBase {
   /// Statistics.
   Statistics *Stats = nullptr;
 
-  /// The child code run right after the fork.
-  void childJobCode(unsigned Id);
+  /// The checkpoints of the golden run, if any.
+  CheckpointSet *Checkpoints = nullptr;
+
+  /// The fingerprints of the golden run, if any.
+  const ConvergenceSet *Convergence = nullptr;
 
-  /// The parent code run after the fork.
-  void parentJobCode(unsigned Id);
+  /// The runtime distribution that sets the timeout, with -adaptive-timeout.
+  RuntimeDistribution *Runtimes = nullptr;
 
-  void jobFinishedParentCode(const JobData &Data);
+  /// The file of -out-runs-csv, if set.
+  std::fstream RunsCsv;
+
+  /// Create the file of -out-runs-csv and write its header.
+  void openRunsCsv();
+
+  /// Append the outcome \p Result of run \p Id to RunsCsv, with a line for
+  /// each of its faults in \p Records.
+  void writeRunToCsv(unsigned Id, const RunResult &Result,
+                     const std::vector<InjectionRecord> &Records);
+
+  /// The code run by a worker for each run.
+  void childJobCode(unsigned Id) override;
+
+  /// The parent code run when the run is queued.
+  void parentJobCode(unsigned Id) override;
+
+  void jobFinishedParentCode(unsigned Id) override;
+
+  /// Picks a random checkpoint, if we have any.
+  int pickJobCheckpoint() override;
+
+  ForkServer *getCheckpointServer(int Idx) override;
+
+  /// The timeout of -adaptive-timeout, updated by the runs so far.
+  double getJobInfExecTimeout() override;
 
 public:
-  TestJobScheduler(const ExecutionExitState *OrigExState, Statistics *Stats)
-      : OrigExState(OrigExState), Stats(Stats) {}
+  TestJobScheduler(const ExecutionExitState *OrigExState, Statistics *Stats,
+                   ForkServer *Server = nullptr,
+                   CheckpointSet *Checkpoints = nullptr,
+                   const ConvergenceSet *Convergence = nullptr,
+                   RuntimeDistribution *Runtimes = nullptr)
+      : JobSchedulerBase(Server), OrigExState(OrigExState), Stats(Stats),
+        Checkpoints(Checkpoints), Convergence(Convergence),
+        Runtimes(Runtimes) {
+    if (OutRunsCsvFile.isSet())
+      openRunsCsv();
+  }
 };
 
 #endif //__THREADS_H__
@@ -22,17 +22,21 @@
 
 #include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <execinfo.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <iomanip>
 #include <iostream>
 #include <pty.h>
 #include <signal.h>
 #include <string>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -119,6 +123,32 @@ static inline void strReplace(std::string &Str, const std::string &From,
   }
 }
 
+/// Splits the comma-separated list \p List, skipping empty entries.
+static inline std::vector<std::string> splitList(const std::string &List) {
+  std::vector<std::string> Entries;
+  size_t Start = 0;
+  while (Start <= List.size()) {
+    size_t End = List.find(',', Start);
+    if (End == std::string::npos)
+      End = List.size();
+    if (End != Start)
+      Entries.push_back(List.substr(Start, End - Start));
+    Start = End + 1;
+  }
+  return Entries;
+}
+
+/// \Returns true if \p Name matches any of the glob patterns in \p Patterns.
+/// A pattern that is equal to \p Name matches too, even if it is not a valid
+/// glob of it, like "[vdso]", which fnmatch() reads as a bracket expression.
+static inline bool matchesAny(const std::vector<std::string> &Patterns,
+                              const std::string &Name) {
+  for (const std::string &Pattern : Patterns)
+    if (Pattern == Name || fnmatch(Pattern.c_str(), Name.c_str(), 0) == 0)
+      return true;
+  return false;
+}
+
 /// Safe mkstemp().
 static inline int mkstempSafe(char *File) {
   int Fd = mkstemp(File);
@@ -129,16 +159,36 @@ static inline int mkstempSafe(char *File) {
   return Fd;
 }
 
-/// A safe alarm() that can handle arbitrarily large inputs.
+/// Safe memfd_create(). The file can be sealed with F_ADD_SEALS.
+static inline int memfdCreateSafe(const char *Name) {
+  int Fd = memfd_create(Name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (Fd == -1) {
+    perror("memfd_create()");
+    die("failed to create ", Name);
+  }
+  return Fd;
+}
+
+/// \Returns a one-shot timer value that expires after \p Secs seconds.
+static inline struct itimerval getITimerVal(double Secs) {
+  struct itimerval Timer = {};
+  Timer.it_value.tv_sec = (time_t)Secs;
+  Timer.it_value.tv_usec =
+      (suseconds_t)((Secs - Timer.it_value.tv_sec) * 1000000);
+  // A zero value would disarm the timer.
+  if (Timer.it_value.tv_sec == 0 && Timer.it_value.tv_usec == 0)
+    Timer.it_value.tv_usec = 1;
+  return Timer;
+}
+
+/// A safe alarm() that can handle arbitrarily large inputs with microsecond
+/// precision.
 static inline void alarmSafe(double Secs) {
-  // usecs() can only handle [0, 1000000]
-  if (Secs <= 1) {
-    unsigned long Usecs = (unsigned long)(Secs * 1000000);
-    ualarm(Usecs, 0);
+  struct itimerval Timer = getITimerVal(Secs);
+  if (setitimer(ITIMER_REAL, &Timer, nullptr) != 0) {
+    perror("setitimer()");
+    die("setitimer() failed");
   }
-  // It is safe for alarm() to go off after Secs, so using ceil() is fine here.
-  else
-    alarm(std::ceil(Secs));
 }
 
 /// Safe ptrace() wrapper that will die() if ptrace() fails.
@@ -222,35 +272,50 @@ static inline void removeSafe(const char *File) {
   }
 }
 
+/// \Returns the size of the file \p Fd in bytes.
+static inline size_t fileSizeSafe(int Fd) {
+  struct stat Stat;
+  if (fstat(Fd, &Stat) != 0) {
+    perror("fstat()");
+    die("Failed to stat fd ", Fd);
+  }
+  return Stat.st_size;
+}
+
+/// Maps the first \p Size bytes of the file \p Fd read-only. Unlike read(),
+/// this does not depend on the file offset, which the writer may still use.
+static inline const char *mmapFileSafe(int Fd, size_t Size) {
+  void *Addr = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  if (Addr == MAP_FAILED) {
+    perror("mmap()");
+    die("Failed to map fd ", Fd);
+  }
+  return static_cast<const char *>(Addr);
+}
+
+/// Safe munmap() wrapper for the mappings of mmapFileSafe().
+static inline void munmapSafe(const char *Addr, size_t Size) {
+  if (munmap(const_cast<char *>(Addr), Size) != 0) {
+    perror("munmap()");
+    die("Failed to unmap ", (const void *)Addr);
+  }
+}
+
 /// Compares the contents of the file descriptors \p Fd1 and \p Fd2. \Returns
 /// true if equal.
 static inline bool defaultDiff(int Fd1, int Fd2) {
-  bool Diff = false;
-  FILE *Fp1 = fdopen(Fd1, "r");
-  if (!Fp1) {
-    perror("fdopen");
-    die("Failed to open Fd1 ", Fd1);
-  }
-  rewind(Fp1);
-  FILE *Fp2 = fdopen(Fd2, "r");
-  if (!Fp2) {
-    perror("fdopen");
-    die("Failed to open Fd2 ", Fd2);
-  }
-  rewind(Fp2);
-  int N = 256;
-  char Buf1[N], Buf2[N];
-  do {
-    size_t Sz1 = fread((void *)Buf1, 1, N, Fp1);
-    size_t Sz2 = fread((void *)Buf2, 1, N, Fp2);
-    // If either the size differs, or the contents differ we found a difference.
-    if (Sz1 != Sz2 || memcmp(Buf1, Buf2, Sz1)) {
-      Diff = true;
-      break;
-    }
-  } while (!feof(Fp1) || !feof(Fp2));
-  // Returns true if no difference found.
-  return !Diff;
+  size_t Size = fileSizeSafe(Fd1);
+  if (Size != fileSizeSafe(Fd2))
+    return false;
+  // mmap() rejects empty mappings.
+  if (Size == 0)
+    return true;
+  const char *Buf1 = mmapFileSafe(Fd1, Size);
+  const char *Buf2 = mmapFileSafe(Fd2, Size);
+  bool Same = memcmp(Buf1, Buf2, Size) == 0;
+  munmapSafe(Buf1, Size);
+  munmapSafe(Buf2, Size);
+  return Same;
 }
 
 /// \Returns true if \p File exists.
@@ -313,6 +378,36 @@ static inline double getTimeDiff(TimePoint T1, TimePoint T2) {
   return (double)std::chrono::duration<double>(T2 - T1).count();
 }
 
+/// A time point of the monotonic clock (CLOCK_MONOTONIC).
+using MonoTimePoint = std::chrono::steady_clock::time_point;
+
+/// \Returns the current time of the monotonic clock.
+static inline MonoTimePoint getMonoTime() {
+  return std::chrono::steady_clock::now();
+}
+
+/// \Returns the time difference \p T2 - \p T1 in secs.
+static inline double getMonoTimeDiff(MonoTimePoint T1, MonoTimePoint T2) {
+  return (double)std::chrono::duration<double>(T2 - T1).count();
+}
+
+/// \Returns \p T plus \p Secs seconds, at nanosecond resolution.
+static inline MonoTimePoint addSecs(MonoTimePoint T, double Secs) {
+  return T + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::duration<double>(Secs));
+}
+
+/// \Returns \p T as an absolute CLOCK_MONOTONIC timespec.
+static inline struct timespec toTimespec(MonoTimePoint T) {
+  auto NSecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   T.time_since_epoch())
+                   .count();
+  struct timespec TS;
+  TS.tv_sec = NSecs / 1000000000;
+  TS.tv_nsec = NSecs % 1000000000;
+  return TS;
+}
+
 /// \Returns true if \p Needle is found in \p Haystack.
 static inline bool isIn(const std::string &Haystack,
                         const std::string &Needle) {
@@ -362,6 +457,38 @@ static inline unsigned long getTimestamp() {
       .count() % 65536;
 }
 
+/// The murmur3 finalizer, which makes every bit of \p H affect every bit of
+/// the result.
+static inline uint64_t fmix64(uint64_t H) {
+  H ^= H >> 33;
+  H *= 0xff51afd7ed558ccdull;
+  H ^= H >> 33;
+  H *= 0xc4ceb9fe1a85ec53ull;
+  H ^= H >> 33;
+  return H;
+}
+
+/// Mix \p Size bytes of \p Data into \p Hash, one word at a time. Each word
+/// goes through fmix64(), since with a plain multiply a flip of the top bit
+/// never reaches the lower bits and two such flips cancel out. \Returns the
+/// new hash.
+static inline uint64_t hashBytes(const void *Data, size_t Size,
+                                 uint64_t Hash = 14695981039346656037ull) {
+  const uint8_t *Bytes = (const uint8_t *)Data;
+  size_t Off = 0;
+  for (; Off + sizeof(uint64_t) <= Size; Off += sizeof(uint64_t)) {
+    uint64_t Word;
+    memcpy(&Word, Bytes + Off, sizeof(Word));
+    Hash = fmix64(Hash ^ Word);
+  }
+  if (Off != Size) {
+    uint64_t Tail = 0;
+    memcpy(&Tail, Bytes + Off, Size - Off);
+    Hash = fmix64(Hash ^ Tail);
+  }
+  return Hash;
+}
+
 /// Cleanup state changes by popping all of them.
 static inline void cleanupWaitpidState(pid_t PID) {
   int TmpStatus;
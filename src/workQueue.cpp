@@ -0,0 +1,140 @@
+// The queues between the main process and its worker processes.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#include "workQueue.h"
+#include "utils.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sched.h>
+
+WorkQueue::WorkQueue(unsigned Capacity, unsigned NumWorkers)
+    : Capacity(Capacity), NumWorkers(NumWorkers) {
+  assert(Capacity != 0 && NumWorkers != 0 && "Empty queue");
+  MemSize = sizeof(Shared) + Capacity * sizeof(RequestSlot) +
+            alignof(ResultRing) + NumWorkers * sizeof(ResultRing) +
+            NumWorkers * Capacity * sizeof(WorkResult);
+  // The mapping is zero-filled, so the indexes start at 0. Only the pages of
+  // the results that are used get allocated.
+  Mem = mmap(nullptr, MemSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (Mem == MAP_FAILED) {
+    perror("mmap()");
+    die("Failed to map the work queue.");
+  }
+  Sh = static_cast<Shared *>(Mem);
+  Requests = reinterpret_cast<RequestSlot *>(Sh + 1);
+  for (unsigned Idx = 0; Idx != Capacity; ++Idx)
+    Requests[Idx].Seq.store(Idx, std::memory_order_relaxed);
+  // Keep the rings aligned to their cache lines.
+  uintptr_t RingsAddr = reinterpret_cast<uintptr_t>(Requests + Capacity);
+  RingsAddr = (RingsAddr + alignof(ResultRing) - 1) & ~(alignof(ResultRing) - 1);
+  Rings = reinterpret_cast<ResultRing *>(RingsAddr);
+  Results = reinterpret_cast<WorkResult *>(Rings + NumWorkers);
+  assert((char *)(Results + NumWorkers * Capacity) <= (char *)Mem + MemSize &&
+         "Mapping too small");
+  if (sem_init(&Sh->NumRequests, /*pshared=*/1, 0) != 0 ||
+      sem_init(&Sh->NumResults, /*pshared=*/1, 0) != 0)
+    die("sem_init() failed.");
+}
+
+WorkQueue::~WorkQueue() {
+  sem_destroy(&Sh->NumRequests);
+  sem_destroy(&Sh->NumResults);
+  munmap(Mem, MemSize);
+}
+
+/// sem_wait() that retries when interrupted by a signal.
+static void semWaitSafe(sem_t *Sem) {
+  while (sem_wait(Sem) != 0)
+    if (errno != EINTR)
+      die("sem_wait() failed.");
+}
+
+void WorkQueue::pushRequest(const WorkRequest &Req) {
+  RequestSlot &Slot = Requests[RequestTail % Capacity];
+  // There are fewer than Capacity runs pending, but the worker that claimed
+  // the previous request of this slot may not have copied it out yet.
+  while (Slot.Seq.load(std::memory_order_acquire) != RequestTail)
+    sched_yield();
+  Slot.Req = Req;
+  Slot.Seq.store(RequestTail + 1, std::memory_order_release);
+  ++RequestTail;
+  // The post wakes up a worker to claim the next request.
+  sem_post(&Sh->NumRequests);
+}
+
+void WorkQueue::popRequest(WorkRequest &Req) {
+  semWaitSafe(&Sh->NumRequests);
+  // Each successful wait matches a posted request, so the one that we claim
+  // has been written. The acquire load makes sure that we see all of it.
+  uint64_t Head = Sh->RequestHead.fetch_add(1);
+  RequestSlot &Slot = Requests[Head % Capacity];
+  while (Slot.Seq.load(std::memory_order_acquire) != Head + 1)
+    sched_yield();
+  Req = Slot.Req;
+  Slot.Seq.store(Head + Capacity, std::memory_order_release);
+}
+
+void WorkQueue::pushResult(unsigned Worker, const WorkResult &Result) {
+  assert(Worker < NumWorkers && "Bad worker");
+  ResultRing &Ring = Rings[Worker];
+  // There is always room, since the main process has at most Capacity runs
+  // pending.
+  uint64_t Tail = Ring.Tail.load(std::memory_order_relaxed);
+  WorkResult &Slot = getResult(Worker, Tail);
+  Slot.Id = Result.Id;
+  Slot.Size = Result.Size;
+  memcpy(Slot.Data, Result.Data, Result.Size);
+  Ring.Tail.store(Tail + 1, std::memory_order_release);
+  // This only enters the kernel if the main process is asleep.
+  sem_post(&Sh->NumResults);
+}
+
+bool WorkQueue::popResult(WorkResult &Result, double Secs) {
+  // Don't look up the time unless we have to sleep.
+  if (sem_trywait(&Sh->NumResults) != 0) {
+    struct timespec Deadline;
+    clock_gettime(CLOCK_REALTIME, &Deadline);
+    long Nsecs = Deadline.tv_nsec + (long)(Secs * 1e9);
+    Deadline.tv_sec += Nsecs / 1000000000;
+    Deadline.tv_nsec = Nsecs % 1000000000;
+    while (sem_timedwait(&Sh->NumResults, &Deadline) != 0) {
+      if (errno == ETIMEDOUT)
+        return false;
+      if (errno != EINTR)
+        die("sem_timedwait() failed.");
+    }
+  }
+  // The post follows the push, so one of the rings has a result.
+  for (unsigned Cnt = 0;; ++Cnt) {
+    unsigned Worker = (NextRing + Cnt) % NumWorkers;
+    ResultRing &Ring = Rings[Worker];
+    uint64_t Head = Ring.Head.load(std::memory_order_relaxed);
+    if (Ring.Tail.load(std::memory_order_acquire) == Head)
+      continue;
+    const WorkResult &Slot = getResult(Worker, Head);
+    Result.Id = Slot.Id;
+    Result.Size = Slot.Size;
+    memcpy(Result.Data, Slot.Data, Slot.Size);
+    Ring.Head.store(Head + 1, std::memory_order_release);
+    NextRing = (Worker + 1) % NumWorkers;
+    return true;
+  }
+}
@@ -0,0 +1,139 @@
+//-*- C++ -*-
+// The queues between the main process and its worker processes.
+//
+// Copyright (C) 2019 Vasileios Porpodas <v.porpodas at gmail.com>
+//
+// This file is part of ZOFI.
+//
+// ZOFI is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2, or (at your option) any later
+// version.
+// GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+// You should have received a copy of the GNU General Public License
+// along with GCC; see the file LICENSE.  If not see
+// <http://www.gnu.org/licenses/>.
+
+#ifndef __WORKQUEUE_H__
+#define __WORKQUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <semaphore.h>
+#include <sys/types.h>
+
+/// A run that the main process asks a worker to do.
+struct WorkRequest {
+  /// The id of the run, or -1 to make the worker exit.
+  long Id = -1;
+  /// The rand() seed of the run.
+  unsigned Seed = 0;
+  /// The checkpoint to clone the run from, or -1 for none.
+  int CheckpointIdx = -1;
+  /// The clone of the checkpoint's server to adopt, or 0 if none.
+  pid_t HandoverPID = 0;
+  /// The infinite execution timeout of the run in seconds, or negative for
+  /// the default.
+  double InfExecTimeout = -1.0;
+};
+
+/// The result of a run, as sent back by a worker.
+struct WorkResult {
+  /// The maximum size of the result data.
+  static constexpr const size_t MaxSize = 16384;
+  /// The id of the run.
+  long Id = -1;
+  /// The size of Data.
+  size_t Size = 0;
+  /// The data written by the worker, see JobSchedulerBase::writeResult().
+  char Data[MaxSize];
+};
+
+/// A queue of WorkRequests from the main process to the workers, and a ring
+/// of WorkResults back from each worker, all in shared memory. Create it
+/// before forking the workers. Each queue and ring holds up to Capacity
+/// entries, so the main process must not have more than Capacity runs
+/// pending.
+class WorkQueue {
+  /// The results of a worker. Only the worker pushes to it and only the main
+  /// process pops from it, so they need no lock. The indexes are on their own
+  /// cache lines, so that the two sides don't keep stealing each other's.
+  struct ResultRing {
+    /// The next result to push.
+    alignas(64) std::atomic<uint64_t> Tail;
+    /// The next result to pop.
+    alignas(64) std::atomic<uint64_t> Head;
+  };
+
+  /// A request and its sequence number, as in Vyukov's bounded queue. The
+  /// slot of request N holds N while it is free for it, N + 1 once it has
+  /// been written, and N + Capacity once a worker has copied it out, which
+  /// frees it for request N + Capacity.
+  struct RequestSlot {
+    std::atomic<uint64_t> Seq;
+    WorkRequest Req;
+  };
+
+  /// The part in shared memory.
+  struct Shared {
+    /// Counts the requests that have been pushed but not popped.
+    sem_t NumRequests;
+    /// The next request to pop, shared by the workers.
+    std::atomic<uint64_t> RequestHead;
+    /// Counts the results that have been pushed but not popped, across all
+    /// rings. The main process only sleeps on it when there are none.
+    sem_t NumResults;
+  };
+
+  /// The number of entries of each queue.
+  unsigned Capacity = 0;
+
+  /// The number of result rings.
+  unsigned NumWorkers = 0;
+
+  /// The mapping that holds the Shared part and all the queues.
+  void *Mem = nullptr;
+  size_t MemSize = 0;
+
+  Shared *Sh = nullptr;
+  RequestSlot *Requests = nullptr;
+  ResultRing *Rings = nullptr;
+  WorkResult *Results = nullptr;
+
+  /// The next request to push. Only the main process pushes requests.
+  uint64_t RequestTail = 0;
+  /// The ring that the main process looks at first for the next result, so
+  /// that a busy worker does not starve the others.
+  unsigned NextRing = 0;
+
+  /// \Returns entry \p Idx of the ring of \p Worker.
+  WorkResult &getResult(unsigned Worker, uint64_t Idx) {
+    return Results[Worker * Capacity + Idx % Capacity];
+  }
+
+public:
+  WorkQueue(unsigned Capacity, unsigned NumWorkers);
+  WorkQueue(const WorkQueue &) = delete;
+  ~WorkQueue();
+
+  /// Main process: queue \p Req for the first free worker. If its slot still
+  /// holds an older request that a worker has claimed but not copied out yet,
+  /// wait for it.
+  void pushRequest(const WorkRequest &Req);
+
+  /// Worker: block until there is a request and pop it into \p Req.
+  void popRequest(WorkRequest &Req);
+
+  /// Worker \p Worker: queue \p Result for the main process.
+  void pushResult(unsigned Worker, const WorkResult &Result);
+
+  /// Main process: wait up to \p Secs seconds for a result and pop it into
+  /// \p Result. \Returns false if there was none.
+  bool popResult(WorkResult &Result, double Secs);
+};
+
+#endif //__WORKQUEUE_H__
@@ -17,12 +17,22 @@
 // <http://www.gnu.org/licenses/>.
 
 #define _DEBUG
+#include "checkpoint.h"
+#include "convergence.h"
 #include "config.h"
+#include "cpuPlacement.h"
 #include "debugstream.h"
+#include "disassembler.h"
+#include "elfFile.h"
+#include "forkServer.h"
+#include "funcScope.h"
+#include "instrCounter.h"
 #include "optionsList.h"
 #include "runner.h"
+#include "runtimeDistribution.h"
 #include "threads.h"
 #include "utils.h"
+#include <algorithm>
 
 // Environmental variables.
 char **Envp = nullptr;
@@ -40,28 +50,68 @@ int main(int argc, char **argv, char **envp) {
   Dbg(1) << Options.getValuesStr();
   Dbg(1) << "---------------------\n";
 
+  // Pin the main process before it forks anything, so that only the jobs run
+  // on their CPUs.
+  CpuPlacement::get().init(CpuPlacementPolicy.getValue(), Jobs.getValue());
+
+  // Fail early if there is no instruction counter.
+  if (InjectByInstrCount.getValue())
+    InstrCounter::checkAvailable();
+
+  // Launch the workload once and clone the runs from it.
+  ForkServer Server;
+  if (UseForkServer.getValue() || NumCheckpoints.getValue() > 0 ||
+      ConvergenceInterval.getValue() > 0)
+    Server.start();
+  // Random bytes would make the memory of the runs differ.
+  if (ConvergenceInterval.getValue() > 0)
+    Server.trapGetrandom();
+  ForkServer *ServerPtr = Server.isRunning() ? &Server : nullptr;
+
   // If the user has not set the execution time of the binary, run once to
   // measure time and collect stdout, stderr.
   // This run blocks until the execution has finished.
   ExecutionExitState OrigState;
 
+  // The golden output is kept in memory by the main process, so that it
+  // outlives the job that writes it.
+  ExecutionExitState Golden;
+  bool UseGolden = ExecutionExitState::useMemFiles() && !NoRedirect.getValue();
+  if (UseGolden)
+    Golden.initFiles(-1);
+
   // Note: This holds the exit state of the original runs. So its lifetime
   // should reach the execution of the test runs.
-  OrigJobScheduler OrigJS;
+  OrigJobScheduler OrigJS(ServerPtr, UseGolden ? &Golden : nullptr);
+  // The runtimes that set the timeout with -adaptive-timeout.
+  RuntimeDistribution Runtimes;
   // We run the original if we do not override either of: i. the bin execution
   // time, or ii. the exit state.
+  // The adaptive timeout needs the runtimes of the original runs.
   if (!DisableTimingRun.getValue() &&
-      (!BinExecTime.isSet() || !SetOrigExitState.isSet())) {
+      (!BinExecTime.isSet() || !SetOrigExitState.isSet() ||
+       AdaptiveTimeout.getValue())) {
     Dbg(1) << "-- Original (Timing) Run --\n";
 
     auto OrigStart = getTime();
     // We spawn multiple process jobs even for the timing run, because modern
     // processors will turbo-boost when running on a single thread.
     unsigned NumOrigJobs = std::min(Jobs.getValue(), TestRuns.getValue());
+    // The adaptive timeout needs a few samples to start from.
+    if (AdaptiveTimeout.getValue())
+      NumOrigJobs = std::max(NumOrigJobs, AdaptiveTimeoutSamples.getValue());
 
     OrigJS.run(NumOrigJobs);
 
     double Duration = getTimeDiff(OrigStart, getTime());
+    // The runs may not all fit in a single batch of jobs, so use the slowest.
+    if (AdaptiveTimeout.getValue()) {
+      const auto &RunTimes = OrigJS.getRunTimes();
+      Duration = *std::max_element(RunTimes.begin(), RunTimes.end());
+      for (double RunTime : RunTimes)
+        Runtimes.add(RunTime);
+      Dbg(1) << "Initial InfExec Timeout: " << Runtimes.getTimeout() << "s\n";
+    }
     Dbg(1).precision(3) << "Original Duration: " << Duration << "s\n\n";
     // Don't override bin execution time if provided by user
     if (!BinExecTime.isSet())
@@ -73,6 +123,14 @@ int main(int argc, char **argv, char **envp) {
     Dbg(2) << " Time: " << BinExecTime.getValue() << "s.\n";
 
     OrigState = OrigJS.getOrigExitState();
+    // All test runs read the golden output, but none may change it.
+    if (UseGolden)
+      OrigState.seal();
+
+    if (InjectByInstrCount.getValue() && !BinInstrCount.isSet()) {
+      BinInstrCount.setValue(OrigJS.getOrigInstrCount());
+      Dbg(1) << "Original Instructions: " << BinInstrCount.getValue() << "\n";
+    }
   }
 
   // Sanity check.
@@ -80,8 +138,14 @@ int main(int argc, char **argv, char **envp) {
     userDie("No orig execution time available. Either remove "
             "-disable-timing-run, or set the -bin-exec-time\n");
 
+  if (InjectByInstrCount.getValue() && BinInstrCount.getValue() == 0 &&
+      !UserInjectionInstr.isSet() && TestRuns.getValue() != 0)
+    userDie("No orig instruction count available. Either remove "
+            "-disable-timing-run, or set the -bin-instr-count\n");
+
   // Print a warning message if the execution time is too low.
-  if (BinExecTime.getValue() < 0.05)
+  // Injecting by instruction count does not depend on timing.
+  if (BinExecTime.getValue() < 0.05 && !InjectByInstrCount.getValue())
     warning("WARNING: Binary execution time ", BinExecTime.getValue(),
             "s is very low. The results may not be accurate, and " __BIN_NAME__
             " may fail.");
@@ -91,20 +155,74 @@ int main(int argc, char **argv, char **envp) {
   if (SetOrigExitState.isSet())
     OrigState.import(SetOrigExitState.getValue());
 
+  // Digest the golden outputs once, instead of reading them in every test run.
+  if (!DiffCmd.isSet() && !NoRedirect.getValue() && TestRuns.getValue() != 0 &&
+      OrigState.getStdoutFile()[0] != '\0')
+    OrigState.computeDigests();
+
   Statistics Stats;
   assert(BinExecTime.isSet() && "Expected orig exec time.");
   Stats.set<double>(Type::OrigExecTime, BinExecTime.getValue());
 
+  // Run the golden process once more, to take checkpoints along the way.
+  CheckpointSet Checkpoints;
+  if (NumCheckpoints.getValue() > 0 && TestRuns.getValue() != 0) {
+    Dbg(1) << "-- Checkpoint Run --\n";
+    Checkpoints.create(ServerPtr, NumCheckpoints.getValue());
+  }
+
+  // Run the golden process once more, to record the fingerprints of its state.
+  ConvergenceSet Convergence;
+  if (ConvergenceInterval.getValue() > 0 && TestRuns.getValue() != 0) {
+    Dbg(1) << "-- Convergence Run --\n";
+    Convergence.create(ServerPtr, ConvergenceInterval.getValue());
+  }
+
+  // The jobs inherit the disassembler, and share its cache of decoded
+  // instructions and its indexes.
+  Disassembler &Disasm = Disassembler::get();
+  if (DecodeIndexDir.isSet() && TestRuns.getValue() != 0) {
+    Dbg(1) << "-- Decode Index --\n";
+    // The files are looked up by the paths in /proc/<pid>/maps.
+    char BinPath[PATH_MAX];
+    if (realpath(Binary.getValue(), BinPath) == nullptr)
+      userDie("Error accessing file '", Binary.getValue(), "'.");
+    std::vector<std::string> Files = {BinPath};
+    if (DecodeIndexLibs.getValue()) {
+      std::vector<std::string> Libs = ElfFile(BinPath).getNeededLibs();
+      Files.insert(Files.end(), Libs.begin(), Libs.end());
+    }
+    Disasm.loadIndexes(Files, DecodeIndexDir.getValue());
+  }
+
+  // The jobs inherit the functions to inject to.
+  if (InjectToFunctions.isSet() && TestRuns.getValue() != 0) {
+    char BinPath[PATH_MAX];
+    if (realpath(Binary.getValue(), BinPath) == nullptr)
+      userDie("Error accessing file '", Binary.getValue(), "'.");
+    std::vector<std::string> Files = ElfFile(BinPath).getNeededLibs();
+    Files.insert(Files.begin(), BinPath);
+    if (FunctionScope::get().resolve(Files, InjectToFunctions.getValue()) == 0)
+      userDie("Error: No function matches '", InjectToFunctions.getValue(),
+              "' in the symbols of the binary and its libraries.");
+  }
+
   // Run all tests.
   Dbg(1) << "-- Test Runs --\n";
 
   auto TimeBeginTests = getTime();
-  TestJobScheduler TestJS(&OrigState, &Stats);
+  TestJobScheduler TestJS(&OrigState, &Stats, ServerPtr, &Checkpoints,
+                          &Convergence,
+                          AdaptiveTimeout.getValue() ? &Runtimes : nullptr);
   TestJS.run(TestRuns.getValue());
   auto TimeEndTests = getTime();
+  if (AdaptiveTimeout.getValue())
+    Stats.setInfExecTimeout(Runtimes.getTimeout(),
+                            Runtimes.getFalseInfExecRisk());
 
   // Remove temporary files of original run
-  if (!NoCleanup.getValue() && !SetOrigExitState.isSet())
+  if (!NoCleanup.getValue() && !SetOrigExitState.isSet() &&
+      !OrigState.isInMemory())
     for (const char *File :
          {OrigState.getStdoutFile(), OrigState.getStderrFile()})
       if (File[0] != '\0')
@@ -0,0 +1,14 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -adaptive-timeout -test-runs 4 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -adaptive-timeout -test-runs 4 -v 1 -no-progress-bar -injections-per-run 0 2>&1 | %GREP 'False InfExec *: [0-9.]*% (est.)' 2>&1 > /dev/null
+
+// Checks that the timeout set from the measured runtimes does not cut short
+// the runs that complete normally, and that its risk gets reported.
+
+#include <stdio.h>
+#include <unistd.h>
+
+int main() {
+  usleep(100000);
+  printf("Done\n");
+  return 0;
+}
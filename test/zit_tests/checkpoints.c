@@ -0,0 +1,23 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -checkpoints 4 -test-runs 10 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -checkpoints 4 -test-runs 10 -j 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %ZOFI -bin %UNIQUE_FILE -checkpoints 4 -test-runs 4 -injection-time 0.15 -v 2 -no-progress-bar 2>&1 | awk '/takeCheckpoint/{sub(/s,$/, "", $6); if ($6 + 0 <= 0.15) C = $6 + 0} /Injected </{sub(/s$/, "", $5); ++I; if ($5 + C < 0.149 || $5 + C > 0.151) Bad = 1} END{print (C > 0 && I > 0 && !Bad)}' | %EQUALS 1
+
+// Tests that runs cloned from checkpoints of the golden run produce the same
+// stdout and stderr, including the output printed before the checkpoint. A
+// run with a fixed -injection-time starts from the latest checkpoint before
+// it, so it should inject that much time after the checkpoint.
+
+#include <stdio.h>
+int main() {
+  volatile long sum = 0;
+  int i;
+  long j;
+  for (i = 0; i != 20; ++i) {
+    for (j = 0; j != 10000000; ++j)
+      sum += j;
+    printf("stdout %d %ld\n", i, sum);
+    fflush(stdout);
+    fprintf(stderr, "stderr %d\n", i);
+  }
+  return 0;
+}
@@ -0,0 +1,29 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 4 -v 2 -no-progress-bar 2>&1 | awk '/Read [0-9]+ of 15 bytes at/{++Partial} /Injected </{++I} END{print (Partial > 0 && I > 0)}' | %EQUALS 1
+
+// Checks that reading the code of an instruction close to the end of the
+// mapped memory returns the bytes before the unmapped page, so that the
+// injection can still decode it. The workload spends its time in a loop that
+// is copied to the last bytes of a page, followed by a page that we unmap.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int main() {
+  // loop: dec %rdi; jnz loop; ret
+  static const unsigned char Code[] = {0x48, 0xff, 0xcf, 0x75, 0xfb, 0xc3};
+  long PageSize = sysconf(_SC_PAGESIZE);
+  unsigned char *Pages = mmap(NULL, 2 * PageSize,
+                              PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Pages == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  munmap(Pages + PageSize, PageSize);
+  unsigned char *Loop = Pages + PageSize - sizeof(Code);
+  memcpy(Loop, Code, sizeof(Code));
+  ((void (*)(unsigned long))Loop)(500000000UL);
+  return 0;
+}
@@ -0,0 +1,28 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -convergence-interval 5 -test-runs 4 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -convergence-interval 5 -test-runs 1 -v 1 -no-progress-bar -injections-per-run 0 2>&1 | %GREP 'Convergence points: [1-9]' 2>&1 > /dev/null
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -convergence-interval 5 -test-runs 8 -v 2 -no-progress-bar 2>&1 | %GREP 'CHECK: Masked (converged with the original run)' > /dev/null
+
+// Checks that the golden run records the fingerprints for the convergence
+// checks, that the runs still work with getrandom() trapped, and that runs
+// with a fault are stopped early as Masked once they converge. The work
+// between the lines spreads the injections over the fingerprints.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main() {
+  // The first malloc() calls getrandom().
+  char *Buff = malloc(64);
+  int i;
+  for (i = 0; i != 200; ++i) {
+    volatile unsigned long Sum = 0;
+    unsigned long J;
+    for (J = 0; J != 20000; ++J)
+      Sum += J;
+    snprintf(Buff, 64, "Line %d\n", i);
+    fputs(Buff, stdout);
+    fflush(stdout);
+  }
+  free(Buff);
+  return 0;
+}
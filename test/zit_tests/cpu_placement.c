@@ -0,0 +1,43 @@
+// RUN: %CC %THIS_FILE -lpthread -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 4 -j 0 -v 1 -no-progress-bar -injections-per-run 0 -cpu-placement core | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 4 -j 0 -v 1 -no-progress-bar -injections-per-run 0 -cpu-placement thread -fork-server | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: rm -f %UNIQUE_FILE.cpus && CPU=$(%ZOFI -bin %UNIQUE_FILE -test-runs 2 -j 1 -v 2 -no-progress-bar -injections-per-run 0 -cpu-placement core -args %UNIQUE_FILE.cpus 2>&1 | grep -o "workload on CPU [0-9]*" | grep -o "[0-9]*$") && test -n "$CPU" && test "$(cat %UNIQUE_FILE.cpus)" = "$CPU" && rm -f %UNIQUE_FILE.cpus
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 4 -j 0 -v 1 -no-progress-bar -cpu-placement core -args threads 2>&1 | grep -c "runs all of its threads on a single CPU" | %EQUALS 1
+
+// Checks that pinning the jobs does not change the outcomes, that the workload
+// runs on the CPU that it was given, and that we warn once if the workload
+// starts threads, which then all share that CPU.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static volatile unsigned long Sum = 0;
+
+static void *loop(void *Arg) {
+  for (unsigned long I = 0; I != 1000000; ++I)
+    Sum += I;
+  return Arg;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "threads") == 0) {
+    pthread_t Thread;
+    pthread_create(&Thread, NULL, loop, NULL);
+    loop(NULL);
+    pthread_join(Thread, NULL);
+    return 0;
+  }
+  // Save the CPUs that we are allowed to run on.
+  if (argc > 1) {
+    char Line[256];
+    FILE *Status = fopen("/proc/self/status", "r");
+    FILE *Out = fopen(argv[1], "w");
+    while (fgets(Line, sizeof(Line), Status) != NULL)
+      if (strncmp(Line, "Cpus_allowed_list:", 18) == 0)
+        fprintf(Out, "%s", Line + 18 + strspn(Line + 18, " \t"));
+    fclose(Out);
+    fclose(Status);
+  }
+  loop(NULL);
+  return 0;
+}
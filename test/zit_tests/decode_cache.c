@@ -0,0 +1,14 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 10 -j 2 -v 2 -no-progress-bar 2>&1 | awk '/begin on worker/{++J} / added to the decode cache/{Added[$4] = J} / found in the decode cache/{if (($4 in Added) && Added[$4] != J) ++Shared} END{print (Shared > 0)}' | %EQUALS 1
+
+// Checks that the decoded instructions are shared across jobs: an injection
+// should find in the cache code that was decoded and added by an earlier job.
+// The injections land in a short loop, so they keep hitting the same few
+// instructions.
+
+int main() {
+  volatile unsigned long Sum = 0;
+  unsigned long I;
+  for (I = 0; I != 10000000; ++I)
+    Sum += I;
+  return 0;
+}
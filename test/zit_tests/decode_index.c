@@ -0,0 +1,13 @@
+// RUN: rm -rf %UNIQUE_FILE.idx && %CC -Wl,--build-id %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -decode-index %UNIQUE_FILE.idx -test-runs 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100 && test -n "$(ls %UNIQUE_FILE.idx/*.idx)"
+// RUN: %ZOFI -bin %UNIQUE_FILE -decode-index %UNIQUE_FILE.idx -test-runs 2 -v 1 -no-progress-bar -injections-per-run 0 2>&1 | grep "Loaded index" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -decode-index %UNIQUE_FILE.idx -decode-index-libs -test-runs 4 -v 2 -no-progress-bar 2>&1 | grep "found in the index" > /dev/null && rm -rf %UNIQUE_FILE.idx
+
+// Checks that -decode-index saves the index of the binary, named after its
+// build-id, that the next campaign loads it instead of creating it again, and
+// that the injections look up their instructions in it.
+
+#include <stdio.h>
+int main() {
+  printf("Hello\n");
+  return 0;
+}
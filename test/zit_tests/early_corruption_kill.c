@@ -0,0 +1,14 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -early-corruption-kill -test-runs 2 -v 1 -no-progress-bar -injections-per-run 0 -bin-exec-time 60 -disable-timing-run -set-orig-exit-state /dev/null,/dev/null,exited:0 2>&1 | %GET_OUTCOME Corrupted % | %EQUALS 100
+
+// Checks that a run whose output differs from the original output is killed
+// as soon as it prints, instead of running until it exits.
+
+#include <stdio.h>
+#include <unistd.h>
+
+int main() {
+  printf("Not in the original output\n");
+  fflush(stdout);
+  sleep(60);
+  return 0;
+}
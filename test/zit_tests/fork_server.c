@@ -0,0 +1,31 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -fork-server -test-runs 10 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -fork-server -test-runs 10 -j 2 -v 1 -no-progress-bar -injections-per-run 0 -args test1 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -fork-server -test-runs 1 -v 1 -no-progress-bar -injections-per-run 0 -no-redirect -args test1 2>&1 | %GREP -z 'argc:2.*argv1:test1' 2>&1 > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -fork-server -test-runs 4 -v 2 -no-progress-bar -args work 2>&1 | awk '/ChildPID [0-9a-f]+ \(clone\)/{C++} /ChildPID [0-9a-f]+$/{E++} /Injected </{I++} END{print (C > 0 && E == 0 && I > 0)}' | %EQUALS 1
+// RUN: %ZOFI -bin %UNIQUE_FILE -fork-server -test-runs 1 -v 2 -no-progress-bar -injections-per-run 0 2>&1 | grep "Fork server stopped at main()" > /dev/null
+// RUN: strip -o %UNIQUE_FILE.stripped %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE.stripped -fork-server -test-runs 2 -v 2 -no-progress-bar -injections-per-run 0 -args test1 2>&1 | grep -c "No symbol for main(), the fork server stays at the entry point" | %EQUALS 1 && rm -f %UNIQUE_FILE.stripped
+
+// Tests that runs cloned from the fork server get their arguments and that
+// their stdout and stderr are redirected correctly. With "work" the workload
+// runs long enough to inject to, and every run, including the ones that
+// inject, should be a clone of the fork server rather than a new exec. The
+// server should stop at main(), or at the entry point if the binary is
+// stripped.
+
+#include <stdio.h>
+#include <string.h>
+int main(int argc, char **argv) {
+  printf("argc:%d\n", argc);
+  int i;
+  for (i = 1; i != argc; ++i)
+    printf("argv%d:%s\n", i, argv[i]);
+  fprintf(stderr, "stderr\n");
+  if (argc == 2 && strcmp(argv[1], "work") == 0) {
+    volatile unsigned long Sum = 0;
+    unsigned long I;
+    for (I = 0; I != 10000000; ++I)
+      Sum += I;
+    printf("sum:%lu\n", Sum);
+  }
+  return 0;
+}
@@ -0,0 +1,25 @@
+// RUN: %CXX -I $(dirname %THIS_FILE)/../../src %THIS_FILE -o %UNIQUE_FILE && %UNIQUE_FILE | %EQUALS 0
+
+// Checks that hashBytes(), which fingerprints the state of a run for the
+// convergence checks, tells apart two states that differ only in bit 63 of
+// two words, like a register and the copy of it that was pushed on the stack.
+// Prints the number of collisions.
+
+#include "utils.h"
+#include <cstdio>
+
+int main() {
+  const uint64_t Top = 1ull << 63;
+  unsigned Collisions = 0;
+  for (unsigned I = 0; I != 8; ++I)
+    for (unsigned J = I + 1; J != 8; ++J) {
+      uint64_t Golden[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+      uint64_t Faulty[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+      Faulty[I] ^= Top;
+      Faulty[J] ^= Top;
+      if (hashBytes(Golden, sizeof(Golden)) == hashBytes(Faulty, sizeof(Faulty)))
+        ++Collisions;
+    }
+  printf("%u\n", Collisions);
+  return 0;
+}
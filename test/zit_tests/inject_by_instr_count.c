@@ -0,0 +1,18 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && { %ZOFI -bin %UNIQUE_FILE -inject-by-instr-count -test-runs 1 -v 1 -no-progress-bar -injections-per-run 0 2>&1 | grep "Failed to count instructions" > /dev/null && echo "No instruction counter, skipping" || %ZOFI -bin %UNIQUE_FILE -inject-by-instr-count -injection-instr 1000000 -test-runs 4 -v 2 -no-progress-bar 2>&1 | awk '/Stopped [0-9]+ after [0-9]+ instructions/{++N; if ($6 < 1000000 || $6 > 1100000) Bad = 1} END{print (N >= 4 && !Bad)}' | %EQUALS 1; }
+// RUN: { %ZOFI -bin %UNIQUE_FILE -injection-instr 1000000 -test-runs 1 -no-progress-bar 2>&1; true; } | grep "'-injection-instr' requires '-inject-by-instr-count'" > /dev/null
+// RUN: { %ZOFI -bin %UNIQUE_FILE -inject-by-instr-count -checkpoints 4 -test-runs 1 -no-progress-bar 2>&1; true; } | grep "Cannot enable both '-inject-by-instr-count' and '-checkpoints'" > /dev/null
+
+// Checks that -injection-instr stops the runs at the requested instruction
+// count, give or take the skid of the counter overflow. The hardware counter
+// is not available everywhere, e.g. in most VMs, so the first test is skipped
+// if zofi cannot count instructions. The other tests check that
+// -injection-instr is rejected without -inject-by-instr-count, and that
+// -inject-by-instr-count is rejected with -checkpoints.
+
+int main() {
+  volatile unsigned long Sum = 0;
+  unsigned long I;
+  for (I = 0; I != 10000000; ++I)
+    Sum += I;
+  return 0;
+}
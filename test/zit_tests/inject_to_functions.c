@@ -0,0 +1,27 @@
+// RUN: %CC -O1 %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -inject-to-functions cold -test-runs 4 -v 2 -no-progress-bar 2>&1 | grep "reached" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -inject-to-functions cold -max-injection-attempts 3 -test-runs 4 -v 1 -no-progress-bar | grep "Masked" > /dev/null
+
+// Checks that -inject-to-functions runs to the selected function, which
+// takes a small part of the runtime, with a breakpoint and injects into it
+// without running out of injection attempts.
+
+#include <stdio.h>
+__attribute__((noinline)) unsigned long cold(unsigned long X) {
+  unsigned long Sum = 0;
+  for (unsigned long I = 0; I != 50; ++I)
+    Sum += X * I;
+  return Sum;
+}
+__attribute__((noinline)) unsigned long hot(unsigned long X) {
+  unsigned long Sum = 0;
+  for (unsigned long I = 0; I != 2000; ++I)
+    Sum += X ^ I;
+  return Sum;
+}
+int main() {
+  volatile unsigned long Sum = 0;
+  for (unsigned long Iter = 0; Iter != 200000; ++Iter)
+    Sum += hot(Iter) + cold(Iter);
+  printf("%lu\n", (unsigned long)Sum);
+  return 0;
+}
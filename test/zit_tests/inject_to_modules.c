@@ -0,0 +1,31 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -no-inject-to-modules "$(basename %UNIQUE_FILE)" -test-runs 4 -v 2 -no-progress-bar 2>&1 | grep "excluded module" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -inject-to-modules "libc*" -test-runs 4 -v 2 -no-progress-bar 2>&1 | grep "excluded module" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -inject-to-modules "$(basename %UNIQUE_FILE)" -test-runs 8 -v 2 -no-progress-bar 2>&1 | grep -o "Injected to module .*" | sort -u | tr -d '\n' | grep -x "Injected to module $(basename %UNIQUE_FILE)" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -inject-to-modules "[vdso]" -test-runs 8 -v 2 -no-progress-bar -args vdso 2>&1 | grep -o "Injected to module .*" | sort -u | tr -d '\n' | grep -x "Injected to module \[vdso\]" > /dev/null
+
+// Checks that the injection points in the binary are skipped both when it is
+// excluded with -no-inject-to-modules and when it is not in the modules of
+// -inject-to-modules, and that the faults land only in the selected modules.
+// The loop keeps the workload in both the binary and libc. With an argument
+// it keeps the workload in the vdso, whose name is not a valid glob.
+
+#include <string.h>
+#include <time.h>
+static char Buf[1 << 16];
+int main(int argc, char **argv) {
+  volatile unsigned long Sum = 0;
+  if (argc > 1) {
+    struct timespec TS;
+    for (int Iter = 0; Iter != 2000000; ++Iter) {
+      clock_gettime(CLOCK_MONOTONIC, &TS);
+      Sum += TS.tv_nsec;
+    }
+    return 0;
+  }
+  for (int Iter = 0; Iter != 20000; ++Iter) {
+    memset(Buf, Iter, sizeof(Buf));
+    for (unsigned long I = 0; I != 2000; ++I)
+      Sum += I;
+  }
+  return 0;
+}
@@ -0,0 +1,12 @@
+// RUN: rm -f %UNIQUE_FILE.out.* && %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -stdout-path %UNIQUE_FILE.out -test-runs 3 -j 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100 && test -z "$(ls %UNIQUE_FILE.out.* 2>/dev/null)"
+// RUN: rm -f %UNIQUE_FILE.out.* && %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -stdout-path %UNIQUE_FILE.out -test-runs 3 -v 1 -no-progress-bar -injections-per-run 0 -no-cleanup | %GET_OUTCOME Masked % | %EQUALS 100 && test -n "$(ls %UNIQUE_FILE.out.* 2>/dev/null)" && rm -f %UNIQUE_FILE.out.*
+
+// Checks that the outputs are captured in memory, with no files written
+// unless -no-cleanup asks to keep them.
+
+#include <stdio.h>
+int main() {
+  for (int i = 0; i < 1000; ++i)
+    printf("Line %d\n", i);
+  return 0;
+}
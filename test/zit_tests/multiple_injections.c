@@ -0,0 +1,10 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -injections-per-run 3 -test-runs 2 -v 1 -no-progress-bar 2>&1 | %GREP 'Avg. injections *: [1-3]' 2>&1 > /dev/null
+
+// Checks that we can inject more than one fault per run, and that the number
+// of faults injected gets reported.
+
+#include <unistd.h>
+int main() {
+  sleep(1);
+  return 0;
+}
@@ -0,0 +1,13 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 5 -j 2 -v 0 -no-progress-bar -out-runs-csv %UNIQUE_FILE.csv && grep -c "^[0-9]*, [A-Za-z]*, [0-9.e-]*, [01], " %UNIQUE_FILE.csv | %EQUALS 5 && grep ", 0x[0-9a-f]*, [a-z0-9]*, [0-9]*$" %UNIQUE_FILE.csv > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 3 -v 0 -no-progress-bar -injections-per-run 0 -out-runs-csv %UNIQUE_FILE.csv && grep -c "^[0-9]*, Masked, [0-9.e-]*, 0, , , , , , $" %UNIQUE_FILE.csv | %EQUALS 3
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 6 -v 0 -no-progress-bar -injections-per-run 3 -out-runs-csv %UNIQUE_FILE.csv && awk -F', ' 'NR > 1 && $4 > 0 { Lines[$1]++; Faults[$1] = $4; if ($5 != Lines[$1] - 1) Bad = 1; if ($4 > 1) Multi = 1 } END { for (Run in Lines) if (Lines[Run] != Faults[Run]) Bad = 1; exit Bad || !Multi }' %UNIQUE_FILE.csv && rm -f %UNIQUE_FILE.csv
+
+// Checks that -out-runs-csv writes a line per run, or one per fault of the
+// run if it has any, numbered in the order they were injected.
+
+int main() {
+  volatile unsigned long Sum = 0;
+  for (unsigned long I = 0; I != 10000000; ++I)
+    Sum += I;
+  return 0;
+}
@@ -0,0 +1,19 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 4 -j 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -exact-output-compare -test-runs 4 -j 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -DPRINT_PID -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 4 -j 2 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Corrupted % | %EQUALS 100
+
+// Checks the comparison of large outputs against the digest of the original
+// output. With PRINT_PID the outputs have the same length, but differ in their
+// last line.
+
+#include <stdio.h>
+#include <unistd.h>
+
+int main() {
+  for (int i = 0; i < 200000; ++i)
+    printf("Line %08d\n", i);
+#ifdef PRINT_PID
+  printf("%08ld\n", (long)getpid());
+#endif
+  return 0;
+}
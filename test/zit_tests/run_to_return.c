@@ -0,0 +1,19 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -no-inject-to-libs -run-to-return -test-runs 4 -v 2 -no-progress-bar 2>&1 | grep "Running to return address" > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -no-inject-to-libs -run-to-return -max-injection-attempts 5 -test-runs 4 -v 1 -no-progress-bar | grep "Masked" > /dev/null
+
+// Checks that with -run-to-return the runs that stop in memset() of libc run
+// to its return address in the binary and inject there, instead of being
+// restarted until they stop in the binary.
+
+#include <stdio.h>
+#include <string.h>
+static char Buf[1 << 16];
+int main() {
+  volatile unsigned long Sum = 0;
+  for (int Iter = 0; Iter != 200000; ++Iter) {
+    memset(Buf, Iter, sizeof(Buf));
+    Sum += Buf[Iter % sizeof(Buf)];
+  }
+  printf("%lu\n", (unsigned long)Sum);
+  return 0;
+}
@@ -0,0 +1,32 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -seize -test-runs 10 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -seize -fork-server -test-runs 10 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -seize -test-runs 1 -v 1 -no-progress-bar -injections-per-run 0 -no-redirect 2>&1 | %GREP 'Handled:10' 2>&1 > /dev/null
+// RUN: %ZOFI -bin %UNIQUE_FILE -seize -test-runs 4 -v 2 -no-progress-bar -args work 2>&1 | awk '/About to stop [0-9a-f]+ with PTRACE_INTERRUPT/{S++} /About to stop [0-9a-f]+ with a SIGTRAP/{T++} /Injected </{I++} END{print (S > 0 && T == 0 && I > 0)}' | %EQUALS 1
+
+// Tests that with -seize the workload receives the signals that it handles
+// and that it is not stopped by stop signals. With an argument the workload
+// also runs long enough to inject to, and the injections should stop it with
+// PTRACE_INTERRUPT instead of sending it a SIGTRAP.
+
+#include <signal.h>
+#include <stdio.h>
+
+static volatile int Handled = 0;
+
+static void handler(int Sig) { ++Handled; }
+
+int main(int argc, char **argv) {
+  signal(SIGUSR1, handler);
+  int i;
+  for (i = 0; i != 10; ++i)
+    raise(SIGUSR1);
+  raise(SIGSTOP);
+  if (argc > 1) {
+    volatile unsigned long Sum = 0;
+    unsigned long I;
+    for (I = 0; I != 10000000; ++I)
+      Sum += I;
+  }
+  printf("Handled:%d\n", Handled);
+  return 0;
+}
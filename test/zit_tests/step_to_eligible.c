@@ -0,0 +1,16 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -step-to-eligible 100 -max-injection-attempts 5 -test-runs 4 -v 1 -no-progress-bar | grep "Masked" > /dev/null
+
+// Checks that -step-to-eligible steps over the nops, which access no
+// registers, to the add that follows them, instead of restarting the run. If
+// it did not, almost every attempt would fail and we would run out of them.
+
+#include <stdio.h>
+#define NOP4 "nop; nop; nop; nop;"
+#define NOP16 NOP4 NOP4 NOP4 NOP4
+int main() {
+  unsigned long Sum = 0;
+  for (unsigned long Iter = 0; Iter != 100000000; ++Iter)
+    asm volatile(NOP16 NOP16 "add $1, %0" : "+r"(Sum));
+  printf("%lu\n", Sum != 0);
+  return 0;
+}
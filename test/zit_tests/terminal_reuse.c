@@ -0,0 +1,25 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 10 -j 1 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 10 -j 1 -v 1 -no-progress-bar -injections-per-run 0 -vfork-spawn | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -DNO_TTY -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 10 -j 1 -v 1 -no-progress-bar -injections-per-run 0 -no-tty | %GET_OUTCOME Masked % | %EQUALS 100
+
+// Checks that the terminal that all runs of a job share does not fill up with
+// what earlier runs wrote to it, and that with -no-tty there is no terminal.
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+int main() {
+  int fd = open("/dev/tty", O_WRONLY);
+#ifdef NO_TTY
+  return fd == -1 ? 0 : 1;
+#else
+  if (fd == -1)
+    return 1;
+  char buf[1024];
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < 8; ++i)
+    write(fd, buf, sizeof(buf));
+  return 0;
+#endif
+}
@@ -0,0 +1,16 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -vfork-spawn -test-runs 10 -v 1 -no-progress-bar -injections-per-run 0 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -vfork-spawn -test-runs 10 -j 2 -v 1 -no-progress-bar -injections-per-run 0 -args test1 | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -vfork-spawn -test-runs 1 -v 1 -no-progress-bar -injections-per-run 0 -no-redirect -args test1 2>&1 | %GREP -z 'argc:2.*argv1:test1' 2>&1 > /dev/null
+
+// Tests that runs spawned with clone(CLONE_VFORK) get their arguments and that
+// their stdout and stderr are redirected correctly.
+
+#include <stdio.h>
+int main(int argc, char **argv) {
+  printf("argc:%d\n", argc);
+  int i;
+  for (i = 1; i != argc; ++i)
+    printf("argv%d:%s\n", i, argv[i]);
+  fprintf(stderr, "stderr\n");
+  return 0;
+}
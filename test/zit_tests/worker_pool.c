@@ -0,0 +1,17 @@
+// RUN: %CC %THIS_FILE -o %UNIQUE_FILE && %ZOFI -bin %UNIQUE_FILE -test-runs 6 -j 2 -v 2 -no-progress-bar -injections-per-run 0 2>&1 | grep -c "begin on worker" | %EQUALS 7
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 6 -j 1 -v 2 -no-progress-bar -injections-per-run 0 2>&1 | grep -o "ParentPID [0-9]*" | sort -u | wc -l | %EQUALS 2
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 6 -j 2 -v 1 -no-progress-bar -injections-per-run 0 -fork-server | %GET_OUTCOME Masked % | %EQUALS 100
+// RUN: %ZOFI -bin %UNIQUE_FILE -test-runs 20 -j 2 -v 2 -no-progress-bar 2>&1 | awk '/Injected </{I++} /^(Masked|Exception|InfExec|Corrupted) *:/{sub(",", "", $3); N += $3} END{print (I >= 20 && N == 20)}' | %EQUALS 1
+
+// Checks that the workers do all the runs, even when there are more runs than
+// workers, and that they send their outcomes back. The first "begin" and the
+// first ParentPID are those of the original run, while all the test runs of a
+// single job are traced by the same worker process. The outcomes of the runs
+// that inject should all be counted, whichever worker ran them.
+
+int main() {
+  volatile unsigned long Sum = 0;
+  for (unsigned long I = 0; I != 1000000; ++I)
+    Sum += I;
+  return 0;
+}